@@ -77,7 +77,8 @@ list_is_empty(struct list *head)
 	return head->next == head;
 }
 
-#define container_of(ptr, type, member) ptr - __builtin_offsetof(type, member)
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
 
 #define list_entry(ptr, type, member) \
     container_of(ptr, type, member)
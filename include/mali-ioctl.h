@@ -36,6 +36,20 @@ typedef u8 mali_atom_id;
  * check each struct's size against the arg length you see in strace.
  */
 
+/**
+ * Most ioctl structs are also followed by a MALI_IOCTL_<NAME>_FIELDS(FIELD, s)
+ * X-macro, which describes each member for panwrap's generic ioctl decoder.
+ * Every entry is FIELD(s, dir, member, format, aux):
+ *
+ * - dir is IN, OUT or INOUT, depending on who fills the member in
+ * - format is one of DEC, SDEC, HEX, PTR, FLAGS, ENUM, STR or HEXDUMP
+ * - aux names the flag or enum table used by the FLAGS and ENUM formats, and
+ *   is left empty otherwise
+ *
+ * Members used in a descriptor can't be bitfields, since we need to be able
+ * to take their offsets.
+ */
+
 enum mali_ioctl_mem_flags {
 	/* IN */
 	MALI_MEM_PROT_CPU_RD = (1U << 0),      /**< Read access CPU side */
@@ -719,6 +733,83 @@ struct mali_jd_atom_v2 {
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_jd_atom_v2, 48, 48);
 
+/*
+ * What the jc of a MALI_JD_REQ_SOFT_JIT_ALLOC atom points to, in CPU memory.
+ * Once the allocation's made, the kernel writes its GPU VA to gpu_alloc_addr.
+ * JIT_FREE atoms just pass the id in jc.
+ */
+struct mali_jd_jit_alloc_info {
+	u64 gpu_alloc_addr;
+	u64 va_pages;
+	u64 commit_pages;
+	u64 extent;
+	u8 id;
+	u8 padding[7];
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_jd_jit_alloc_info, 40, 40);
+
+/* What the jc of FENCE_TRIGGER and FENCE_WAIT atoms points to, in CPU memory */
+struct mali_jd_fence {
+	s32 fd;
+	s32 stream_fd;
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_jd_fence, 8, 8);
+
+/* What the jc of DUMP_CPU_GPU_TIME atoms points to, in GPU memory. EVENT_*
+ * atoms point to a single byte in GPU memory instead, which is non-zero while
+ * the event is set. */
+struct mali_jd_dump_cpu_gpu_counters {
+	u64 system_time;
+	u64 cycle_counter;
+	u64 sec;
+	u32 usec;
+	u8 padding[36];
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_jd_dump_cpu_gpu_counters, 64, 64);
+
+/**
+ * Events are read() from the device file by userspace, one for each atom that
+ * completes unless the atom's core_req asks for them to be suppressed
+ */
+enum mali_jd_event_code {
+	MALI_JD_EVENT_NOT_STARTED       = 0x00,
+	MALI_JD_EVENT_DONE              = 0x01,
+	MALI_JD_EVENT_STOPPED           = 0x03,
+	MALI_JD_EVENT_TERMINATED        = 0x04,
+	MALI_JD_EVENT_ACTIVE            = 0x08,
+
+	MALI_JD_EVENT_JOB_CONFIG_FAULT  = 0x40,
+	MALI_JD_EVENT_JOB_POWER_FAULT   = 0x41,
+	MALI_JD_EVENT_JOB_READ_FAULT    = 0x42,
+	MALI_JD_EVENT_JOB_WRITE_FAULT   = 0x43,
+	MALI_JD_EVENT_JOB_AFFINITY_FAULT = 0x44,
+	MALI_JD_EVENT_JOB_BUS_FAULT     = 0x48,
+	MALI_JD_EVENT_INSTR_INVALID_PC  = 0x50,
+	MALI_JD_EVENT_INSTR_INVALID_ENC = 0x51,
+	MALI_JD_EVENT_DATA_INVALID_FAULT = 0x58,
+	MALI_JD_EVENT_TILE_RANGE_FAULT  = 0x59,
+	MALI_JD_EVENT_STATE_FAULT       = 0x5A,
+	MALI_JD_EVENT_OUT_OF_MEMORY     = 0x60,
+	MALI_JD_EVENT_UNKNOWN           = 0x7F,
+};
+
+struct mali_jd_event_v2 {
+	u32 event_code; /* enum mali_jd_event_code */
+	mali_atom_id atom_number;
+	u8 :8;
+	u16 :16;
+	struct mali_jd_udata udata;
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_jd_event_v2, 24, 24);
+
+/* Values for the rc field of the ioctl header */
+enum mali_error {
+	MALI_ERROR_NONE = 0,
+	MALI_ERROR_OUT_OF_GPU_MEMORY,
+	MALI_ERROR_OUT_OF_MEMORY,
+	MALI_ERROR_FUNCTION_FAILED,
+};
+
 /**
  * Header used by all ioctls
  */
@@ -739,6 +830,9 @@ struct mali_ioctl_get_version {
 	u32 :32;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_get_version, 16, 16);
+#define MALI_IOCTL_GET_VERSION_FIELDS(FIELD, s) \
+	FIELD(s, OUT, major, DEC, )            \
+	FIELD(s, OUT, minor, DEC, )
 
 struct mali_ioctl_mem_alloc {
 	union mali_ioctl_header header;
@@ -756,17 +850,26 @@ struct mali_ioctl_mem_alloc {
 	u16 :16;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_mem_alloc, 56, 56);
+#define MALI_IOCTL_MEM_ALLOC_FIELDS(FIELD, s)        \
+	FIELD(s, IN,    va_pages,     DEC,   )       \
+	FIELD(s, IN,    commit_pages, DEC,   )       \
+	FIELD(s, IN,    extent,       HEX,   )       \
+	FIELD(s, INOUT, flags,        FLAGS, mem)    \
+	FIELD(s, OUT,   gpu_va,       PTR,   )       \
+	FIELD(s, OUT,   va_alignment, DEC,   )
+
+enum mali_ioctl_mem_import_type {
+	MALI_MEM_IMPORT_TYPE_INVALID = 0,
+	MALI_MEM_IMPORT_TYPE_UMP = 1,
+	MALI_MEM_IMPORT_TYPE_UMM = 2,
+	MALI_MEM_IMPORT_TYPE_USER_BUFFER = 3,
+};
 
 struct mali_ioctl_mem_import {
 	union mali_ioctl_header header;
 	/* [in] */
 	u64 phandle;
-	enum {
-		MALI_MEM_IMPORT_TYPE_INVALID = 0,
-		MALI_MEM_IMPORT_TYPE_UMP = 1,
-		MALI_MEM_IMPORT_TYPE_UMM = 2,
-		MALI_MEM_IMPORT_TYPE_USER_BUFFER = 3,
-	} type :32;
+	u32 type; /* enum mali_ioctl_mem_import_type */
 	u32 :32;
 	/* [in/out] */
 	u64 flags;
@@ -775,6 +878,12 @@ struct mali_ioctl_mem_import {
 	u64 va_pages;
 } __attribute__((packed));
 /* FIXME: Size unconfirmed (haven't seen in a trace yet) */
+#define MALI_IOCTL_MEM_IMPORT_FIELDS(FIELD, s)            \
+	FIELD(s, IN,    phandle,  HEX,   )                \
+	FIELD(s, IN,    type,     ENUM,  mem_import_type) \
+	FIELD(s, INOUT, flags,    FLAGS, mem)             \
+	FIELD(s, OUT,   gpu_va,   PTR,   )                \
+	FIELD(s, OUT,   va_pages, DEC,   )
 
 struct mali_ioctl_mem_commit {
 	union mali_ioctl_header header;
@@ -786,27 +895,39 @@ struct mali_ioctl_mem_commit {
 	u32 :32;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_mem_commit, 32, 32);
+#define MALI_IOCTL_MEM_COMMIT_FIELDS(FIELD, s)     \
+	FIELD(s, IN,  gpu_addr,       PTR, )      \
+	FIELD(s, IN,  pages,          DEC, )      \
+	FIELD(s, OUT, result_subcode, DEC, )
+
+enum mali_ioctl_mem_query_type {
+	MALI_MEM_QUERY_COMMIT_SIZE = 1,
+	MALI_MEM_QUERY_VA_SIZE     = 2,
+	MALI_MEM_QUERY_FLAGS       = 3
+};
 
 struct mali_ioctl_mem_query {
 	union mali_ioctl_header header;
 	/* [in] */
 	PAD_PTR(mali_ptr gpu_addr);
-	enum {
-		MALI_MEM_QUERY_COMMIT_SIZE = 1,
-		MALI_MEM_QUERY_VA_SIZE     = 2,
-		MALI_MEM_QUERY_FLAGS       = 3
-	} query :32;
+	u32 query; /* enum mali_ioctl_mem_query_type */
 	u32 :32;
 	/* [out] */
 	u64 value;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_mem_query, 32, 32);
+#define MALI_IOCTL_MEM_QUERY_FIELDS(FIELD, s)           \
+	FIELD(s, IN,  gpu_addr, PTR,  )                \
+	FIELD(s, IN,  query,    ENUM, mem_query_type)  \
+	FIELD(s, OUT, value,    HEX,  )
 
 struct mali_ioctl_mem_free {
 	union mali_ioctl_header header;
 	PAD_PTR(mali_ptr gpu_addr); /* [in] */
 } __attribute__((packed));
 /* FIXME: Size unconfirmed (haven't seen in a trace yet) */
+#define MALI_IOCTL_MEM_FREE_FIELDS(FIELD, s) \
+	FIELD(s, IN, gpu_addr, PTR, )
 
 struct mali_ioctl_mem_flags_change {
 	union mali_ioctl_header header;
@@ -816,6 +937,10 @@ struct mali_ioctl_mem_flags_change {
 	u64 mask;
 } __attribute__((packed));
 /* FIXME: Size unconfirmed (haven't seen in a trace yet) */
+#define MALI_IOCTL_MEM_FLAGS_CHANGE_FIELDS(FIELD, s) \
+	FIELD(s, IN, gpu_va, PTR,   )               \
+	FIELD(s, IN, flags,  FLAGS, mem)            \
+	FIELD(s, IN, mask,   HEX,   )
 
 struct mali_ioctl_mem_alias {
 	union mali_ioctl_header header;
@@ -829,16 +954,34 @@ struct mali_ioctl_mem_alias {
 	PAD_PTR(mali_ptr gpu_va);
 	u64 va_pages;
 } __attribute__((packed));
+#define MALI_IOCTL_MEM_ALIAS_FIELDS(FIELD, s)       \
+	FIELD(s, INOUT, flags,    FLAGS, mem)      \
+	FIELD(s, IN,    stride,   DEC,   )         \
+	FIELD(s, IN,    nents,    DEC,   )         \
+	FIELD(s, IN,    ai,       HEX,   )         \
+	FIELD(s, OUT,   gpu_va,   PTR,   )         \
+	FIELD(s, OUT,   va_pages, DEC,   )
+
+struct mali_ioctl_mem_jit_init {
+	union mali_ioctl_header header;
+	/* [in] */
+	u64 va_pages;
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_ioctl_mem_jit_init, 16, 16);
+#define MALI_IOCTL_MEM_JIT_INIT_FIELDS(FIELD, s) \
+	FIELD(s, IN, va_pages, DEC, )
+
+enum mali_ioctl_sync_type {
+	MALI_SYNC_TO_DEVICE = 0,
+	MALI_SYNC_TO_CPU = 1,
+};
 
 struct mali_ioctl_sync {
 	union mali_ioctl_header header;
 	PAD_PTR(mali_ptr handle);
 	PAD_PTR(void* user_addr);
 	u64 size;
-	enum {
-		MALI_SYNC_TO_DEVICE = 0,
-		MALI_SYNC_TO_CPU = 1,
-	} type :8;
+	u8 type; /* enum mali_ioctl_sync_type */
 	u64 :56;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_sync, 40, 40);
@@ -864,6 +1007,8 @@ struct mali_ioctl_set_flags {
 	u32 :32;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_set_flags, 16, 16);
+#define MALI_IOCTL_SET_FLAGS_FIELDS(FIELD, s) \
+	FIELD(s, IN, create_flags, HEX, )
 
 struct mali_ioctl_stream_create {
 	union mali_ioctl_header header;
@@ -874,6 +1019,9 @@ struct mali_ioctl_stream_create {
 	u32 :32;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_stream_create, 48, 48);
+#define MALI_IOCTL_STREAM_CREATE_FIELDS(FIELD, s) \
+	FIELD(s, IN,  name, STR,  )              \
+	FIELD(s, OUT, fd,   SDEC, )
 
 struct mali_ioctl_job_submit {
 	union mali_ioctl_header header;
@@ -890,6 +1038,8 @@ struct mali_ioctl_get_context_id {
 	s64 id;
 } __attribute__((packed));
 ASSERT_SIZEOF_TYPE(struct mali_ioctl_get_context_id, 16, 16);
+#define MALI_IOCTL_GET_CONTEXT_ID_FIELDS(FIELD, s) \
+	FIELD(s, OUT, id, HEX, )
 
 #undef PAD_PTR
 
@@ -898,6 +1048,11 @@ typedef struct {
 	union mali_ioctl_header header;
 } __ioctl_placeholder;
 
+/* Compares requests without the size, since that can differ across ABIs */
+#define IOCTL_MATCHES(request, mali_ioctl) \
+	(_IOC_TYPE(request) == _IOC_TYPE(mali_ioctl) && \
+	 _IOC_NR(request) == _IOC_NR(mali_ioctl))
+
 #define MALI_IOCTL_TYPE_BASE  0x80
 #define MALI_IOCTL_TYPE_MAX   0x82
 #define MALI_IOCTL_TYPE_COUNT (MALI_IOCTL_TYPE_MAX - MALI_IOCTL_TYPE_BASE + 1)
@@ -938,7 +1093,7 @@ typedef struct {
 #define MALI_IOCTL_HWCNT_READER_SETUP      (_IOWR(0x82, 36, __ioctl_placeholder))
 #define MALI_IOCTL_SET_PRFCNT_VALUES       (_IOWR(0x82, 37, __ioctl_placeholder))
 #define MALI_IOCTL_SOFT_EVENT_UPDATE       (_IOWR(0x82, 38, __ioctl_placeholder))
-#define MALI_IOCTL_MEM_JIT_INIT            (_IOWR(0x82, 39, __ioctl_placeholder))
+#define MALI_IOCTL_MEM_JIT_INIT            (_IOWR(0x82, 39, struct mali_ioctl_mem_jit_init))
 #define MALI_IOCTL_TLSTREAM_ACQUIRE        (_IOWR(0x82, 40, __ioctl_placeholder))
 
 #endif /* __MALI_IOCTL_H__ */
@@ -0,0 +1,263 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * Declarative layouts for the descriptors in mali-job.h.
+ *
+ * Each schema is an X-macro listing every field of a descriptor as
+ * FIELD(name, offset, bits), with the offset in bits from the start of the
+ * descriptor and bits at most 64. MALI_DESCRIPTOR() then turns a schema into:
+ *
+ *  - struct <name>_unpacked, with every field widened to a u64
+ *  - <name>_unpack() and <name>_pack(), which use explicit shifts and masks
+ *    instead of relying on how the compiler lays out bitfields
+ *  - <name>_unpack_array(), for unpacking several descriptors in one go
+ *  - <name>_fields[], describing each field so they can be printed
+ *
+ * Descriptors containing pointers change layout with the host's pointer size,
+ * just like the structs in mali-job.h do, so their offsets are expressed in
+ * terms of MALI_PTR_BITS.
+ */
+
+#ifndef __MALI_JOB_SCHEMA_H__
+#define __MALI_JOB_SCHEMA_H__
+
+#include <stddef.h>
+#include <mali-job.h>
+
+struct mali_field {
+	const char *name;
+	unsigned int offset;
+	unsigned int bits;
+};
+
+static inline u64
+mali_get_bits(const void *packed, unsigned int offset, unsigned int bits)
+{
+	const u8 *bytes = packed;
+	u64 value = 0;
+
+	for (unsigned int i = 0; i < bits;) {
+		unsigned int bit = offset + i;
+		unsigned int n = MIN(8 - bit % 8, bits - i);
+
+		value |= (u64) ((bytes[bit / 8] >> (bit % 8)) &
+				((1u << n) - 1)) << i;
+		i += n;
+	}
+
+	return value;
+}
+
+static inline void
+mali_set_bits(void *packed, unsigned int offset, unsigned int bits, u64 value)
+{
+	u8 *bytes = packed;
+
+	for (unsigned int i = 0; i < bits;) {
+		unsigned int bit = offset + i;
+		unsigned int n = MIN(8 - bit % 8, bits - i);
+		u8 mask = ((1u << n) - 1) << (bit % 8);
+
+		bytes[bit / 8] = (bytes[bit / 8] & ~mask) |
+			(((value >> i) << (bit % 8)) & mask);
+		i += n;
+	}
+}
+
+#define MALI_FIELD_MEMBER(name, offset, bits) u64 name;
+#define MALI_FIELD_INFO(name, offset, bits) { #name, offset, bits },
+#define MALI_FIELD_UNPACK(name, offset, bits) \
+	out->name = mali_get_bits(packed, offset, bits);
+#define MALI_FIELD_PACK(name, offset, bits) \
+	mali_set_bits(packed, offset, bits, in->name);
+
+#define MALI_DESCRIPTOR(type, SCHEMA)					\
+	struct type##_unpacked {					\
+		SCHEMA(MALI_FIELD_MEMBER)				\
+	};								\
+									\
+	static const struct mali_field type##_fields[] = {		\
+		SCHEMA(MALI_FIELD_INFO)					\
+	};								\
+									\
+	static inline void						\
+	type##_unpack(const void *packed, struct type##_unpacked *out)	\
+	{								\
+		SCHEMA(MALI_FIELD_UNPACK)				\
+	}								\
+									\
+	static inline void						\
+	type##_pack(const struct type##_unpacked *in, void *packed)	\
+	{								\
+		SCHEMA(MALI_FIELD_PACK)					\
+	}								\
+									\
+	static inline void						\
+	type##_unpack_array(const void *packed, size_t stride,		\
+			    struct type##_unpacked *out, size_t count)	\
+	{								\
+		for (size_t i = 0; i < count; i++)			\
+			type##_unpack((const u8 *) packed + i * stride,	\
+				      &out[i]);				\
+	}
+
+#define MALI_JOB_DESCRIPTOR_HEADER_SCHEMA(FIELD)		\
+	FIELD(exception_status,          0, 32)		\
+	FIELD(first_incomplete_task,    32, 32)		\
+	FIELD(fault_pointer,            64, 64)		\
+	FIELD(job_descriptor_size,     128,  1)		\
+	FIELD(job_type,                129,  7)		\
+	FIELD(job_barrier,             136,  1)		\
+	FIELD(job_index,               144, 16)		\
+	FIELD(job_dependency_index_1,  160, 16)		\
+	FIELD(job_dependency_index_2,  176, 16)		\
+	FIELD(next_job_64,             192, 64)
+MALI_DESCRIPTOR(mali_job_descriptor_header, MALI_JOB_DESCRIPTOR_HEADER_SCHEMA)
+
+/* With 32-bit descriptors, only the low half of next_job_64 is the pointer */
+static inline mali_ptr
+mali_job_next(const struct mali_job_descriptor_header_unpacked *hu)
+{
+	return hu->job_descriptor_size ? hu->next_job_64 :
+		(u32) hu->next_job_64;
+}
+
+/* With 32-bit descriptors, the payload of everything but fragment jobs starts
+ * where the upper half of next_job_64 would be */
+static inline size_t
+mali_job_payload_offset(const struct mali_job_descriptor_header_unpacked *hu)
+{
+	return sizeof(struct mali_job_descriptor_header) -
+		(!hu->job_descriptor_size &&
+		 hu->job_type != JOB_TYPE_FRAGMENT ? 4 : 0);
+}
+
+#define MALI_PAYLOAD_SET_VALUE_SCHEMA(FIELD)			\
+	FIELD(out,                       0, 64)		\
+	FIELD(unknown,                  64, 64)
+MALI_DESCRIPTOR(mali_payload_set_value, MALI_PAYLOAD_SET_VALUE_SCHEMA)
+
+#define MALI_VERTEX_TILER_ATTR_SCHEMA(FIELD)			\
+	FIELD(flags,                     0, 2)			\
+	FIELD(elements_upper,            2, MALI_PTR_BITS - 2)	\
+	FIELD(stride,        MALI_PTR_BITS, MALI_PTR_BITS)	\
+	FIELD(size,      MALI_PTR_BITS * 2, MALI_PTR_BITS)
+MALI_DESCRIPTOR(mali_vertex_tiler_attr, MALI_VERTEX_TILER_ATTR_SCHEMA)
+
+#define MALI_VERTEX_TILER_ATTR_META_SCHEMA(FIELD)		\
+	FIELD(index,                     0, 8)			\
+	FIELD(flags,                     8, 56)
+MALI_DESCRIPTOR(mali_vertex_tiler_attr_meta, MALI_VERTEX_TILER_ATTR_META_SCHEMA)
+
+/* What we know of block1, and the pointers in between block1 and block2.
+ * The draw mode, index type and index count (minus one, and also set for
+ * draws without indices) are only meaningful for tiler jobs.
+ *
+ * invocation_count packs the workgroup size and count along each axis, each
+ * minus one, one after another: size x starts at bit 0, size y at
+ * size_y_shift, and so on up to the workgroup count along z, which runs from
+ * workgroups_z_shift to the top. */
+#define MALI_VT_PTR(i) (10 * 32 + (i) * MALI_PTR_BITS)
+#define MALI_PAYLOAD_VERTEX_TILER_SCHEMA(FIELD)			\
+	FIELD(invocation_count,            0, 32)		\
+	FIELD(size_y_shift,               32,  5)		\
+	FIELD(size_z_shift,               37,  5)		\
+	FIELD(workgroups_x_shift,         42,  6)		\
+	FIELD(workgroups_y_shift,         48,  6)		\
+	FIELD(workgroups_z_shift,         54,  6)		\
+	FIELD(workgroups_x_shift_2,       60,  4)		\
+	FIELD(draw_mode,                  64,  4)		\
+	FIELD(index_type,                 68,  2)		\
+	FIELD(workgroups_x_shift_3,       90,  6)		\
+	FIELD(index_count,               128, 32)		\
+	FIELD(indices,                   256, 64)		\
+	FIELD(null0,          MALI_VT_PTR(0), MALI_PTR_BITS)	\
+	FIELD(_zeroes,        MALI_VT_PTR(1), MALI_PTR_BITS)	\
+	FIELD(unknown1,       MALI_VT_PTR(2), MALI_PTR_BITS)	\
+	FIELD(null1,          MALI_VT_PTR(3), MALI_PTR_BITS)	\
+	FIELD(null2,          MALI_VT_PTR(4), MALI_PTR_BITS)	\
+	FIELD(unknown2,       MALI_VT_PTR(5), MALI_PTR_BITS)	\
+	FIELD(flags,          MALI_VT_PTR(6), 4)		\
+	FIELD(shader_upper,   MALI_VT_PTR(6) + 4, MALI_PTR_BITS - 4) \
+	FIELD(attributes,     MALI_VT_PTR(7), MALI_PTR_BITS)	\
+	FIELD(attribute_meta, MALI_VT_PTR(8), MALI_PTR_BITS)	\
+	FIELD(unknown5,       MALI_VT_PTR(9), MALI_PTR_BITS)	\
+	FIELD(unknown6,       MALI_VT_PTR(10), MALI_PTR_BITS)	\
+	FIELD(nullForVertex,  MALI_VT_PTR(11), MALI_PTR_BITS)	\
+	FIELD(null4,          MALI_VT_PTR(12), MALI_PTR_BITS)	\
+	FIELD(fbd,            MALI_VT_PTR(13), MALI_PTR_BITS)	\
+	FIELD(unknown7,       MALI_VT_PTR(14), MALI_PTR_BITS)
+MALI_DESCRIPTOR(mali_payload_vertex_tiler, MALI_PAYLOAD_VERTEX_TILER_SCHEMA)
+
+#define MALI_PAYLOAD_FRAGMENT_SCHEMA(FIELD)			\
+	FIELD(min_tile_x,                0, 12)		\
+	FIELD(min_tile_y,               16, 12)		\
+	FIELD(max_tile_x,               32, 12)		\
+	FIELD(max_tile_y,               48, 12)		\
+	FIELD(framebuffer,              64, 64)
+MALI_DESCRIPTOR(mali_payload_fragment, MALI_PAYLOAD_FRAGMENT_SCHEMA)
+
+#define MALI_FRAMEBUFFER_SCHEMA(FIELD)				\
+	FIELD(unk0,                      0, 32)		\
+	FIELD(unknown2,                 32, 32)		\
+	FIELD(scratchpad,               64, 64)		\
+	FIELD(sample_locations,        128, 64)		\
+	FIELD(unknown1,                192, 64)		\
+	FIELD(width1,                  256, 16)		\
+	FIELD(height1,                 272, 16)		\
+	FIELD(width2,                  320, 16)		\
+	FIELD(height2,                 336, 16)		\
+	FIELD(unk1,                    352, 19)		\
+	FIELD(rt_count_1,              371,  2)		\
+	FIELD(unk2,                    373,  3)		\
+	FIELD(rt_count_2,              376,  3)		\
+	FIELD(clear_stencil,           384,  8)		\
+	FIELD(mfbd_flags,              392, 24)		\
+	FIELD(clear_depth,             416, 32)		\
+	FIELD(tiler_meta,              448, 64)		\
+	FIELD(tiler_scratch_start,     512, 64)		\
+	FIELD(tiler_scratch_middle,    576, 64)		\
+	FIELD(tiler_heap_start,        640, 64)		\
+	FIELD(tiler_heap_end,          704, 64)
+MALI_DESCRIPTOR(mali_framebuffer, MALI_FRAMEBUFFER_SCHEMA)
+
+#define MALI_FRAMEBUFFER_EXTRA_SCHEMA(FIELD)			\
+	FIELD(checksum,                  0, 64)		\
+	FIELD(checksum_stride,          64, 32)		\
+	FIELD(unk,                      96, 32)		\
+	FIELD(depth,                   128, 64)		\
+	FIELD(depth_stride,            196, 28)		\
+	FIELD(stencil,                 256, 64)		\
+	FIELD(stencil_stride,          324, 28)
+MALI_DESCRIPTOR(mali_framebuffer_extra, MALI_FRAMEBUFFER_EXTRA_SCHEMA)
+
+#define MALI_RENDER_TARGET_SCHEMA(FIELD)			\
+	FIELD(format_unk1,               0, 32)		\
+	FIELD(nr_channels,              35,  2)		\
+	FIELD(block,                    42,  2)		\
+	FIELD(format_flags,             44,  4)		\
+	FIELD(swizzle,                  48, 12)		\
+	FIELD(afbc_metadata,           128, 64)		\
+	FIELD(afbc_stride,             192, 32)		\
+	FIELD(afbc_unk,                224, 32)		\
+	FIELD(framebuffer,             256, 64)		\
+	FIELD(framebuffer_stride,      324, 28)		\
+	FIELD(clear_color_1,           384, 32)		\
+	FIELD(clear_color_2,           416, 32)		\
+	FIELD(clear_color_3,           448, 32)		\
+	FIELD(clear_color_4,           480, 32)
+MALI_DESCRIPTOR(mali_render_target, MALI_RENDER_TARGET_SCHEMA)
+
+#endif /* __MALI_JOB_SCHEMA_H__ */
@@ -46,6 +46,14 @@ enum mali_gl_mode {
 	MALI_GL_TRIANGLE_FAN   = 0x0C,
 };
 
+/* Size of each index of an indexed draw, none for non-indexed draws */
+enum mali_index_type {
+	MALI_INDEX_NONE   = 0,
+	MALI_INDEX_UINT8  = 1,
+	MALI_INDEX_UINT16 = 2,
+	MALI_INDEX_UINT32 = 3,
+};
+
 struct mali_shader_meta {
 	PAD_PTR(mali_ptr shader);
 	PAD_PTR(mali_ptr unknown1);
@@ -71,8 +79,14 @@ struct mali_job_descriptor_header {
 	u16 job_index;
 	u16 job_dependency_index_1;
 	u16 job_dependency_index_2;
-	PAD_PTR(mali_ptr next_job);
+
+	/* Which one is used depends on job_descriptor_size */
+	union {
+		u64 next_job_64;
+		u32 next_job_32;
+	};
 } __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_job_descriptor_header, 32, 32);
 
 struct mali_payload_set_value {
 	u64 out;
@@ -118,6 +132,127 @@ struct mali_payload_vertex_tiler {
 } __attribute__((packed));
 //ASSERT_SIZEOF_TYPE(struct mali_payload_vertex_tiler, 256, 256);
 
+/*
+ * Fragment jobs, and the multiple framebuffer descriptor (MFBD) they point
+ * to. The framebuffer pointer is 64 byte aligned, with the low bits used as
+ * flags. Tile coordinates are in 16x16 pixel tiles, and inclusive.
+ *
+ * Most of the MFBD layout is tentative: it comes from traces of the blob,
+ * and fields named unk* are exactly what they sound like. Unlike the Midgard
+ * descriptors above, these are only ever used by 64-bit GPUs, so pointers are
+ * always 64 bits wide.
+ */
+#define MALI_FRAGMENT_TILE_SIZE 16
+
+#define MALI_MFBD		(1 << 0)
+#define MALI_FBD_POINTER_MASK	(~(u64) 0x3F)
+
+struct mali_payload_fragment {
+	u32 min_tile_x : 12;
+	u32 : 4;
+	u32 min_tile_y : 12;
+	u32 : 4;
+	u32 max_tile_x : 12;
+	u32 : 4;
+	u32 max_tile_y : 12;
+	u32 : 4;
+	u64 framebuffer;
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_payload_fragment, 16, 16);
+
+/* Depth/stencil get written back to memory, instead of being thrown away
+ * with the tile buffer */
+#define MALI_MFBD_DEPTH_WRITE	(1 << 10)
+/* A mali_framebuffer_extra follows the MFBD */
+#define MALI_MFBD_EXTRA		(1 << 13)
+
+struct mali_framebuffer {
+	u32 unk0;
+	u32 unknown2;
+	u64 scratchpad;
+	u64 sample_locations;
+	u64 unknown1;
+
+	/* Both are the size minus one */
+	u16 width1, height1;
+	u32 zero3;
+	u16 width2, height2;
+	u32 unk1 : 19;
+	u32 rt_count_1 : 2; /* Minus one */
+	u32 unk2 : 3;
+	u32 rt_count_2 : 3;
+	u32 zero4 : 5;
+
+	u32 clear_stencil : 8;
+	u32 mfbd_flags : 24;
+	float clear_depth;
+
+	u64 tiler_meta;
+	u64 tiler_scratch_start;
+	u64 tiler_scratch_middle;
+	u64 tiler_heap_start;
+	u64 tiler_heap_end;
+	u64 zero5[4];
+
+	/* Followed by a mali_framebuffer_extra with MALI_MFBD_EXTRA, then
+	 * the render targets */
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_framebuffer, 128, 128);
+
+struct mali_framebuffer_extra {
+	u64 checksum; /* 8 bytes per tile */
+	u32 checksum_stride;
+	u32 unk;
+
+	/* Depth is combined depth/stencil when there's no stencil */
+	u64 depth;
+	u32 depth_stride_zero : 4;
+	u32 depth_stride : 28;
+	u32 zero1;
+	u64 stencil;
+	u32 stencil_stride_zero : 4;
+	u32 stencil_stride : 28;
+	u32 zero2;
+
+	u64 zero3, zero4;
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_framebuffer_extra, 64, 64);
+
+enum mali_rt_block {
+	MALI_RT_BLOCK_TILED = 0,
+	MALI_RT_BLOCK_UNKNOWN = 1,
+	MALI_RT_BLOCK_LINEAR = 2,
+	MALI_RT_BLOCK_AFBC = 3,
+};
+
+struct mali_render_target {
+	u32 format_unk1;
+	u32 format_unk2 : 3;
+	u32 nr_channels : 2; /* Minus one */
+	u32 format_unk3 : 5;
+	u32 block : 2;
+	u32 format_flags : 4;
+	u32 swizzle : 12;
+	u32 format_unk4 : 4;
+	u64 zero1;
+
+	/* Only used with AFBC, which keeps 16 bytes of metadata per tile */
+	u64 afbc_metadata;
+	u32 afbc_stride; /* In tiles */
+	u32 afbc_unk;
+
+	u64 framebuffer;
+	u32 zero2 : 4;
+	u32 framebuffer_stride : 28; /* In bytes */
+	u32 zero3;
+
+	u32 clear_color_1;
+	u32 clear_color_2;
+	u32 clear_color_3;
+	u32 clear_color_4;
+} __attribute__((packed));
+ASSERT_SIZEOF_TYPE(struct mali_render_target, 64, 64);
+
 /* Originally from chai, which found it from mali_kase_reply.c */
 
 #undef PAD_PTR
@@ -0,0 +1,115 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * libpandecode: walks job chains and hands each descriptor it finds to a
+ * visitor, without knowing anything about where GPU memory lives or how the
+ * results get presented.
+ *
+ * GPU memory is read through the resolve callback, which returns a pointer to
+ * size bytes of GPU memory starting at gpu_va, or NULL if that isn't
+ * available. Anything the visitor doesn't care about can be left NULL.
+ * Pointers passed to the visitor are only valid for the duration of the
+ * callback.
+ */
+
+#ifndef __PANDECODE_H__
+#define __PANDECODE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <mali-ioctl.h>
+#include <mali-job.h>
+
+/* How much of a payload we don't know the size of gets passed along */
+#define PANDECODE_UNKNOWN_PAYLOAD_SIZE 256
+
+enum pandecode_error {
+	/* The descriptor at gpu_va couldn't be resolved */
+	PANDECODE_ERROR_UNMAPPED,
+	/* The job at gpu_va was already visited in this chain */
+	PANDECODE_ERROR_CHAIN_LOOP,
+	/* The chain continues at gpu_va past max_jobs jobs */
+	PANDECODE_ERROR_CHAIN_TOO_LONG,
+};
+
+struct pandecode_visitor {
+	/* Called for every job in the chain. Return false to skip the
+	 * job's payload, job_end() still gets called. */
+	bool (*job)(void *data, int index, mali_ptr gpu_va,
+		    const struct mali_job_descriptor_header *h);
+	void (*job_end)(void *data, int index, size_t payload_size);
+
+	void (*set_value)(void *data, mali_ptr gpu_va,
+			  const struct mali_payload_set_value *s);
+
+	/* Return false to skip the descriptors the payload points to,
+	 * including vertex_tiler_end() */
+	bool (*vertex_tiler)(void *data, mali_ptr gpu_va,
+			     const struct mali_job_descriptor_header *h,
+			     const struct mali_payload_vertex_tiler *v);
+	void (*vertex_tiler_end)(void *data,
+				 const struct mali_payload_vertex_tiler *v);
+
+	/* meta is NULL if the payload has no shader */
+	void (*shader)(void *data, mali_ptr meta_ptr,
+		       const struct mali_shader_meta *meta);
+
+	/* elements is the attribute buffer's contents, or NULL if it couldn't
+	 * be resolved */
+	void (*attribute)(void *data, int index,
+			  const struct mali_vertex_tiler_attr_meta *meta,
+			  mali_ptr gpu_va,
+			  const struct mali_vertex_tiler_attr *attr,
+			  const void *elements);
+
+	/* The framebuffer descriptor a vertex/tiler or fragment payload points
+	 * to. extra is NULL unless the descriptor has MALI_MFBD_EXTRA, and rts
+	 * holds as many render targets as the descriptor says. Single
+	 * framebuffer descriptors aren't supported, and aren't visited. */
+	void (*framebuffer)(void *data, mali_ptr gpu_va,
+			    const struct mali_framebuffer *fb,
+			    const struct mali_framebuffer_extra *extra,
+			    const struct mali_render_target *rts);
+
+	/* Called before the fragment job's framebuffer() */
+	void (*fragment)(void *data, mali_ptr gpu_va,
+			 const struct mali_payload_fragment *f);
+	void (*fragment_end)(void *data,
+			     const struct mali_payload_fragment *f);
+
+	/* bytes is the first PANDECODE_UNKNOWN_PAYLOAD_SIZE bytes of the
+	 * payload, or NULL if they couldn't be resolved */
+	void (*unknown_payload)(void *data, mali_ptr gpu_va,
+				const struct mali_job_descriptor_header *h,
+				const void *bytes);
+
+	/* what names the kind of descriptor at gpu_va */
+	void (*error)(void *data, enum pandecode_error error, const char *what,
+		      mali_ptr gpu_va);
+};
+
+struct pandecode_context {
+	const void *(*resolve)(void *data, mali_ptr gpu_va, size_t size);
+	/* NULL to just walk the chain, e.g. to count its jobs */
+	const struct pandecode_visitor *visitor;
+	void *data;
+
+	/* Stop following a chain after this many jobs, 0 for no limit */
+	int max_jobs;
+};
+
+int pandecode_chain(const struct pandecode_context *ctx, mali_ptr jc);
+
+#endif /* __PANDECODE_H__ */
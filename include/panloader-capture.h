@@ -0,0 +1,95 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/**
+ * Format of the capture files written by panwrap (PANWRAP_CAPTURE=<path>) and
+ * read by panreplay.
+ *
+ * A capture starts with a panloader_capture_header, followed by records. Each
+ * record is a panloader_capture_record, then the struct for its type, then any
+ * variable length data. All values are in the native byte order of the
+ * machine the capture was taken on, and ioctl args are stored exactly as they
+ * were passed to the kernel. So, captures can only be replayed on machines
+ * with the same pointer size.
+ */
+
+#ifndef __PANLOADER_CAPTURE_H__
+#define __PANLOADER_CAPTURE_H__
+
+#include <panloader-util.h>
+
+#define PANLOADER_CAPTURE_MAGIC   0x434e4150 /* "PANC" */
+#define PANLOADER_CAPTURE_VERSION 1
+
+struct panloader_capture_header {
+	u32 magic;
+	u32 version;
+	u32 pointer_size;
+	u32 :32;
+} __attribute__((packed));
+
+enum panloader_capture_record_type {
+	PANLOADER_CAPTURE_OPEN   = 1,
+	PANLOADER_CAPTURE_CLOSE  = 2,
+	PANLOADER_CAPTURE_IOCTL  = 3,
+	PANLOADER_CAPTURE_MMAP   = 4,
+	PANLOADER_CAPTURE_MUNMAP = 5,
+	PANLOADER_CAPTURE_MEMORY = 6,
+};
+
+struct panloader_capture_record {
+	u32 type;
+	u32 size; /* Size of everything following this struct */
+} __attribute__((packed));
+
+/* PANLOADER_CAPTURE_OPEN and PANLOADER_CAPTURE_CLOSE */
+struct panloader_capture_fd {
+	s32 fd;
+	u32 :32;
+} __attribute__((packed));
+
+/* Followed by the args before the ioctl, and then the args after it */
+struct panloader_capture_ioctl {
+	s32 fd;
+	u32 request;
+	s32 ret;
+	u32 arg_size;
+} __attribute__((packed));
+
+struct panloader_capture_mmap {
+	u64 addr; /* What mmap() returned */
+	u64 length;
+	s32 prot;
+	s32 flags;
+	s32 fd;
+	u32 :32;
+	u64 offset;
+} __attribute__((packed));
+
+struct panloader_capture_munmap {
+	u64 addr;
+	u64 length;
+} __attribute__((packed));
+
+/*
+ * The contents of some CPU memory right before the next ioctl, followed by
+ * the data itself. Emitted for every mapping of GPU memory and for the atom
+ * list before each JOB_SUBMIT.
+ */
+struct panloader_capture_memory {
+	u64 addr;
+	u64 size;
+} __attribute__((packed));
+
+#endif /* __PANLOADER_CAPTURE_H__ */
@@ -55,6 +55,9 @@ typedef int64_t s64;
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
 #define YES_NO(b) ((b) ? "Yes" : "No")
 
 #endif /* __PANLOADER_UTIL_H__ */
@@ -0,0 +1,254 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * The job chain walker behind libpandecode, see pandecode.h. Since job chains
+ * come straight out of GPU memory they might well be corrupt, so nothing here
+ * trusts a pointer before it's been resolved: anything that can't be gets
+ * reported to the visitor's error callback and skipped.
+ */
+
+#include <stdlib.h>
+#include <panloader-util.h>
+#include <mali-job-schema.h>
+#include <pandecode.h>
+
+/* The visitor, and any of its callbacks, may be NULL */
+#define HAS_VISIT(ctx, callback) \
+	((ctx)->visitor && (ctx)->visitor->callback)
+
+#define VISIT(ctx, callback, ...) do { \
+	if (HAS_VISIT(ctx, callback)) \
+		(ctx)->visitor->callback((ctx)->data, __VA_ARGS__); \
+} while (0)
+
+static const void *
+pandecode_resolve(const struct pandecode_context *ctx, const char *what,
+		  mali_ptr gpu_va, size_t size)
+{
+	const void *ptr = ctx->resolve(ctx->data, gpu_va, size);
+
+	if (!ptr)
+		VISIT(ctx, error, PANDECODE_ERROR_UNMAPPED, what, gpu_va);
+
+	return ptr;
+}
+
+static void
+pandecode_attributes(const struct pandecode_context *ctx,
+		     const struct mali_payload_vertex_tiler_unpacked *vu)
+{
+	for (int i = 0; ; i++) {
+		mali_ptr p = vu->attribute_meta + i * sizeof(u64);
+		const struct mali_vertex_tiler_attr_meta *meta;
+		const struct mali_vertex_tiler_attr *attr;
+		struct mali_vertex_tiler_attr_meta_unpacked mu;
+		struct mali_vertex_tiler_attr_unpacked au;
+		const void *elements;
+		mali_ptr attr_va;
+
+		meta = pandecode_resolve(ctx, "attribute list", p, sizeof(*meta));
+		if (!meta || !*(const u64 *) meta)
+			return;
+
+		mali_vertex_tiler_attr_meta_unpack(meta, &mu);
+		attr_va = vu->attributes + mu.index;
+		attr = pandecode_resolve(ctx, "attribute", attr_va, sizeof(*attr));
+		if (!attr)
+			continue;
+
+		mali_vertex_tiler_attr_unpack(attr, &au);
+		elements = ctx->resolve(ctx->data, au.elements_upper << 2,
+					au.size);
+		VISIT(ctx, attribute, i, meta, attr_va, attr, elements);
+	}
+}
+
+static void
+pandecode_framebuffer(const struct pandecode_context *ctx, u64 tagged)
+{
+	const struct mali_framebuffer *fb;
+	const struct mali_framebuffer_extra *extra = NULL;
+	const struct mali_render_target *rts;
+	struct mali_framebuffer_unpacked fu;
+	mali_ptr gpu_va = tagged & MALI_FBD_POINTER_MASK;
+	mali_ptr rt_va = gpu_va + sizeof(*fb);
+	int rt_count;
+
+	if (!(tagged & MALI_MFBD))
+		return;
+
+	fb = pandecode_resolve(ctx, "framebuffer", gpu_va, sizeof(*fb));
+	if (!fb)
+		return;
+
+	mali_framebuffer_unpack(fb, &fu);
+	if (fu.mfbd_flags & MALI_MFBD_EXTRA) {
+		extra = pandecode_resolve(ctx, "framebuffer extra", rt_va,
+					  sizeof(*extra));
+		rt_va += sizeof(*extra);
+	}
+
+	rt_count = fu.rt_count_1 + 1;
+	rts = pandecode_resolve(ctx, "render targets", rt_va,
+				sizeof(*rts) * rt_count);
+
+	VISIT(ctx, framebuffer, gpu_va, fb, extra, rts);
+}
+
+static size_t
+pandecode_fragment(const struct pandecode_context *ctx, mali_ptr payload)
+{
+	const struct mali_payload_fragment *f;
+	struct mali_payload_fragment_unpacked fu;
+
+	f = pandecode_resolve(ctx, "payload", payload, sizeof(*f));
+	if (!f)
+		return 0;
+
+	mali_payload_fragment_unpack(f, &fu);
+
+	VISIT(ctx, fragment, payload, f);
+	pandecode_framebuffer(ctx, fu.framebuffer);
+	VISIT(ctx, fragment_end, f);
+
+	return sizeof(*f);
+}
+
+static size_t
+pandecode_vertex_tiler(const struct pandecode_context *ctx,
+		       const struct mali_job_descriptor_header *h,
+		       mali_ptr payload)
+{
+	const struct mali_payload_vertex_tiler *v;
+	const struct mali_shader_meta *meta = NULL;
+	struct mali_payload_vertex_tiler_unpacked vu;
+	mali_ptr meta_ptr;
+
+	v = pandecode_resolve(ctx, "payload", payload, sizeof(*v));
+	if (!v)
+		return 0;
+
+	if (HAS_VISIT(ctx, vertex_tiler) &&
+	    !ctx->visitor->vertex_tiler(ctx->data, payload, h, v))
+		return sizeof(*v);
+
+	mali_payload_vertex_tiler_unpack(v, &vu);
+
+	meta_ptr = vu.shader_upper << 4;
+	if (meta_ptr)
+		meta = pandecode_resolve(ctx, "shader meta", meta_ptr,
+					 sizeof(*meta));
+	if (meta || !meta_ptr)
+		VISIT(ctx, shader, meta_ptr, meta);
+
+	if (vu.attribute_meta)
+		pandecode_attributes(ctx, &vu);
+
+	if (vu.fbd)
+		pandecode_framebuffer(ctx, vu.fbd);
+
+	VISIT(ctx, vertex_tiler_end, v);
+
+	return sizeof(*v);
+}
+
+/* Returns the size of the payload, or 0 if we don't know it */
+static size_t
+pandecode_payload(const struct pandecode_context *ctx,
+		  const struct mali_job_descriptor_header *h,
+		  enum mali_job_type type, mali_ptr payload)
+{
+	const struct mali_payload_set_value *s;
+
+	switch (type) {
+	case JOB_TYPE_SET_VALUE:
+		s = pandecode_resolve(ctx, "payload", payload, sizeof(*s));
+		if (!s)
+			return 0;
+
+		VISIT(ctx, set_value, payload, s);
+		return sizeof(*s);
+	case JOB_TYPE_TILER:
+	case JOB_TYPE_VERTEX:
+	case JOB_TYPE_COMPUTE:
+		return pandecode_vertex_tiler(ctx, h, payload);
+	case JOB_TYPE_FRAGMENT:
+		return pandecode_fragment(ctx, payload);
+	default:
+		VISIT(ctx, unknown_payload, payload, h,
+		      ctx->resolve(ctx->data, payload,
+				   PANDECODE_UNKNOWN_PAYLOAD_SIZE));
+		return 0;
+	}
+}
+
+/**
+ * Follow the job chain starting at jc through each job's next_job pointer,
+ * visiting every job along the way. Returns the number of jobs visited.
+ */
+int
+pandecode_chain(const struct pandecode_context *ctx, mali_ptr jc)
+{
+	const struct mali_job_descriptor_header *h;
+	mali_ptr *visited = NULL;
+	size_t visited_size = 0;
+	int jobs = 0;
+
+	for (; jc;) {
+		struct mali_job_descriptor_header_unpacked hu;
+		size_t payload_size = 0;
+		mali_ptr payload;
+		int i;
+
+		if (ctx->max_jobs && jobs == ctx->max_jobs) {
+			VISIT(ctx, error, PANDECODE_ERROR_CHAIN_TOO_LONG, "job",
+			      jc);
+			break;
+		}
+
+		for (i = 0; i < jobs && visited[i] != jc; i++);
+		if (i < jobs) {
+			VISIT(ctx, error, PANDECODE_ERROR_CHAIN_LOOP, "job", jc);
+			break;
+		}
+
+		h = pandecode_resolve(ctx, "job", jc, sizeof(*h));
+		if (!h)
+			break;
+
+		mali_job_descriptor_header_unpack(h, &hu);
+		payload = jc + mali_job_payload_offset(&hu);
+
+		if (jobs == visited_size) {
+			visited_size = MAX(visited_size * 2, 16);
+			visited = realloc(visited,
+					  sizeof(*visited) * visited_size);
+		}
+		visited[jobs] = jc;
+
+		if (!HAS_VISIT(ctx, job) ||
+		    ctx->visitor->job(ctx->data, jobs, jc, h))
+			payload_size = pandecode_payload(ctx, h, hu.job_type,
+							 payload);
+
+		VISIT(ctx, job_end, jobs, payload_size);
+		jobs++;
+
+		jc = mali_job_next(&hu);
+	}
+
+	free(visited);
+	return jobs;
+}
@@ -0,0 +1,412 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Job latency model
+ *
+ * With PANFAKE_LATENCY_MODEL=1, atoms don't complete the moment they're
+ * submitted. Instead, each one is given a duration from the jobs in its chain,
+ * waits for its pre_deps, and then runs in one of a limited number of job
+ * slots. A scheduler thread completes atoms once their time is up, so
+ * completion events show up on the fd in the order the atoms finished.
+ *
+ * Environment variables (durations in microseconds unless noted):
+ *   PANFAKE_JOB_SLOTS           Atoms that can run at once (default: 3)
+ *   PANFAKE_DELAY_VERTEX        Per vertex job (default: 50)
+ *   PANFAKE_DELAY_TILER         Per tiler job (default: 50)
+ *   PANFAKE_DELAY_FRAGMENT      Per fragment job (default: 500)
+ *   PANFAKE_DELAY_COMPUTE       Per compute job (default: 100)
+ *   PANFAKE_DELAY_OTHER         Per job of any other type (default: 5)
+ *
+ * Fused jobs take as long as a vertex job and a tiler job together.
+ *   PANFAKE_DELAY_PER_VERTEX_NS Added to vertex/tiler jobs for each vertex
+ *                               in their attribute buffers (default: 10)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <mali-job-schema.h>
+#include "panfake.h"
+
+#define PANFAKE_MAX_CHAIN_JOBS 1024
+#define PANFAKE_MAX_ATTRIBUTES 32
+
+struct panfake_atom {
+	struct panfake_context *ctx;
+	struct mali_jd_atom_v2 atom;
+	u64 duration_ns;
+	u64 finish_ns; /* Only valid while running */
+
+	struct list node;
+};
+
+static bool enabled;
+static unsigned int job_slots;
+static u64 job_delay_ns[JOB_TYPE_FRAGMENT + 1];
+static u64 other_delay_ns, per_vertex_ns;
+
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static pthread_t thread;
+static bool thread_running, stopping;
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond;
+static LIST_HEAD(waiting); /* In submission order */
+static LIST_HEAD(running); /* Sorted by finish_ns */
+static unsigned int nr_waiting, nr_running;
+
+static struct {
+	u64 atoms;
+	u64 start_ns, last_ns;
+	u64 busy_ns;
+	u64 depth_ns; /* Queue depth integrated over time */
+	unsigned int max_depth;
+} stats;
+
+static u64
+panfake_monotonic_ns()
+{
+	struct timespec tp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return tp.tv_sec * 1000000000ull + tp.tv_nsec;
+}
+
+/* Call whenever the number of queued or running atoms is about to change */
+static void
+panfake_sched_account(u64 now)
+{
+	u64 dt = now - stats.last_ns;
+
+	if (!stats.start_ns)
+		stats.start_ns = now;
+	else if (nr_running)
+		stats.busy_ns += dt;
+
+	stats.depth_ns += dt * (nr_waiting + nr_running);
+	stats.last_ns = now;
+}
+
+static u64
+panfake_vertex_count(struct panfake_context *ctx, mali_ptr payload)
+{
+	const struct mali_payload_vertex_tiler *v =
+		panfake_gpu_mem(ctx, payload, sizeof(*v));
+	u64 count = 0;
+
+	if (!v || !v->attributes || !v->attribute_meta)
+		return 0;
+
+	for (int i = 0; i < PANFAKE_MAX_ATTRIBUTES; i++) {
+		const struct mali_vertex_tiler_attr_meta *meta;
+		const struct mali_vertex_tiler_attr *attr;
+
+		meta = panfake_gpu_mem(ctx, v->attribute_meta + i * sizeof(*meta),
+				       sizeof(*meta));
+		if (!meta || !*(const u64 *)meta)
+			break;
+
+		attr = panfake_gpu_mem(ctx, v->attributes +
+				       meta->index * sizeof(*attr),
+				       sizeof(*attr));
+		if (attr && attr->stride)
+			count = MAX(count, attr->size / attr->stride);
+	}
+
+	return count;
+}
+
+/* How long the GPU would take to run everything in the job chain at jc */
+static u64
+panfake_chain_duration(struct panfake_context *ctx, mali_ptr jc)
+{
+	u64 total = 0;
+
+	for (int i = 0; jc && i < PANFAKE_MAX_CHAIN_JOBS; i++) {
+		const struct mali_job_descriptor_header *h =
+			panfake_gpu_mem(ctx, jc, sizeof(*h));
+		struct mali_job_descriptor_header_unpacked hu;
+		mali_ptr payload;
+
+		if (!h)
+			break;
+
+		mali_job_descriptor_header_unpack(h, &hu);
+		payload = jc + mali_job_payload_offset(&hu);
+
+		switch (hu.job_type) {
+		case JOB_TYPE_VERTEX:
+		case JOB_TYPE_TILER:
+		case JOB_TYPE_FUSED:
+			total += per_vertex_ns * panfake_vertex_count(ctx, payload);
+			/* fallthrough */
+		case JOB_TYPE_COMPUTE:
+		case JOB_TYPE_FRAGMENT:
+			total += job_delay_ns[hu.job_type] ?: other_delay_ns;
+			break;
+		default:
+			total += other_delay_ns;
+			break;
+		}
+
+		jc = mali_job_next(&hu);
+	}
+
+	return total;
+}
+
+static bool
+panfake_atom_is_ready(const struct panfake_atom *a)
+{
+	struct panfake_atom *pos;
+
+	for (int i = 0; i < ARRAY_SIZE(a->atom.pre_dep); i++) {
+		const struct mali_jd_dependency *dep = &a->atom.pre_dep[i];
+
+		if (dep->dependency_type == MALI_JD_DEP_TYPE_INVALID)
+			continue;
+
+		/* Anything still around that was submitted before us is
+		 * something we have to wait for */
+		list_for_each_entry(pos, &running, node) {
+			if (pos->ctx == a->ctx &&
+			    pos->atom.atom_number == dep->atom_id)
+				return false;
+		}
+		list_for_each_entry(pos, &waiting, node) {
+			if (pos == a)
+				break;
+			if (pos->ctx == a->ctx &&
+			    pos->atom.atom_number == dep->atom_id)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static void
+panfake_atom_start(struct panfake_atom *a, u64 now)
+{
+	struct panfake_atom *pos;
+	struct list *prev = &running;
+
+	a->finish_ns = now + a->duration_ns;
+
+	list_del(&a->node);
+	nr_waiting--;
+
+	list_for_each_entry(pos, &running, node) {
+		if (pos->finish_ns > a->finish_ns)
+			break;
+		prev = &pos->node;
+	}
+	list_add(&a->node, prev);
+	nr_running++;
+}
+
+static void *
+panfake_sched_thread(void *data)
+{
+	struct panfake_atom *a, *tmp;
+	struct timespec deadline;
+	u64 now;
+
+	pthread_mutex_lock(&sched_lock);
+	while (!stopping || nr_waiting || nr_running) {
+		now = panfake_monotonic_ns();
+		panfake_sched_account(now);
+
+		/* Running is sorted by finish time, so events go out in the
+		 * order atoms finished */
+		list_for_each_entry_safe(a, tmp, &running, node) {
+			if (a->finish_ns > now)
+				break;
+
+			list_del(&a->node);
+			nr_running--;
+			stats.atoms++;
+			panfake_send_event(a->ctx, &a->atom, MALI_JD_EVENT_DONE);
+			free(a);
+		}
+
+		list_for_each_entry_safe(a, tmp, &waiting, node) {
+			if (nr_running >= job_slots)
+				break;
+			if (panfake_atom_is_ready(a))
+				panfake_atom_start(a, now);
+		}
+
+		if (list_is_empty(&running)) {
+			if (stopping && !nr_waiting)
+				break;
+			pthread_cond_wait(&sched_cond, &sched_lock);
+			continue;
+		}
+
+		a = list_first_entry(&running, typeof(*a), node);
+		deadline.tv_sec = a->finish_ns / 1000000000ull;
+		deadline.tv_nsec = a->finish_ns % 1000000000ull;
+		pthread_cond_timedwait(&sched_cond, &sched_lock, &deadline);
+	}
+	pthread_mutex_unlock(&sched_lock);
+
+	return NULL;
+}
+
+static void
+panfake_sched_start_thread()
+{
+	int ret = pthread_create(&thread, NULL, panfake_sched_thread, NULL);
+
+	if (ret) {
+		fprintf(stderr, "panfake: Failed to start scheduler thread: %s\n",
+			strerror(ret));
+		exit(1);
+	}
+
+	thread_running = true;
+}
+
+bool
+panfake_sched_enabled()
+{
+	return enabled;
+}
+
+/* Called with the context's lock held */
+void
+panfake_sched_submit(struct panfake_context *ctx,
+		     const struct mali_jd_atom_v2 *atoms, unsigned int count)
+{
+	pthread_once(&thread_once, panfake_sched_start_thread);
+
+	pthread_mutex_lock(&sched_lock);
+	panfake_sched_account(panfake_monotonic_ns());
+
+	for (int i = 0; i < count; i++) {
+		struct panfake_atom *a = calloc(1, sizeof(*a));
+
+		a->ctx = ctx;
+		a->atom = atoms[i];
+		if (!MALI_JD_REQ_SOFT_JOB_OR_DEP(atoms[i].core_req))
+			a->duration_ns = panfake_chain_duration(ctx,
+								atoms[i].jc);
+
+		list_add(&a->node, waiting.prev);
+		nr_waiting++;
+	}
+
+	stats.max_depth = MAX(stats.max_depth, nr_waiting + nr_running);
+	pthread_cond_signal(&sched_cond);
+	pthread_mutex_unlock(&sched_lock);
+}
+
+/* Forget about any atoms from a context that's going away */
+void
+panfake_sched_context_destroy(struct panfake_context *ctx)
+{
+	struct panfake_atom *a, *tmp;
+
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&sched_lock);
+	panfake_sched_account(panfake_monotonic_ns());
+
+	list_for_each_entry_safe(a, tmp, &waiting, node) {
+		if (a->ctx != ctx)
+			continue;
+		list_del(&a->node);
+		nr_waiting--;
+		free(a);
+	}
+	list_for_each_entry_safe(a, tmp, &running, node) {
+		if (a->ctx != ctx)
+			continue;
+		list_del(&a->node);
+		nr_running--;
+		free(a);
+	}
+
+	pthread_cond_signal(&sched_cond);
+	pthread_mutex_unlock(&sched_lock);
+}
+
+unsigned int
+panfake_sched_job_slots()
+{
+	return job_slots;
+}
+
+static void __attribute__((constructor))
+panfake_sched_init()
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sched_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	enabled = panfake_parse_env_long("PANFAKE_LATENCY_MODEL", 0);
+	job_slots = MIN(MAX(panfake_parse_env_long("PANFAKE_JOB_SLOTS", 3), 1),
+			MALI_GPU_MAX_JOB_SLOTS);
+
+	job_delay_ns[JOB_TYPE_VERTEX] =
+		panfake_parse_env_long("PANFAKE_DELAY_VERTEX", 50) * 1000;
+	job_delay_ns[JOB_TYPE_TILER] =
+		panfake_parse_env_long("PANFAKE_DELAY_TILER", 50) * 1000;
+	job_delay_ns[JOB_TYPE_FRAGMENT] =
+		panfake_parse_env_long("PANFAKE_DELAY_FRAGMENT", 500) * 1000;
+	job_delay_ns[JOB_TYPE_COMPUTE] =
+		panfake_parse_env_long("PANFAKE_DELAY_COMPUTE", 100) * 1000;
+	job_delay_ns[JOB_TYPE_FUSED] =
+		job_delay_ns[JOB_TYPE_VERTEX] + job_delay_ns[JOB_TYPE_TILER];
+	other_delay_ns =
+		panfake_parse_env_long("PANFAKE_DELAY_OTHER", 5) * 1000;
+	per_vertex_ns =
+		panfake_parse_env_long("PANFAKE_DELAY_PER_VERTEX_NS", 10);
+}
+
+static void __attribute__((destructor))
+panfake_sched_fini()
+{
+	u64 elapsed;
+
+	if (!thread_running)
+		return;
+
+	/* Let everything that's still queued finish */
+	pthread_mutex_lock(&sched_lock);
+	stopping = true;
+	pthread_cond_signal(&sched_cond);
+	pthread_mutex_unlock(&sched_lock);
+
+	pthread_join(thread, NULL);
+	thread_running = false;
+
+	elapsed = stats.last_ns - stats.start_ns;
+	if (!elapsed)
+		return;
+
+	fprintf(stderr, "panfake: %" PRIu64 " atoms in %.3f ms, GPU busy %.1f%%, queue depth avg %.2f max %u\n",
+		stats.atoms, elapsed / 1000000.0,
+		100.0 * stats.busy_ns / elapsed,
+		(double)stats.depth_ns / elapsed, stats.max_depth);
+}
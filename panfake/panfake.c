@@ -0,0 +1,733 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * panfake: a stand-in for /dev/mali0, for running panwrap and pandev on
+ * machines without a Bifrost GPU.
+ *
+ * When preloaded, opening the device path gives the application one end of a
+ * SOCK_SEQPACKET socket instead. ioctl() and mmap() calls on it are handled
+ * here, and atom completion events get written to the other end, so read()
+ * and poll() on the fd work without any help from us. GPU memory is backed by
+ * a sparse memfd per context. See panfake-sched.c for how long jobs take.
+ *
+ * When panwrap is used as well, it needs to come first in LD_PRELOAD so that
+ * it sees the calls before they reach us.
+ *
+ * Environment variables:
+ *   PANFAKE_DEVICE        Path to pretend to be (default: /dev/mali0)
+ *   PANFAKE_MEM_MB        GPU memory available to each context (default: 1024)
+ *   PANFAKE_GPU_ID        Raw GPU_ID register (default: 0x60000000, Mali-G71)
+ *   PANFAKE_SHADER_CORES  Number of shader cores (default: 8)
+ *   PANFAKE_GPU_MHZ       Reported GPU clock (default: 850)
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/ioctl.h>
+#include <linux/falloc.h>
+
+#include "panfake.h"
+
+#define PANFAKE_MAX_FDS     4096
+#define PANFAKE_COOKIE_BASE (64ul << 12)
+#define PANFAKE_MAX_COOKIES 64
+
+static struct panfake_context *contexts[PANFAKE_MAX_FDS];
+static pthread_mutex_t contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+static u32 next_context_id = 1;
+
+static const char *device_path = "/dev/mali0";
+static u64 mem_size;
+static u32 gpu_id, shader_cores, gpu_mhz;
+
+void *
+panfake_dlsym(const char *name)
+{
+	void *func = dlsym(RTLD_NEXT, name);
+
+	if (!func) {
+		fprintf(stderr, "panfake: Failed to find %s: %s\n",
+			name, dlerror());
+		exit(-1);
+	}
+
+	return func;
+}
+
+long
+panfake_parse_env_long(const char *env, long def)
+{
+	const char *val = getenv(env);
+	char *end;
+	long ret;
+
+	if (!val)
+		return def;
+
+	errno = 0;
+	ret = strtol(val, &end, 0);
+	if (errno || end == val || *end) {
+		fprintf(stderr, "panfake: Invalid value for %s: %s\n",
+			env, val);
+		exit(1);
+	}
+
+	return ret;
+}
+
+static inline struct panfake_context *
+panfake_get_context(int fd)
+{
+	if (fd < 0 || fd >= PANFAKE_MAX_FDS)
+		return NULL;
+
+	return contexts[fd];
+}
+
+static struct panfake_allocation *
+panfake_find_allocation(struct panfake_context *ctx, mali_ptr gpu_va)
+{
+	struct panfake_allocation *pos;
+
+	list_for_each_entry(pos, &ctx->allocations, node) {
+		if (pos->gpu_va && gpu_va >= pos->gpu_va &&
+		    gpu_va < pos->gpu_va + pos->va_pages * PANFAKE_PAGE_SIZE)
+			return pos;
+	}
+
+	return NULL;
+}
+
+static struct panfake_allocation *
+panfake_find_cookie(struct panfake_context *ctx, u64 cookie)
+{
+	struct panfake_allocation *pos;
+
+	list_for_each_entry(pos, &ctx->allocations, node) {
+		if (!pos->gpu_va && pos->cookie == cookie)
+			return pos;
+	}
+
+	return NULL;
+}
+
+/**
+ * Get a pointer to the GPU memory at gpu_va, as seen by the "GPU". Returns
+ * NULL if the range isn't entirely inside of one allocation.
+ */
+void *
+panfake_gpu_mem(struct panfake_context *ctx, mali_ptr gpu_va, size_t size)
+{
+	struct panfake_allocation *a = panfake_find_allocation(ctx, gpu_va);
+
+	if (!a || gpu_va - a->gpu_va + size > a->va_pages * PANFAKE_PAGE_SIZE)
+		return NULL;
+
+	return ctx->mem + a->offset + (gpu_va - a->gpu_va);
+}
+
+void
+panfake_send_event(struct panfake_context *ctx,
+		   const struct mali_jd_atom_v2 *atom,
+		   enum mali_jd_event_code code)
+{
+	static bool warned;
+	struct mali_jd_event_v2 event = {
+		.event_code = code,
+		.atom_number = atom->atom_number,
+		.udata = atom->udata,
+	};
+
+	if (atom->core_req & MALI_JD_REQ_EVENT_NEVER)
+		return;
+	if ((atom->core_req & MALI_JD_REQ_EVENT_ONLY_ON_FAILURE) &&
+	    code == MALI_JD_EVENT_DONE)
+		return;
+
+	if (send(ctx->event_fd, &event, sizeof(event), MSG_DONTWAIT) < 0 &&
+	    !warned) {
+		fprintf(stderr, "panfake: Dropping completion events, nobody's reading them (%s)\n",
+			strerror(errno));
+		warned = true;
+	}
+}
+
+/*
+ * First fit allocation out of the context's memfd. The list of allocations is
+ * kept sorted by offset so that we just need to look for the first big enough
+ * gap.
+ */
+static struct panfake_allocation *
+panfake_allocation_create(struct panfake_context *ctx, u64 va_pages)
+{
+	struct panfake_allocation *a, *pos;
+	struct list *prev = &ctx->allocations;
+	u64 size = va_pages * PANFAKE_PAGE_SIZE, offset = 0;
+
+	list_for_each_entry(pos, &ctx->allocations, node) {
+		if (pos->offset - offset >= size)
+			break;
+
+		offset = pos->offset + pos->va_pages * PANFAKE_PAGE_SIZE;
+		prev = &pos->node;
+	}
+
+	if (offset + size > ctx->mem_size)
+		return NULL;
+
+	a = calloc(1, sizeof(*a));
+	a->offset = offset;
+	a->va_pages = va_pages;
+	list_add(&a->node, prev);
+
+	return a;
+}
+
+static void
+panfake_set_commit(struct panfake_context *ctx, struct panfake_allocation *a,
+		   u64 pages)
+{
+	/* Give back the memory past the new commit size */
+	if (pages < a->commit_pages) {
+		fallocate(ctx->mem_fd,
+			  FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			  a->offset + pages * PANFAKE_PAGE_SIZE,
+			  (a->commit_pages - pages) * PANFAKE_PAGE_SIZE);
+	}
+
+	a->commit_pages = pages;
+}
+
+static void
+panfake_allocation_destroy(struct panfake_context *ctx,
+			   struct panfake_allocation *a)
+{
+	panfake_set_commit(ctx, a, 0);
+	list_del(&a->node);
+	free(a);
+}
+
+static bool
+panfake_assign_cookie(struct panfake_context *ctx,
+		      struct panfake_allocation *a)
+{
+	for (int i = 0; i < PANFAKE_MAX_COOKIES; i++) {
+		u64 cookie = PANFAKE_COOKIE_BASE + i * PANFAKE_PAGE_SIZE;
+
+		if (!panfake_find_cookie(ctx, cookie)) {
+			a->cookie = cookie;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static enum mali_error
+panfake_mem_alloc(struct panfake_context *ctx,
+		  struct mali_ioctl_mem_alloc *args)
+{
+	struct panfake_allocation *a;
+
+	if (!args->va_pages || args->commit_pages > args->va_pages)
+		return MALI_ERROR_FUNCTION_FAILED;
+
+	a = panfake_allocation_create(ctx, args->va_pages);
+	if (!a)
+		return MALI_ERROR_OUT_OF_GPU_MEMORY;
+
+	a->flags = args->flags;
+	a->commit_pages = args->commit_pages;
+
+	if (args->flags & MALI_MEM_SAME_VA) {
+		if (!panfake_assign_cookie(ctx, a)) {
+			panfake_allocation_destroy(ctx, a);
+			return MALI_ERROR_FUNCTION_FAILED;
+		}
+
+		/* The GPU address is wherever this ends up getting mmapped */
+		args->flags |= MALI_MEM_NEED_MMAP;
+		args->gpu_va = a->cookie;
+	} else {
+		a->gpu_va = PANFAKE_GPU_VA_BASE + a->offset;
+		args->gpu_va = a->gpu_va;
+	}
+
+	args->va_alignment = 0;
+	return MALI_ERROR_NONE;
+}
+
+static enum mali_error
+panfake_mem_commit(struct panfake_context *ctx,
+		   struct mali_ioctl_mem_commit *args)
+{
+	struct panfake_allocation *a =
+		panfake_find_allocation(ctx, args->gpu_addr);
+
+	args->result_subcode = 0;
+	if (!a || args->pages > a->va_pages)
+		return MALI_ERROR_FUNCTION_FAILED;
+
+	panfake_set_commit(ctx, a, args->pages);
+	return MALI_ERROR_NONE;
+}
+
+static enum mali_error
+panfake_mem_query(struct panfake_context *ctx,
+		  struct mali_ioctl_mem_query *args)
+{
+	struct panfake_allocation *a =
+		panfake_find_allocation(ctx, args->gpu_addr);
+
+	if (!a)
+		return MALI_ERROR_FUNCTION_FAILED;
+
+	switch (args->query) {
+	case MALI_MEM_QUERY_COMMIT_SIZE:
+		args->value = a->commit_pages;
+		break;
+	case MALI_MEM_QUERY_VA_SIZE:
+		args->value = a->va_pages;
+		break;
+	case MALI_MEM_QUERY_FLAGS:
+		args->value = a->flags;
+		break;
+	default:
+		return MALI_ERROR_FUNCTION_FAILED;
+	}
+
+	return MALI_ERROR_NONE;
+}
+
+static enum mali_error
+panfake_mem_free(struct panfake_context *ctx, struct mali_ioctl_mem_free *args)
+{
+	struct panfake_allocation *a =
+		panfake_find_allocation(ctx, args->gpu_addr);
+
+	/* SAME_VA memory that was never mapped can be freed by its cookie */
+	if (!a)
+		a = panfake_find_cookie(ctx, args->gpu_addr);
+	if (!a || (a->gpu_va && a->gpu_va != args->gpu_addr))
+		return MALI_ERROR_FUNCTION_FAILED;
+
+	panfake_allocation_destroy(ctx, a);
+	return MALI_ERROR_NONE;
+}
+
+static enum mali_error
+panfake_mem_flags_change(struct panfake_context *ctx,
+			 struct mali_ioctl_mem_flags_change *args)
+{
+	struct panfake_allocation *a =
+		panfake_find_allocation(ctx, args->gpu_va);
+
+	if (!a)
+		return MALI_ERROR_FUNCTION_FAILED;
+
+	a->flags = (a->flags & ~args->mask) | (args->flags & args->mask);
+	return MALI_ERROR_NONE;
+}
+
+static enum mali_error
+panfake_gpu_props_reg_dump(struct panfake_context *ctx,
+			   struct mali_ioctl_gpu_props_reg_dump *args)
+{
+	u64 shader_present = (1ull << shader_cores) - 1;
+
+	memset((void *)args + sizeof(args->header), 0,
+	       sizeof(*args) - sizeof(args->header));
+
+	args->core.product_id = gpu_id >> 16;
+	args->core.major_revision = (gpu_id >> 12) & 0xf;
+	args->core.minor_revision = (gpu_id >> 4) & 0xff;
+	args->core.version_status = gpu_id & 0xf;
+	args->core.gpu_speed_mhz = gpu_mhz;
+	args->core.gpu_freq_khz_max = gpu_mhz * 1000;
+	args->core.gpu_freq_khz_min = gpu_mhz * 1000;
+	args->core.log2_program_counter_size = 24;
+	args->core.gpu_available_memory_size = mem_size;
+	for (int i = 0; i < MALI_GPU_NUM_TEXTURE_FEATURES_REGISTERS; i++) {
+		args->core.texture_features[i] = ~0;
+		args->raw.texture_features[i] = ~0;
+	}
+
+	args->l2.log2_line_size = 6;
+	args->l2.log2_cache_size = 20;
+	args->l2.num_l2_slices = 1;
+
+	args->tiler.bin_size_bytes = 512;
+	args->tiler.max_active_levels = 4;
+
+	args->thread.max_threads = 384;
+	args->thread.max_workgroup_size = 384;
+	args->thread.max_barrier_size = 384;
+	args->thread.max_registers = 16384;
+	args->thread.max_task_queue = 3;
+	args->thread.max_thread_group_split = 10;
+	args->thread.impl_tech = MALI_GPU_IMPLEMENTATION_SW;
+
+	args->raw.shader_present = shader_present;
+	args->raw.tiler_present = 1;
+	args->raw.l2_present = 1;
+	args->raw.stack_present = shader_present;
+	args->raw.l2_features = (args->l2.log2_cache_size << 16) |
+				args->l2.log2_line_size;
+	args->raw.mmu_features = 0x2830; /* 48 bit VA, 40 bit PA */
+	args->raw.as_present = 0xff;
+	args->raw.js_present = (1u << panfake_sched_job_slots()) - 1;
+	args->raw.tiler_features = 0x409;
+	args->raw.gpu_id = gpu_id;
+	args->raw.thread_max_threads = args->thread.max_threads;
+	args->raw.thread_max_workgroup_size = args->thread.max_workgroup_size;
+	args->raw.thread_max_barrier_size = args->thread.max_barrier_size;
+	args->raw.coherency_mode = COHERENCY_NONE;
+
+	args->coherency_info.num_groups = 1;
+	args->coherency_info.num_core_groups = 1;
+	args->coherency_info.coherency = COHERENCY_NONE;
+	args->coherency_info.group[0].core_mask = shader_present;
+	args->coherency_info.group[0].num_cores = shader_cores;
+
+	return MALI_ERROR_NONE;
+}
+
+static enum mali_error
+panfake_stream_create(struct panfake_context *ctx,
+		      struct mali_ioctl_stream_create *args)
+{
+	int fds[2];
+
+	/* We don't have anything to put in the timeline stream, so just hand
+	 * out something that reads as empty */
+	if (pipe2(fds, O_CLOEXEC | O_NONBLOCK))
+		return MALI_ERROR_FUNCTION_FAILED;
+
+	close(fds[1]);
+	args->fd = fds[0];
+	return MALI_ERROR_NONE;
+}
+
+static enum mali_error
+panfake_job_submit(struct panfake_context *ctx,
+		   struct mali_ioctl_job_submit *args)
+{
+	const struct mali_jd_atom_v2 *atoms = args->addr;
+
+	if (args->stride != sizeof(*atoms))
+		return MALI_ERROR_FUNCTION_FAILED;
+
+	if (panfake_sched_enabled()) {
+		panfake_sched_submit(ctx, atoms, args->nr_atoms);
+		return MALI_ERROR_NONE;
+	}
+
+	/* Without the latency model, jobs complete the moment they're
+	 * submitted */
+	for (int i = 0; i < args->nr_atoms; i++)
+		panfake_send_event(ctx, &atoms[i], MALI_JD_EVENT_DONE);
+
+	return MALI_ERROR_NONE;
+}
+
+static int
+panfake_ioctl(struct panfake_context *ctx, unsigned long int request,
+	      void *ptr)
+{
+	union mali_ioctl_header *header = ptr;
+	enum mali_error rc = MALI_ERROR_NONE;
+
+	if (!ptr || _IOC_SIZE(request) < sizeof(*header) ||
+	    (_IOC_TYPE(request) != 0x80 && _IOC_TYPE(request) != 0x82)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_GET_VERSION) ||
+	    IOCTL_MATCHES(request, MALI_IOCTL_GET_VERSION_NEW)) {
+		struct mali_ioctl_get_version *args = ptr;
+
+		args->major = 10;
+		args->minor = 4;
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_ALLOC)) {
+		rc = panfake_mem_alloc(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_COMMIT)) {
+		rc = panfake_mem_commit(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_QUERY)) {
+		rc = panfake_mem_query(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_FREE)) {
+		rc = panfake_mem_free(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_FLAGS_CHANGE)) {
+		rc = panfake_mem_flags_change(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_GPU_PROPS_REG_DUMP)) {
+		rc = panfake_gpu_props_reg_dump(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_STREAM_CREATE)) {
+		rc = panfake_stream_create(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_GET_CONTEXT_ID)) {
+		struct mali_ioctl_get_context_id *args = ptr;
+
+		args->id = ctx->id;
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		rc = panfake_job_submit(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_IMPORT) ||
+		   IOCTL_MATCHES(request, MALI_IOCTL_MEM_ALIAS)) {
+		rc = MALI_ERROR_FUNCTION_FAILED;
+	}
+	/* Everything else (SET_FLAGS, SYNC, ...) has nothing to do, since the
+	 * "GPU" shares memory with the CPU */
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	header->rc = rc;
+	return 0;
+}
+
+static int
+panfake_context_create(int flags)
+{
+	struct panfake_context *ctx;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds))
+		return -1;
+
+	if (fds[0] >= PANFAKE_MAX_FDS) {
+		close(fds[0]);
+		close(fds[1]);
+		errno = EMFILE;
+		return -1;
+	}
+
+	if (flags & O_NONBLOCK)
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	if (!(flags & O_CLOEXEC))
+		fcntl(fds[0], F_SETFD, 0);
+
+	ctx = calloc(1, sizeof(*ctx));
+	ctx->fd = fds[0];
+	ctx->event_fd = fds[1];
+	ctx->mem_size = mem_size;
+	list_init(&ctx->allocations);
+	pthread_mutex_init(&ctx->lock, NULL);
+
+	ctx->mem_fd = syscall(SYS_memfd_create, "panfake", 1 /* CLOEXEC */);
+	if (ctx->mem_fd < 0 || ftruncate(ctx->mem_fd, ctx->mem_size))
+		goto fail;
+
+	ctx->mem = mmap(NULL, ctx->mem_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_NORESERVE, ctx->mem_fd, 0);
+	if (ctx->mem == MAP_FAILED)
+		goto fail;
+
+	pthread_mutex_lock(&contexts_lock);
+	ctx->id = next_context_id++;
+	contexts[ctx->fd] = ctx;
+	pthread_mutex_unlock(&contexts_lock);
+
+	return ctx->fd;
+
+fail:
+	fprintf(stderr, "panfake: Failed to create GPU memory: %s\n",
+		strerror(errno));
+	if (ctx->mem_fd >= 0)
+		close(ctx->mem_fd);
+	close(fds[0]);
+	close(fds[1]);
+	free(ctx);
+	errno = ENOMEM;
+	return -1;
+}
+
+static void
+panfake_context_destroy(struct panfake_context *ctx)
+{
+	struct panfake_allocation *pos, *tmp;
+
+	pthread_mutex_lock(&contexts_lock);
+	contexts[ctx->fd] = NULL;
+	pthread_mutex_unlock(&contexts_lock);
+
+	panfake_sched_context_destroy(ctx);
+
+	list_for_each_entry_safe(pos, tmp, &ctx->allocations, node)
+		free(pos);
+
+	munmap(ctx->mem, ctx->mem_size);
+	close(ctx->mem_fd);
+	close(ctx->event_fd);
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+static void *
+panfake_mmap(struct panfake_context *ctx, void *addr, size_t length,
+	     int prot, int flags, u64 offset)
+{
+	struct panfake_allocation *a;
+	u64 mem_offset;
+	void *ret = MAP_FAILED;
+	PROLOG(mmap);
+
+	pthread_mutex_lock(&ctx->lock);
+
+	a = panfake_find_cookie(ctx, offset);
+	if (a) {
+		mem_offset = a->offset;
+	} else {
+		a = panfake_find_allocation(ctx, offset);
+		if (!a)
+			goto out;
+
+		mem_offset = a->offset + (offset - a->gpu_va);
+	}
+
+	if (mem_offset + length > a->offset + a->va_pages * PANFAKE_PAGE_SIZE)
+		goto out;
+
+	ret = orig_mmap(addr, length, prot, flags, ctx->mem_fd, mem_offset);
+	if (ret != MAP_FAILED && !a->gpu_va)
+		a->gpu_va = (uintptr_t)ret;
+
+out:
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (ret == MAP_FAILED && errno == 0)
+		errno = EINVAL;
+	return ret;
+}
+
+/**
+ * Overriden libc functions start here
+ */
+static inline int
+panfake_open_wrap(typeof(open) *func, const char *path, int flags,
+		  va_list args)
+{
+	if (strcmp(path, device_path) == 0)
+		return panfake_context_create(flags);
+
+	if (flags & O_CREAT)
+		return func(path, flags, (mode_t) va_arg(args, int));
+	else
+		return func(path, flags);
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	PROLOG(open);
+	va_list args;
+	va_start(args, flags);
+	int o = panfake_open_wrap(orig_open, path, flags, args);
+	va_end(args);
+	return o;
+}
+
+int
+open64(const char *path, int flags, ...)
+{
+	PROLOG(open64);
+	va_list args;
+	va_start(args, flags);
+	int o = panfake_open_wrap(orig_open64, path, flags, args);
+	va_end(args);
+	return o;
+}
+
+int
+close(int fd)
+{
+	struct panfake_context *ctx = panfake_get_context(fd);
+	PROLOG(close);
+
+	if (ctx)
+		panfake_context_destroy(ctx);
+
+	return orig_close(fd);
+}
+
+/* XXX: Android has a messed up ioctl signature */
+int
+ioctl(int fd, int request, ...)
+{
+	struct panfake_context *ctx = panfake_get_context(fd);
+	void *ptr;
+	va_list args;
+	PROLOG(ioctl);
+
+	va_start(args, request);
+	ptr = va_arg(args, void *);
+	va_end(args);
+
+	if (!ctx)
+		return orig_ioctl(fd, request, ptr);
+
+	return panfake_ioctl(ctx, request, ptr);
+}
+
+void *
+mmap64(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	struct panfake_context *ctx = panfake_get_context(fd);
+	PROLOG(mmap64);
+
+	if (!ctx)
+		return orig_mmap64(addr, length, prot, flags, fd, offset);
+
+	errno = 0;
+	return panfake_mmap(ctx, addr, length, prot, flags, offset);
+}
+
+#ifdef IS_MMAP64_SEPERATE_SYMBOL
+void *
+mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+#ifdef IS_64_BIT
+	struct panfake_context *ctx = panfake_get_context(fd);
+	PROLOG(mmap);
+
+	if (!ctx)
+		return orig_mmap(addr, length, prot, flags, fd, offset);
+
+	errno = 0;
+	return panfake_mmap(ctx, addr, length, prot, flags, offset);
+#else
+	return mmap64(addr, length, prot, flags, fd, (loff_t) offset);
+#endif
+}
+#endif
+
+static void __attribute__((constructor))
+panfake_init()
+{
+	device_path = getenv("PANFAKE_DEVICE") ?: device_path;
+	mem_size = panfake_parse_env_long("PANFAKE_MEM_MB", 1024) * 1024 * 1024;
+	gpu_id = panfake_parse_env_long("PANFAKE_GPU_ID", 0x60000000);
+	shader_cores = MIN(panfake_parse_env_long("PANFAKE_SHADER_CORES", 8),
+			   32);
+	gpu_mhz = panfake_parse_env_long("PANFAKE_GPU_MHZ", 850);
+}
@@ -0,0 +1,76 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANFAKE_H__
+#define __PANFAKE_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include <mali-ioctl.h>
+#include <list.h>
+
+#define PANFAKE_PAGE_SIZE   4096
+#define PANFAKE_GPU_VA_BASE 0x10000000
+
+struct panfake_allocation {
+	mali_ptr gpu_va; /* 0 for SAME_VA memory until it gets mmapped */
+	u64 cookie;      /* What SAME_VA memory gets mmapped with */
+	u64 offset;      /* Where the memory lives in the context's memfd */
+	u64 va_pages;
+	u64 commit_pages;
+	u64 flags;
+
+	struct list node; /* Sorted by offset */
+};
+
+/* Everything belonging to a single open() of the fake device */
+struct panfake_context {
+	int fd;       /* The application's end of the event socket */
+	int event_fd; /* Our end */
+	u32 id;
+
+	/* All of the context's GPU memory lives in one sparse memfd, which
+	 * the "GPU" accesses through its own mapping of it */
+	int mem_fd;
+	void *mem;
+	u64 mem_size;
+
+	struct list allocations;
+	pthread_mutex_t lock;
+};
+
+#define PROLOG(func) 					\
+	static typeof(func) *orig_##func = NULL;	\
+	if (!orig_##func)				\
+		orig_##func = panfake_dlsym(#func);	\
+
+void *panfake_dlsym(const char *name);
+long panfake_parse_env_long(const char *env, long def);
+
+void *panfake_gpu_mem(struct panfake_context *ctx, mali_ptr gpu_va,
+		      size_t size);
+void panfake_send_event(struct panfake_context *ctx,
+			const struct mali_jd_atom_v2 *atom,
+			enum mali_jd_event_code code);
+
+bool panfake_sched_enabled();
+void panfake_sched_submit(struct panfake_context *ctx,
+			  const struct mali_jd_atom_v2 *atoms,
+			  unsigned int count);
+void panfake_sched_context_destroy(struct panfake_context *ctx);
+unsigned int panfake_sched_job_slots();
+
+#endif /* __PANFAKE_H__ */
@@ -0,0 +1,514 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * panreplay: issues the ioctls and mmaps from a capture taken with
+ * PANWRAP_CAPTURE=<path> against a device again, without needing the
+ * application that made them.
+ *
+ * The kernel is free to hand out different GPU addresses and mmap cookies
+ * than it did during the capture, so we keep track of what each one got
+ * remapped to and fix up the ioctl args as we go. Memory mapped with SAME_VA
+ * gets mapped at its original address whenever possible, since the job
+ * chains themselves contain GPU pointers which we can't fix up without fully
+ * decoding them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <mali-ioctl.h>
+#include <panloader-util.h>
+#include <panloader-capture.h>
+
+/* Maps a range of addresses from the capture to where they ended up now */
+struct relocation {
+	u64 old;
+	u64 new;
+	u64 size;
+};
+
+struct mapping {
+	u64 old;
+	void *new;
+	u64 length;
+	int prot;
+};
+
+/* CPU memory saved from the capture that isn't part of any mapping */
+struct saved_memory {
+	u64 addr;
+	u64 size;
+	void *data;
+};
+
+struct fd_map {
+	int old;
+	int new;
+};
+
+static struct relocation *relocs;
+static size_t nr_relocs;
+
+static struct mapping *mappings;
+static size_t nr_mappings;
+
+static struct saved_memory *saved;
+static size_t nr_saved;
+
+static struct fd_map *fds;
+static size_t nr_fds;
+
+static const char *device_path = "/dev/mali0";
+static bool verbose;
+
+static struct {
+	unsigned int ioctls;
+	unsigned int mmaps;
+	unsigned int ret_mismatches;
+	unsigned int skipped;
+	unsigned int moved_mappings;
+} stats;
+
+#define GROW(array, count) \
+	(array = realloc(array, sizeof(*(array)) * ((count) + 1)), \
+	 &(array)[(count)++])
+
+static void
+add_relocation(u64 old, u64 new, u64 size)
+{
+	*GROW(relocs, nr_relocs) = (struct relocation) {
+		.old = old, .new = new, .size = size
+	};
+}
+
+static u64
+relocate(u64 addr)
+{
+	/* Search newest first, since addresses can get reused */
+	for (ssize_t i = nr_relocs - 1; i >= 0; i--) {
+		const struct relocation *r = &relocs[i];
+
+		if (addr >= r->old && addr < r->old + r->size)
+			return r->new + (addr - r->old);
+	}
+
+	return addr;
+}
+
+static struct mapping *
+find_mapping(u64 addr)
+{
+	for (ssize_t i = nr_mappings - 1; i >= 0; i--) {
+		struct mapping *m = &mappings[i];
+
+		if (m->new && addr >= m->old && addr < m->old + m->length)
+			return m;
+	}
+
+	return NULL;
+}
+
+static void *
+find_saved_memory(u64 addr)
+{
+	for (ssize_t i = nr_saved - 1; i >= 0; i--) {
+		if (addr >= saved[i].addr &&
+		    addr < saved[i].addr + saved[i].size)
+			return saved[i].data + (addr - saved[i].addr);
+	}
+
+	return NULL;
+}
+
+static void
+free_saved_memory()
+{
+	for (size_t i = 0; i < nr_saved; i++)
+		free(saved[i].data);
+
+	nr_saved = 0;
+}
+
+static int
+lookup_fd(int old)
+{
+	for (size_t i = 0; i < nr_fds; i++) {
+		if (fds[i].old == old)
+			return fds[i].new;
+	}
+
+	return -1;
+}
+
+static int
+replay_open(const struct panloader_capture_fd *rec)
+{
+	struct fd_map *map;
+	int fd = open(device_path, O_RDWR | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			device_path, strerror(errno));
+		return -1;
+	}
+
+	map = GROW(fds, nr_fds);
+	map->old = rec->fd;
+	map->new = fd;
+
+	return 0;
+}
+
+static int
+replay_close(const struct panloader_capture_fd *rec)
+{
+	for (size_t i = 0; i < nr_fds; i++) {
+		if (fds[i].old != rec->fd)
+			continue;
+
+		close(fds[i].new);
+		fds[i] = fds[--nr_fds];
+		break;
+	}
+
+	return 0;
+}
+
+static void
+replay_memory(const struct panloader_capture_memory *rec, const void *data)
+{
+	struct mapping *m = find_mapping(rec->addr);
+	struct saved_memory *s;
+
+	if (m) {
+		/* Read-only mappings get their contents from the GPU */
+		if ((m->prot & PROT_WRITE) &&
+		    rec->addr + rec->size <= m->old + m->length)
+			memcpy(m->new + (rec->addr - m->old), data, rec->size);
+		return;
+	}
+
+	s = GROW(saved, nr_saved);
+	s->addr = rec->addr;
+	s->size = rec->size;
+	s->data = malloc(rec->size);
+	memcpy(s->data, data, rec->size);
+}
+
+static int
+replay_mmap(const struct panloader_capture_mmap *rec)
+{
+	struct mapping *m;
+	void *addr;
+	int fd = lookup_fd(rec->fd);
+
+	if (fd < 0) {
+		fprintf(stderr, "mmap on unknown fd %d\n", rec->fd);
+		return -1;
+	}
+
+	addr = mmap((void *)(uintptr_t)rec->addr, rec->length, rec->prot,
+		    rec->flags & ~MAP_FIXED, fd, relocate(rec->offset));
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "mmap of 0x%" PRIx64 " failed: %s\n",
+			rec->offset, strerror(errno));
+		return -1;
+	}
+
+	if ((uintptr_t)addr != rec->addr) {
+		if (!stats.moved_mappings++)
+			fprintf(stderr, "Warning: couldn't map memory at its original address, GPU pointers to it will be stale\n");
+	}
+
+	m = GROW(mappings, nr_mappings);
+	m->old = rec->addr;
+	m->new = addr;
+	m->length = rec->length;
+	m->prot = rec->prot;
+
+	add_relocation(rec->addr, (uintptr_t)addr, rec->length);
+	stats.mmaps++;
+
+	return 0;
+}
+
+static int
+replay_munmap(const struct panloader_capture_munmap *rec)
+{
+	struct mapping *m = find_mapping(rec->addr);
+
+	if (!m)
+		return 0;
+
+	munmap(m->new, m->length);
+	m->new = NULL;
+
+	return 0;
+}
+
+/*
+ * Fix up any pointers in the ioctl's args. Returns false if the ioctl can't be
+ * replayed at all.
+ */
+static bool
+fixup_ioctl_pre(u32 request, void *ptr)
+{
+	if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_COMMIT)) {
+		struct mali_ioctl_mem_commit *args = ptr;
+
+		args->gpu_addr = relocate(args->gpu_addr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_QUERY)) {
+		struct mali_ioctl_mem_query *args = ptr;
+
+		args->gpu_addr = relocate(args->gpu_addr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_FREE)) {
+		struct mali_ioctl_mem_free *args = ptr;
+
+		args->gpu_addr = relocate(args->gpu_addr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_FLAGS_CHANGE)) {
+		struct mali_ioctl_mem_flags_change *args = ptr;
+
+		args->gpu_va = relocate(args->gpu_va);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_SYNC)) {
+		struct mali_ioctl_sync *args = ptr;
+
+		args->handle = relocate(args->handle);
+		args->user_addr =
+			(void *)(uintptr_t)relocate((uintptr_t)args->user_addr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		struct mali_ioctl_job_submit *args = ptr;
+		struct mali_jd_atom_v2 *atoms;
+
+		atoms = find_saved_memory((uintptr_t)args->addr);
+		if (!atoms || args->stride != sizeof(*atoms))
+			return false;
+
+		args->addr = atoms;
+		for (int i = 0; i < args->nr_atoms; i++) {
+			struct mali_jd_atom_v2 *a = &atoms[i];
+			struct mali_external_resource *res;
+
+			a->jc = relocate(a->jc);
+			if (!a->ext_res_list)
+				continue;
+
+			res = find_saved_memory((uintptr_t)a->ext_res_list);
+			if (!res)
+				return false;
+
+			a->ext_res_list = res;
+			for (int j = 0; j < a->nr_ext_res; j++) {
+				u64 *r = &res[j].ext_resource[0];
+				u64 access = *r & MALI_EXT_RES_ACCESS_EXCLUSIVE;
+
+				*r = relocate(*r & ~access) | access;
+			}
+		}
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_IMPORT) ||
+		   IOCTL_MATCHES(request, MALI_IOCTL_MEM_ALIAS)) {
+		/* These reference resources outside of the capture */
+		return false;
+	}
+
+	return true;
+}
+
+static void
+fixup_ioctl_post(u32 request, const void *ptr, const void *captured)
+{
+	if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_ALLOC)) {
+		const struct mali_ioctl_mem_alloc *args = ptr, *old = captured;
+
+		add_relocation(old->gpu_va, args->gpu_va,
+			       MAX(old->va_pages, 1) * 4096);
+	}
+}
+
+static int
+replay_ioctl(const struct panloader_capture_ioctl *rec, const void *data)
+{
+	const void *pre = data, *post = data + rec->arg_size;
+	unsigned char *args = NULL;
+	int fd = lookup_fd(rec->fd);
+	int ret;
+
+	if (fd < 0) {
+		fprintf(stderr, "ioctl on unknown fd %d\n", rec->fd);
+		return -1;
+	}
+
+	if (rec->arg_size) {
+		args = malloc(rec->arg_size);
+		memcpy(args, pre, rec->arg_size);
+	}
+
+	if (args && !fixup_ioctl_pre(rec->request, args)) {
+		if (verbose)
+			printf("Skipping ioctl 0x%x\n", rec->request);
+		stats.skipped++;
+		goto out;
+	}
+
+	ret = ioctl(fd, rec->request, args);
+	stats.ioctls++;
+
+	if (verbose)
+		printf("ioctl 0x%x: ret %d (was %d)\n",
+		       rec->request, ret, rec->ret);
+
+	if (ret != rec->ret)
+		stats.ret_mismatches++;
+
+	if (args && ret == 0)
+		fixup_ioctl_post(rec->request, args, post);
+
+out:
+	free(args);
+	free_saved_memory();
+	return 0;
+}
+
+static int
+replay(FILE *f)
+{
+	struct panloader_capture_header header;
+	struct panloader_capture_record record;
+	void *data = NULL;
+	int ret = 0;
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    header.magic != PANLOADER_CAPTURE_MAGIC) {
+		fprintf(stderr, "Not a panwrap capture\n");
+		return -1;
+	}
+
+	if (header.version != PANLOADER_CAPTURE_VERSION) {
+		fprintf(stderr, "Unsupported capture version %d\n",
+			header.version);
+		return -1;
+	}
+
+	if (header.pointer_size != sizeof(void *)) {
+		fprintf(stderr, "Capture was taken on a %d bit system, but we're %zd bit\n",
+			header.pointer_size * 8, sizeof(void *) * 8);
+		return -1;
+	}
+
+	while (!ret && fread(&record, sizeof(record), 1, f) == 1) {
+		data = realloc(data, record.size);
+		if (fread(data, record.size, 1, f) != 1) {
+			fprintf(stderr, "Capture is truncated\n");
+			ret = -1;
+			break;
+		}
+
+		switch (record.type) {
+		case PANLOADER_CAPTURE_OPEN:
+			ret = replay_open(data);
+			break;
+		case PANLOADER_CAPTURE_CLOSE:
+			ret = replay_close(data);
+			break;
+		case PANLOADER_CAPTURE_IOCTL:
+			ret = replay_ioctl(data,
+			    data + sizeof(struct panloader_capture_ioctl));
+			break;
+		case PANLOADER_CAPTURE_MMAP:
+			ret = replay_mmap(data);
+			break;
+		case PANLOADER_CAPTURE_MUNMAP:
+			ret = replay_munmap(data);
+			break;
+		case PANLOADER_CAPTURE_MEMORY:
+			replay_memory(data,
+			    data + sizeof(struct panloader_capture_memory));
+			break;
+		default:
+			fprintf(stderr, "Unknown record type %d\n",
+				record.type);
+			ret = -1;
+			break;
+		}
+	}
+
+	free(data);
+	return ret;
+}
+
+static void
+usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-v] <capture> [device]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start, end;
+	FILE *f;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "v")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (optind + 1 < argc)
+		device_path = argv[optind + 1];
+
+	f = fopen(argv[optind], "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			argv[optind], strerror(errno));
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = replay(f);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fclose(f);
+
+	printf("Replayed %u ioctls and %u mmaps in %.3f ms\n",
+	       stats.ioctls, stats.mmaps,
+	       (end.tv_sec - start.tv_sec) * 1000.0 +
+	       (end.tv_nsec - start.tv_nsec) / 1000000.0);
+	if (stats.skipped)
+		printf("%u ioctls couldn't be replayed\n", stats.skipped);
+	if (stats.ret_mismatches)
+		printf("%u ioctls returned something different than during capture\n",
+		       stats.ret_mismatches);
+	if (stats.moved_mappings)
+		printf("%u mappings moved\n", stats.moved_mappings);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Atom dependency scheduling
+ *
+ * With PANWRAP_ATOM_SIM=1, we collect the atoms each context submits, across
+ * however many JOB_SUBMIT calls it takes, into one graph per frame (a frame
+ * ending with each fragment atom, like in panwrap-timeline.c). Edges come from
+ * the atoms' pre_dep, and each atom costs as many units of time as there are
+ * jobs in its chain. Soft jobs and atoms without a chain cost nothing.
+ *
+ * Each graph then gets run through a simple list scheduler with
+ * PANWRAP_ATOM_SIM_SLOTS (3 by default) job slots four times:
+ *
+ *  - as submitted, starting atoms strictly in submission order
+ *  - reordered, starting whichever atom is ready first
+ *  - reordered, and without the ORDER-only dependencies
+ *  - reordered, and without any dependencies at all
+ *
+ * The differences between these are the most we could win by reordering or
+ * relaxing the dependencies. We also point out ORDER dependencies that are
+ * already implied by an atom's other dependencies, which can simply go away.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <mali-job-schema.h>
+#include "panwrap.h"
+
+#define MAX_SLOTS 16
+#define MAX_CHAIN_COST 1024
+
+enum atom_sim {
+	ATOM_SIM_AS_SUBMITTED,
+	ATOM_SIM_REORDERED,
+	ATOM_SIM_NO_ORDER_DEPS,
+	ATOM_SIM_NO_DEPS,
+};
+
+static bool enabled;
+static int slots;
+
+static bool
+atom_dep_is_order_only(const struct panwrap_atom_graph *g, int i, int d)
+{
+	return g->atoms[i].dep_types[d] == MALI_JD_DEP_TYPE_ORDER;
+}
+
+static bool
+atom_dep_honored(const struct panwrap_atom_graph *g, int i, int d,
+		 enum atom_sim sim)
+{
+	if (g->atoms[i].deps[d] < 0)
+		return false;
+
+	switch (sim) {
+	case ATOM_SIM_NO_DEPS:
+		return false;
+	case ATOM_SIM_NO_ORDER_DEPS:
+		return !atom_dep_is_order_only(g, i, d);
+	default:
+		return true;
+	}
+}
+
+static unsigned int
+atom_chain_cost(mali_ptr jc)
+{
+	unsigned int jobs = 0;
+
+	while (jc && jobs < MAX_CHAIN_COST) {
+		struct panwrap_mapped_memory *mem =
+			panwrap_find_mapped_gpu_mem_containing(jc);
+		const struct mali_job_descriptor_header *h;
+		struct mali_job_descriptor_header_unpacked hu;
+
+		if (!mem || jc + sizeof(*h) > mem->gpu_va + mem->length)
+			break;
+
+		h = panwrap_deref_gpu_mem(mem, jc, sizeof(*h));
+		mali_job_descriptor_header_unpack(h, &hu);
+		jobs++;
+		jc = mali_job_next(&hu);
+	}
+
+	return MAX(jobs, 1);
+}
+
+static u64
+atom_graph_simulate(const struct panwrap_atom_graph *g, enum atom_sim sim)
+{
+	u64 finish[PANWRAP_ATOM_GRAPH_MAX] = {};
+	bool done[PANWRAP_ATOM_GRAPH_MAX] = {};
+	u64 slot_free[MAX_SLOTS] = {};
+	u64 last_start = 0, makespan = 0;
+
+	for (int n = 0; n < g->count; n++) {
+		u64 best_start = 0;
+		int best = -1, best_slot = 0;
+
+		for (int s = 1; s < slots; s++) {
+			if (slot_free[s] < slot_free[best_slot])
+				best_slot = s;
+		}
+
+		for (int i = 0; i < g->count; i++) {
+			u64 start = sim == ATOM_SIM_AS_SUBMITTED ? last_start : 0;
+			bool ready = !done[i];
+
+			for (int d = 0; d < 2 && ready; d++) {
+				if (!atom_dep_honored(g, i, d, sim))
+					continue;
+
+				ready = done[g->atoms[i].deps[d]];
+				start = MAX(start, finish[g->atoms[i].deps[d]]);
+			}
+
+			if (!ready)
+				continue;
+
+			if (g->atoms[i].cost)
+				start = MAX(start, slot_free[best_slot]);
+
+			if (best < 0 || start < best_start) {
+				best = i;
+				best_start = start;
+			}
+
+			/* In order, the next atom is the only candidate */
+			if (sim == ATOM_SIM_AS_SUBMITTED)
+				break;
+		}
+
+		finish[best] = best_start + g->atoms[best].cost;
+		done[best] = true;
+		last_start = best_start;
+		makespan = MAX(makespan, finish[best]);
+
+		if (g->atoms[best].cost)
+			slot_free[best_slot] = finish[best];
+	}
+
+	return makespan;
+}
+
+/* Complain about ORDER dependencies the other dependencies already imply */
+static void
+atom_graph_check_order_deps(const struct panwrap_atom_graph *g)
+{
+	u64 ancestors[PANWRAP_ATOM_GRAPH_MAX][PANWRAP_ATOM_GRAPH_MAX / 64];
+
+	memset(ancestors, 0, sizeof(ancestors[0]) * g->count);
+
+	for (int i = 0; i < g->count; i++) {
+		for (int d = 0; d < 2; d++) {
+			int p = g->atoms[i].deps[d];
+			int other = g->atoms[i].deps[!d];
+
+			if (p < 0)
+				continue;
+
+			for (int w = 0; w < ARRAY_SIZE(ancestors[i]); w++)
+				ancestors[i][w] |= ancestors[p][w];
+			ancestors[i][p / 64] |= 1ull << (p % 64);
+
+			if (atom_dep_is_order_only(g, i, d) && other >= 0 &&
+			    other != p &&
+			    ancestors[other][p / 64] & (1ull << (p % 64))) {
+				panwrap_log("Atom %d's ORDER dependency on atom %d is already implied by its dependency on atom %d\n",
+					    g->atoms[i].number, g->atoms[p].number,
+					    g->atoms[other].number);
+			}
+		}
+	}
+}
+
+static void
+atom_graph_flush(struct panwrap_context *ctx)
+{
+	struct panwrap_atom_graph *g = &ctx->atom_graph;
+	int data_deps = 0, order_deps = 0;
+	unsigned int jobs = 0;
+	u64 times[4];
+
+	if (!g->count)
+		return;
+
+	for (int i = 0; i < g->count; i++) {
+		jobs += g->atoms[i].cost;
+
+		for (int d = 0; d < 2; d++) {
+			if (g->atoms[i].deps[d] < 0)
+				continue;
+
+			if (atom_dep_is_order_only(g, i, d))
+				order_deps++;
+			else
+				data_deps++;
+		}
+	}
+
+	for (int sim = 0; sim < ARRAY_SIZE(times); sim++) {
+		times[sim] = atom_graph_simulate(g, sim);
+		g->totals[sim] += times[sim];
+	}
+	g->batches++;
+
+	panwrap_log("Atom graph: %d atoms, %d DATA and %d ORDER dependencies, %u jobs\n",
+		    g->count, data_deps, order_deps, jobs);
+	panwrap_indent++;
+	panwrap_log("Simulated on %d slots: as submitted %" PRIu64 ", reordered %" PRIu64 " (%.2fx), without ORDER dependencies %" PRIu64 " (%.2fx), without any dependencies %" PRIu64 " (%.2fx)\n",
+		    slots, times[ATOM_SIM_AS_SUBMITTED],
+		    times[ATOM_SIM_REORDERED],
+		    (double) times[0] / MAX(times[ATOM_SIM_REORDERED], 1),
+		    times[ATOM_SIM_NO_ORDER_DEPS],
+		    (double) times[0] / MAX(times[ATOM_SIM_NO_ORDER_DEPS], 1),
+		    times[ATOM_SIM_NO_DEPS],
+		    (double) times[0] / MAX(times[ATOM_SIM_NO_DEPS], 1));
+	atom_graph_check_order_deps(g);
+	panwrap_indent--;
+
+	g->count = 0;
+}
+
+void
+panwrap_atom_graph_submit(struct panwrap_context *ctx,
+			  const struct mali_ioctl_job_submit *args)
+{
+	struct panwrap_atom_graph *g = &ctx->atom_graph;
+	const struct mali_jd_atom_v2 *atoms = args->addr;
+	bool frame_done = false;
+
+	if (!enabled || args->stride != sizeof(*atoms))
+		return;
+
+	for (int i = 0; i < args->nr_atoms; i++) {
+		const struct mali_jd_atom_v2 *a = &atoms[i];
+		bool soft = a->core_req & MALI_JD_REQ_SOFT_JOB;
+		int n;
+
+		if (g->count == PANWRAP_ATOM_GRAPH_MAX)
+			atom_graph_flush(ctx);
+
+		n = g->count++;
+		g->atoms[n].number = a->atom_number;
+		g->atoms[n].cost = soft || !a->jc ? 0 : atom_chain_cost(a->jc);
+
+		for (int d = 0; d < 2; d++) {
+			const struct mali_jd_dependency *dep = &a->pre_dep[d];
+			int p = -1;
+
+			/* Atom numbers get reused, so look for the latest.
+			 * Anything from before this graph has been waited on
+			 * long enough already. */
+			if (dep->atom_id) {
+				for (p = n - 1;
+				     p >= 0 && g->atoms[p].number != dep->atom_id;
+				     p--);
+			}
+
+			g->atoms[n].deps[d] = p;
+			g->atoms[n].dep_types[d] = dep->dependency_type;
+		}
+
+		if (!soft && (a->core_req & MALI_JD_REQ_FS))
+			frame_done = true;
+	}
+
+	if (frame_done)
+		atom_graph_flush(ctx);
+}
+
+void
+panwrap_atom_graph_log_stats(const struct panwrap_context *ctx)
+{
+	const struct panwrap_atom_graph *g = &ctx->atom_graph;
+	const u64 *t = g->totals;
+
+	if (!g->batches)
+		return;
+
+	panwrap_log("Atom scheduling on context %u over %" PRIu64 " graphs: as submitted %" PRIu64 ", reordered %.2fx, without ORDER dependencies %.2fx, without any dependencies %.2fx faster\n",
+		    ctx->id, g->batches, t[ATOM_SIM_AS_SUBMITTED],
+		    (double) t[0] / MAX(t[ATOM_SIM_REORDERED], 1),
+		    (double) t[0] / MAX(t[ATOM_SIM_NO_ORDER_DEPS], 1),
+		    (double) t[0] / MAX(t[ATOM_SIM_NO_DEPS], 1));
+}
+
+static void __attribute__((constructor))
+panwrap_atom_graph_init()
+{
+	enabled = panwrap_parse_env_bool("PANWRAP_ATOM_SIM", false);
+	slots = MIN(MAX(panwrap_parse_env_long("PANWRAP_ATOM_SIM_SLOTS", 3), 1),
+		    MAX_SLOTS);
+}
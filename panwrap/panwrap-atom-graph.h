@@ -0,0 +1,44 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_ATOM_GRAPH_H__
+#define __PANWRAP_ATOM_GRAPH_H__
+
+#include <stdbool.h>
+#include <mali-ioctl.h>
+
+struct panwrap_context;
+
+#define PANWRAP_ATOM_GRAPH_MAX 256
+
+/* The atoms submitted on a context since the last frame, see
+ * panwrap-atom-graph.c */
+struct panwrap_atom_graph {
+	int count;
+	struct {
+		mali_atom_id number;
+		int deps[2];
+		mali_jd_dep_type dep_types[2];
+		unsigned int cost;
+	} atoms[PANWRAP_ATOM_GRAPH_MAX];
+
+	u64 batches;
+	u64 totals[4];
+};
+
+void panwrap_atom_graph_submit(struct panwrap_context *ctx,
+			       const struct mali_ioctl_job_submit *args);
+void panwrap_atom_graph_log_stats(const struct panwrap_context *ctx);
+
+#endif /* __PANWRAP_ATOM_GRAPH_H__ */
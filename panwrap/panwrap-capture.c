@@ -0,0 +1,286 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Capturing
+ *
+ * When PANWRAP_CAPTURE=<path> is set, every call we intercept on /dev/mali0
+ * gets written to <path> in the format described in panloader-capture.h, so
+ * that panreplay can issue the exact same sequence of calls again later
+ * without the original application. This happens independently of decoding.
+ * All contexts share one capture file, with each record written out whole
+ * under capture_lock; the memory of a JOB_SUBMIT or SYNC is written together
+ * with its ioctl record so nothing from other contexts ends up in between.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <mali-ioctl.h>
+#include <panloader-capture.h>
+#include "panwrap.h"
+#include "panwrap-capture.h"
+
+struct panwrap_capture_ioctl {
+	int fd;
+	unsigned long int request;
+
+	/* MEMORY records to write out along with the ioctl */
+	FILE *memory;
+	char *memory_data;
+	size_t memory_size;
+
+	size_t size;
+	unsigned char args[];
+};
+
+static FILE *capture_file;
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+capture_write_record(FILE *f, enum panloader_capture_record_type type,
+		     const void *data, size_t size,
+		     const void *extra, size_t extra_size,
+		     const void *extra2, size_t extra2_size)
+{
+	struct panloader_capture_record record = {
+		.type = type,
+		.size = size + extra_size + extra2_size,
+	};
+
+	fwrite(&record, sizeof(record), 1, f);
+	fwrite(data, size, 1, f);
+	if (extra_size)
+		fwrite(extra, extra_size, 1, f);
+	if (extra2_size)
+		fwrite(extra2, extra2_size, 1, f);
+}
+
+static void
+capture_write_locked(enum panloader_capture_record_type type,
+		     const void *data, size_t size)
+{
+	pthread_mutex_lock(&capture_lock);
+	capture_write_record(capture_file, type, data, size, NULL, 0, NULL, 0);
+	pthread_mutex_unlock(&capture_lock);
+}
+
+static void
+capture_memory(FILE *f, const void *addr, size_t size)
+{
+	struct panloader_capture_memory mem = {
+		.addr = (uintptr_t)addr,
+		.size = size,
+	};
+
+	if (!addr || !size)
+		return;
+
+	capture_write_record(f, PANLOADER_CAPTURE_MEMORY, &mem, sizeof(mem),
+			     addr, size, NULL, 0);
+}
+
+static void
+capture_job_submit_memory(FILE *f, const struct mali_ioctl_job_submit *args)
+{
+	const struct mali_jd_atom_v2 *atoms = args->addr;
+	struct panwrap_mapped_memory *pos;
+
+	/* A replay needs all of the memory the chains might use, not just
+	 * what the decoder reads, so save every mapping the CPU can read */
+	list_for_each_entry(pos, &panwrap_context_current()->mmaps, node) {
+		if (pos->prot & PROT_READ)
+			capture_memory(f, pos->addr, pos->length);
+	}
+
+	if (args->stride != sizeof(*atoms)) {
+		capture_memory(f, args->addr, args->stride * args->nr_atoms);
+		return;
+	}
+
+	capture_memory(f, atoms, sizeof(*atoms) * args->nr_atoms);
+	for (int i = 0; i < args->nr_atoms; i++) {
+		if (!atoms[i].ext_res_list)
+			continue;
+
+		capture_memory(f, atoms[i].ext_res_list,
+			       sizeof(*atoms[i].ext_res_list) *
+			       MAX(atoms[i].nr_ext_res, 1));
+	}
+}
+
+void
+panwrap_capture_open(int fd)
+{
+	struct panloader_capture_fd rec = { .fd = fd };
+
+	if (!capture_file)
+		return;
+
+	capture_write_locked(PANLOADER_CAPTURE_OPEN, &rec, sizeof(rec));
+}
+
+void
+panwrap_capture_close(int fd)
+{
+	struct panloader_capture_fd rec = { .fd = fd };
+
+	if (!capture_file)
+		return;
+
+	capture_write_locked(PANLOADER_CAPTURE_CLOSE, &rec, sizeof(rec));
+
+	pthread_mutex_lock(&capture_lock);
+	fflush(capture_file);
+	pthread_mutex_unlock(&capture_lock);
+}
+
+/**
+ * Save everything the kernel is about to see for this ioctl. Returns the
+ * state needed by panwrap_capture_ioctl_post(), or NULL if we're not
+ * capturing.
+ */
+struct panwrap_capture_ioctl *
+panwrap_capture_ioctl_pre(int fd, unsigned long int request, const void *ptr)
+{
+	struct panwrap_capture_ioctl *capture;
+	size_t size = ptr ? _IOC_SIZE(request) : 0;
+
+	if (!capture_file)
+		return NULL;
+
+	capture = calloc(1, sizeof(*capture) + size);
+	capture->memory = open_memstream(&capture->memory_data,
+					 &capture->memory_size);
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		capture_job_submit_memory(capture->memory, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_SYNC)) {
+		const struct mali_ioctl_sync *args = ptr;
+
+		if (args->type == MALI_SYNC_TO_DEVICE)
+			capture_memory(capture->memory, args->user_addr,
+				       args->size);
+	}
+
+	capture->fd = fd;
+	capture->request = request;
+	capture->size = size;
+	if (size)
+		memcpy(capture->args, ptr, size);
+
+	return capture;
+}
+
+void
+panwrap_capture_ioctl_post(struct panwrap_capture_ioctl *capture,
+			   const void *ptr, int ret)
+{
+	struct panloader_capture_ioctl rec;
+
+	if (!capture)
+		return;
+
+	rec = (struct panloader_capture_ioctl) {
+		.fd = capture->fd,
+		.request = capture->request,
+		.ret = ret,
+		.arg_size = capture->size,
+	};
+
+	fclose(capture->memory);
+
+	pthread_mutex_lock(&capture_lock);
+	fwrite(capture->memory_data, capture->memory_size, 1, capture_file);
+	capture_write_record(capture_file, PANLOADER_CAPTURE_IOCTL,
+			     &rec, sizeof(rec),
+			     capture->args, capture->size,
+			     ptr, capture->size);
+	pthread_mutex_unlock(&capture_lock);
+
+	free(capture->memory_data);
+	free(capture);
+}
+
+void
+panwrap_capture_mmap(int fd, void *addr, size_t length, int prot, int flags,
+		     off_t offset)
+{
+	struct panloader_capture_mmap rec = {
+		.addr = (uintptr_t)addr,
+		.length = length,
+		.prot = prot,
+		.flags = flags,
+		.fd = fd,
+		.offset = offset,
+	};
+
+	if (!capture_file || addr == MAP_FAILED)
+		return;
+
+	capture_write_locked(PANLOADER_CAPTURE_MMAP, &rec, sizeof(rec));
+}
+
+void
+panwrap_capture_munmap(void *addr, size_t length)
+{
+	struct panloader_capture_munmap rec = {
+		.addr = (uintptr_t)addr,
+		.length = length,
+	};
+
+	if (!capture_file)
+		return;
+
+	capture_write_locked(PANLOADER_CAPTURE_MUNMAP, &rec, sizeof(rec));
+}
+
+static void __attribute__((constructor))
+panwrap_capture_init()
+{
+	struct panloader_capture_header header = {
+		.magic = PANLOADER_CAPTURE_MAGIC,
+		.version = PANLOADER_CAPTURE_VERSION,
+		.pointer_size = sizeof(void *),
+	};
+	const char *path = getenv("PANWRAP_CAPTURE");
+
+	if (!path)
+		return;
+
+	capture_file = fopen(path, "w");
+	if (!capture_file) {
+		fprintf(stderr, "Failed to open capture file %s: %s\n",
+			path, strerror(errno));
+		exit(1);
+	}
+
+	fwrite(&header, sizeof(header), 1, capture_file);
+}
+
+static void __attribute__((destructor))
+panwrap_capture_fini()
+{
+	if (!capture_file)
+		return;
+
+	pthread_mutex_lock(&capture_lock);
+	fclose(capture_file);
+	capture_file = NULL;
+	pthread_mutex_unlock(&capture_lock);
+}
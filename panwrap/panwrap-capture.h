@@ -0,0 +1,33 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_CAPTURE_H__
+#define __PANWRAP_CAPTURE_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct panwrap_capture_ioctl;
+
+void panwrap_capture_open(int fd);
+void panwrap_capture_close(int fd);
+struct panwrap_capture_ioctl *
+panwrap_capture_ioctl_pre(int fd, unsigned long int request, const void *ptr);
+void panwrap_capture_ioctl_post(struct panwrap_capture_ioctl *capture,
+				const void *ptr, int ret);
+void panwrap_capture_mmap(int fd, void *addr, size_t length, int prot,
+			  int flags, off_t offset);
+void panwrap_capture_munmap(void *addr, size_t length);
+
+#endif /* __PANWRAP_CAPTURE_H__ */
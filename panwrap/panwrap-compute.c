@@ -0,0 +1,179 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Compute dispatches
+ *
+ * Compute jobs use the same payload as vertex and tiler jobs, with the
+ * workgroup size and count packed into invocation_count (see
+ * mali-job-schema.h). Along with those, we estimate how well each dispatch
+ * fills the GPU, using the thread properties and shader core mask the kernel
+ * reported in GPU_PROPS_REG_DUMP:
+ *
+ *  - Each core runs at most max_threads threads, so it can hold
+ *    max_threads / threads-per-workgroup workgroups at once. Whatever doesn't
+ *    divide evenly is wasted.
+ *  - Workgroups get spread over every core, so fewer workgroups than cores
+ *    leaves cores idle, and too few per core leaves them partly empty.
+ *  - Threads run in quads, so workgroup sizes that aren't a multiple of 4
+ *    leave lanes idle.
+ *
+ * We don't know how many registers a shader uses yet, which can also limit
+ * how many threads fit on a core, so these are upper bounds: we just log the
+ * register budget each thread has at full occupancy.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <mali-job-schema.h>
+#include "panwrap.h"
+
+#define QUAD_SIZE 4
+
+static struct {
+	bool valid;
+	unsigned int cores;
+	u32 max_threads;
+	u32 max_workgroup_size;
+	u16 max_registers;
+	u8 max_task_queue;
+} gpu;
+static pthread_mutex_t gpu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+panwrap_compute_set_gpu_props(const struct mali_ioctl_gpu_props_reg_dump *props)
+{
+	if (!props->thread.max_threads)
+		return;
+
+	pthread_mutex_lock(&gpu_lock);
+	gpu.valid = true;
+	gpu.cores = __builtin_popcountll(props->raw.shader_present);
+	gpu.max_threads = props->thread.max_threads;
+	gpu.max_workgroup_size = props->thread.max_workgroup_size;
+	gpu.max_registers = props->thread.max_registers;
+	gpu.max_task_queue = props->thread.max_task_queue;
+	pthread_mutex_unlock(&gpu_lock);
+}
+
+/* Bits [start, end) of the invocation count, plus one */
+static u64
+invocation_field(u64 invocation_count, unsigned int start, unsigned int end)
+{
+	if (end <= start || start >= 32)
+		return 1;
+
+	end = MIN(end, 32);
+	return ((invocation_count >> start) & ((1ull << (end - start)) - 1)) + 1;
+}
+
+static void
+compute_log_occupancy(u64 threads, u64 workgroups)
+{
+	u64 resident, per_core, waves, last_wave;
+	double occupancy;
+
+	pthread_mutex_lock(&gpu_lock);
+
+	if (!gpu.valid) {
+		pthread_mutex_unlock(&gpu_lock);
+		panwrap_log("No GPU properties seen yet, can't estimate occupancy\n");
+		return;
+	}
+
+	if (threads > gpu.max_workgroup_size) {
+		panwrap_log("Workgroups of %" PRIu64 " threads are larger than the maximum of %u!\n",
+			    threads, gpu.max_workgroup_size);
+		pthread_mutex_unlock(&gpu_lock);
+		return;
+	}
+
+	/* How many workgroups fit on a core at once, and how many each core
+	 * actually gets in the first wave */
+	resident = MAX(gpu.max_threads / threads, 1);
+	per_core = MIN((workgroups + gpu.cores - 1) / MAX(gpu.cores, 1),
+		       resident);
+	occupancy = (double) per_core * threads / gpu.max_threads;
+	waves = (workgroups + resident * gpu.cores - 1) /
+		MAX(resident * gpu.cores, 1);
+	last_wave = workgroups - (waves - 1) * resident * gpu.cores;
+
+	panwrap_log("Occupancy estimate: %.0f%% of %u threads on each of %u cores, %" PRIu64 " workgroups per core at once, %" PRIu64 " wave%s, up to %u registers per thread at full occupancy\n",
+		    occupancy * 100, gpu.max_threads, gpu.cores, resident,
+		    waves, waves == 1 ? "" : "s",
+		    gpu.max_registers / MAX(gpu.max_threads, 1));
+
+	if (workgroups < gpu.cores)
+		panwrap_log("Only %" PRIu64 " workgroups for %u cores, %u cores sit idle\n",
+			    workgroups, gpu.cores,
+			    gpu.cores - (unsigned int) workgroups);
+	else if (occupancy < 0.5)
+		panwrap_log("Cores are less than half full, use more or larger workgroups\n");
+
+	if (resident * threads < gpu.max_threads &&
+	    gpu.max_threads - resident * threads >= threads / 2)
+		panwrap_log("%" PRIu64 " threads per core can't be used, since workgroups of %" PRIu64 " don't divide %u evenly\n",
+			    gpu.max_threads - resident * threads, threads,
+			    gpu.max_threads);
+
+	if (waves > 1 && last_wave * 2 < resident * gpu.cores)
+		panwrap_log("The last wave only has %" PRIu64 " of %" PRIu64 " workgroups\n",
+			    last_wave, resident * gpu.cores);
+
+	pthread_mutex_unlock(&gpu_lock);
+}
+
+/**
+ * Log the workgroup size and count of a compute payload, along with how well
+ * it's likely to fill the GPU.
+ */
+void
+panwrap_compute_log(const struct mali_payload_vertex_tiler *v)
+{
+	struct mali_payload_vertex_tiler_unpacked vu;
+	u64 size[3], count[3], threads, workgroups;
+
+	mali_payload_vertex_tiler_unpack(v, &vu);
+
+	size[0] = invocation_field(vu.invocation_count, 0, vu.size_y_shift);
+	size[1] = invocation_field(vu.invocation_count, vu.size_y_shift,
+				   vu.size_z_shift);
+	size[2] = invocation_field(vu.invocation_count, vu.size_z_shift,
+				   vu.workgroups_x_shift);
+	count[0] = invocation_field(vu.invocation_count, vu.workgroups_x_shift,
+				    vu.workgroups_y_shift);
+	count[1] = invocation_field(vu.invocation_count, vu.workgroups_y_shift,
+				    vu.workgroups_z_shift);
+	count[2] = invocation_field(vu.invocation_count, vu.workgroups_z_shift,
+				    32);
+
+	threads = size[0] * size[1] * size[2];
+	workgroups = count[0] * count[1] * count[2];
+
+	panwrap_log("Workgroup size %" PRIu64 "x%" PRIu64 "x%" PRIu64 " (%" PRIu64 " threads), %" PRIu64 "x%" PRIu64 "x%" PRIu64 " workgroups (%" PRIu64 " threads in total)\n",
+		    size[0], size[1], size[2], threads,
+		    count[0], count[1], count[2], threads * workgroups);
+
+	panwrap_indent++;
+
+	if (threads % QUAD_SIZE)
+		panwrap_log("Workgroup size isn't a multiple of %d, some lanes of every quad go unused\n",
+			    QUAD_SIZE);
+
+	compute_log_occupancy(threads, workgroups);
+
+	panwrap_indent--;
+}
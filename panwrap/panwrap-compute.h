@@ -0,0 +1,24 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_COMPUTE_H__
+#define __PANWRAP_COMPUTE_H__
+
+#include <mali-ioctl.h>
+#include <mali-job.h>
+
+void panwrap_compute_set_gpu_props(const struct mali_ioctl_gpu_props_reg_dump *props);
+void panwrap_compute_log(const struct mali_payload_vertex_tiler *v);
+
+#endif /* __PANWRAP_COMPUTE_H__ */
@@ -0,0 +1,326 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Contexts
+ *
+ * Every fd that /dev/mali0 gets opened at has its own context, which holds
+ * the memory mappings and allocations we're tracking for it along with its
+ * statistics. Contexts are found by fd through a fixed size array, so that
+ * checking whether an fd belongs to us doesn't need to take any locks.
+ *
+ * While a thread holds a context's lock, that context is the thread's current
+ * context, and is what all of the memory tracking in panwrap-mmap.c uses.
+ *
+ * Contexts are reference counted: the fd array holds one reference, and so
+ * does every thread that's found the context and is waiting for or holding
+ * its lock. That way a close() on another thread can't free the context out
+ * from under them. Which context each mapping belongs to is also kept in an
+ * index of its own under contexts_lock, so that munmap() doesn't have to lock
+ * every context to find the right one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include "panwrap.h"
+
+static struct panwrap_context *contexts[PANWRAP_MAX_FDS];
+static LIST_HEAD(context_list);
+static unsigned int nr_contexts, next_id = 1;
+static bool multiple_contexts;
+static pthread_mutex_t contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	void *addr;
+	struct panwrap_context *ctx;
+} *mappings;
+static size_t nr_mappings, mappings_size;
+
+static __thread struct panwrap_context *current;
+
+struct panwrap_context *
+panwrap_context_create(int fd)
+{
+	struct panwrap_context *ctx;
+
+	if (fd < 0 || fd >= PANWRAP_MAX_FDS) {
+		panwrap_log("Can't trace /dev/mali0 at fd %d, too many files open\n",
+			    fd);
+		return NULL;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	ctx->fd = fd;
+	ctx->refs = 1;
+	list_init(&ctx->allocations);
+	list_init(&ctx->mmaps);
+	pthread_mutex_init(&ctx->lock, NULL);
+
+	pthread_mutex_lock(&contexts_lock);
+	ctx->id = next_id++;
+	if (nr_contexts)
+		multiple_contexts = true;
+	nr_contexts++;
+	list_add(&ctx->node, context_list.prev);
+	contexts[fd] = ctx;
+	pthread_mutex_unlock(&contexts_lock);
+
+	return ctx;
+}
+
+static void
+panwrap_context_log_stats(struct panwrap_context *ctx)
+{
+	if (!ctx->stats.submits)
+		return;
+
+	panwrap_log("JOB_SUBMIT overhead on context %u (%s decoding): %" PRIu64 " submits, avg %.3f us, max %.3f us\n",
+		    ctx->id,
+		    ctx->stats.submit_deferred ? "deferred" : "synchronous",
+		    ctx->stats.submits,
+		    ctx->stats.submit_total_ns / 1000.0 / ctx->stats.submits,
+		    ctx->stats.submit_max_ns / 1000.0);
+	panwrap_events_log_stats(ctx);
+	panwrap_timeline_log_stats(ctx);
+	panwrap_atom_graph_log_stats(ctx);
+	panwrap_frame_stats_log_stats(ctx);
+	panwrap_jit_log_stats(ctx);
+	panwrap_tiler_heap_log_stats(ctx);
+}
+
+/* Takes another reference to ctx, which has to be dropped with
+ * panwrap_context_put() */
+struct panwrap_context *
+panwrap_context_get(struct panwrap_context *ctx)
+{
+	atomic_fetch_add(&ctx->refs, 1);
+	return ctx;
+}
+
+void
+panwrap_context_put(struct panwrap_context *ctx)
+{
+	struct panwrap_allocated_memory *alloc, *alloc_tmp;
+	struct panwrap_mapped_memory *mem, *mem_tmp;
+
+	if (atomic_fetch_sub(&ctx->refs, 1) != 1)
+		return;
+
+	list_for_each_entry_safe(alloc, alloc_tmp, &ctx->allocations, node)
+		free(alloc);
+	list_for_each_entry_safe(mem, mem_tmp, &ctx->mmaps, node)
+		free(mem);
+
+	pthread_mutex_destroy(&ctx->lock);
+	free(ctx);
+}
+
+/* Takes a reference to ctx, which has to be locked next */
+static struct panwrap_context *
+panwrap_context_lock_ref(struct panwrap_context *ctx)
+{
+	pthread_mutex_lock(&ctx->lock);
+
+	/* Closed while we were waiting for it */
+	if (ctx->closed) {
+		pthread_mutex_unlock(&ctx->lock);
+		panwrap_context_put(ctx);
+		return NULL;
+	}
+
+	current = ctx;
+	return ctx;
+}
+
+/**
+ * Log a context's statistics, stop tracking it, and unlock it. The context
+ * must have been locked with panwrap_context_lock(), and is freed once no
+ * other thread is using it anymore.
+ */
+void
+panwrap_context_destroy(struct panwrap_context *ctx)
+{
+	bool removed;
+
+	ctx->closed = true;
+	panwrap_context_log_stats(ctx);
+	current = NULL;
+	pthread_mutex_unlock(&ctx->lock);
+
+	pthread_mutex_lock(&contexts_lock);
+	removed = contexts[ctx->fd] == ctx;
+	if (removed) {
+		contexts[ctx->fd] = NULL;
+		list_del(&ctx->node);
+		nr_contexts--;
+	}
+
+	for (size_t i = 0; i < nr_mappings; ) {
+		if (mappings[i].ctx == ctx)
+			mappings[i] = mappings[--nr_mappings];
+		else
+			i++;
+	}
+	pthread_mutex_unlock(&contexts_lock);
+
+	if (removed)
+		panwrap_context_put(ctx);
+	panwrap_context_put(ctx);
+}
+
+/**
+ * Whether fd is a /dev/mali0 we're tracing, without locking anything. Useful
+ * for calls that can block, since they can't hold the context's lock while
+ * they wait.
+ */
+bool
+panwrap_context_tracked(int fd)
+{
+	return fd >= 0 && fd < PANWRAP_MAX_FDS && contexts[fd];
+}
+
+/**
+ * Find and lock the context for fd, making it the current context. Returns
+ * NULL if fd isn't one of ours.
+ */
+struct panwrap_context *
+panwrap_context_lock(int fd)
+{
+	struct panwrap_context *ctx;
+
+	if (fd < 0 || fd >= PANWRAP_MAX_FDS || !contexts[fd])
+		return NULL;
+
+	pthread_mutex_lock(&contexts_lock);
+	ctx = contexts[fd];
+	if (ctx)
+		atomic_fetch_add(&ctx->refs, 1);
+	pthread_mutex_unlock(&contexts_lock);
+
+	return ctx ? panwrap_context_lock_ref(ctx) : NULL;
+}
+
+/**
+ * Find and lock the context that has memory mapped at addr, making it the
+ * current context. Returns NULL if no context has addr mapped.
+ */
+struct panwrap_context *
+panwrap_context_lock_mapping(void *addr)
+{
+	struct panwrap_context *ctx = NULL;
+
+	/* Memory panwrap itself frees while a context is locked can't be GPU
+	 * memory, and trying to lock the context again would deadlock */
+	if (!nr_contexts || current)
+		return NULL;
+
+	pthread_mutex_lock(&contexts_lock);
+	for (size_t i = 0; i < nr_mappings; i++) {
+		if (mappings[i].addr == addr) {
+			ctx = mappings[i].ctx;
+			atomic_fetch_add(&ctx->refs, 1);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&contexts_lock);
+
+	return ctx ? panwrap_context_lock_ref(ctx) : NULL;
+}
+
+void
+panwrap_context_unlock(struct panwrap_context *ctx)
+{
+	current = NULL;
+	pthread_mutex_unlock(&ctx->lock);
+	panwrap_context_put(ctx);
+}
+
+/**
+ * Record that ctx has memory mapped at addr, for
+ * panwrap_context_lock_mapping()
+ */
+void
+panwrap_context_add_mapping(struct panwrap_context *ctx, void *addr)
+{
+	pthread_mutex_lock(&contexts_lock);
+	if (nr_mappings == mappings_size) {
+		mappings_size = MAX(mappings_size * 2, 64);
+		mappings = realloc(mappings, sizeof(*mappings) * mappings_size);
+	}
+	mappings[nr_mappings].addr = addr;
+	mappings[nr_mappings].ctx = ctx;
+	nr_mappings++;
+	pthread_mutex_unlock(&contexts_lock);
+}
+
+void
+panwrap_context_remove_mapping(struct panwrap_context *ctx, void *addr)
+{
+	pthread_mutex_lock(&contexts_lock);
+	for (size_t i = 0; i < nr_mappings; i++) {
+		if (mappings[i].addr == addr && mappings[i].ctx == ctx) {
+			mappings[i] = mappings[--nr_mappings];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&contexts_lock);
+}
+
+struct panwrap_context *
+panwrap_context_current()
+{
+	return current;
+}
+
+/**
+ * Make ctx the current context of a thread that's working on behalf of the
+ * thread holding ctx's lock, or stop doing so if ctx is NULL. The lock has to
+ * stay held until the thread is done, unless it's the deferred decoding
+ * thread, which only holds a reference and only touches decoding state.
+ */
+void
+panwrap_context_set_current(struct panwrap_context *ctx)
+{
+	current = ctx;
+}
+
+/**
+ * What to label the current context's log lines with, or 0 if they don't
+ * need a label because there's never been more than one context.
+ */
+unsigned int
+panwrap_context_label()
+{
+	return multiple_contexts && current ? current->id : 0;
+}
+
+static void __attribute__((destructor))
+panwrap_context_fini()
+{
+	struct panwrap_context *ctx;
+
+	pthread_mutex_lock(&contexts_lock);
+	list_for_each_entry(ctx, &context_list, node) {
+		pthread_mutex_lock(&ctx->lock);
+		if (!ctx->closed)
+			panwrap_context_log_stats(ctx);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	pthread_mutex_unlock(&contexts_lock);
+
+	panwrap_log_flush();
+}
@@ -0,0 +1,83 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_CONTEXT_H__
+#define __PANWRAP_CONTEXT_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <list.h>
+#include <panloader-util.h>
+#include "panwrap-events.h"
+#include "panwrap-timeline.h"
+#include "panwrap-atom-graph.h"
+#include "panwrap-frame-stats.h"
+#include "panwrap-jit.h"
+#include "panwrap-tiler-heap.h"
+#include "panwrap-fragment.h"
+
+#define PANWRAP_MAX_FDS 4096
+
+/*
+ * Everything we know about one open() of /dev/mali0. Each context is traced
+ * under its own lock, so different contexts can be used from different
+ * threads without waiting on each other.
+ */
+struct panwrap_context {
+	int fd;
+	unsigned int id;
+	pthread_mutex_t lock;
+	atomic_int refs;
+	bool closed;
+
+	struct list allocations;
+	struct list mmaps;
+
+	struct {
+		u64 ioctls;
+		u64 submits;
+		u64 submit_total_ns;
+		u64 submit_max_ns;
+		bool submit_deferred;
+	} stats;
+
+	struct panwrap_events events;
+	struct panwrap_timeline timeline;
+	struct panwrap_atom_graph atom_graph;
+	struct panwrap_frame_stats frame_stats;
+	struct panwrap_jit jit;
+	struct panwrap_tiler_heap tiler_heap;
+	struct panwrap_fragment last_pass;
+
+	struct list node;
+};
+
+struct panwrap_context *panwrap_context_create(int fd);
+void panwrap_context_destroy(struct panwrap_context *ctx);
+
+bool panwrap_context_tracked(int fd);
+struct panwrap_context *panwrap_context_lock(int fd);
+struct panwrap_context *panwrap_context_lock_mapping(void *addr);
+void panwrap_context_unlock(struct panwrap_context *ctx);
+struct panwrap_context *panwrap_context_get(struct panwrap_context *ctx);
+void panwrap_context_put(struct panwrap_context *ctx);
+void panwrap_context_add_mapping(struct panwrap_context *ctx, void *addr);
+void panwrap_context_remove_mapping(struct panwrap_context *ctx, void *addr);
+
+struct panwrap_context *panwrap_context_current();
+void panwrap_context_set_current(struct panwrap_context *ctx);
+unsigned int panwrap_context_label();
+
+#endif /* __PANWRAP_CONTEXT_H__ */
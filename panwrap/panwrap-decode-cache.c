@@ -0,0 +1,129 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Decode cache
+ *
+ * Frame after frame, drivers tend to submit the same draws with the same
+ * state, and decoding all of it again just buries whatever actually changed.
+ * So the decoder hashes everything it's about to decode for a payload, and
+ * looks the hash up here first. If we've seen it recently, the decoder just
+ * refers back to the payload it decoded before in the log. It still decodes
+ * it without logging anything, so it counts towards the statistics all the
+ * same.
+ *
+ * We remember the last PANWRAP_DECODE_CACHE (256 by default) payloads, and
+ * forget whichever was used longest ago once that's full. Setting it to 0
+ * turns the cache off, and every payload gets decoded in full again. The
+ * cache is bypassed while decoding in parallel (see panwrap-workers.c), since
+ * which payload got there first would depend on the workers' timing.
+ */
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "panwrap.h"
+
+struct decode_cache_entry {
+	u64 hash;
+	unsigned int id;
+	u64 last_used;
+};
+
+static struct decode_cache_entry *entries;
+static long size;
+static long count;
+
+static u64 lookups;
+static unsigned int next_id;
+static u64 hits;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Whether payloads should be looked up at all, so the decoder can skip hashing
+ * them when they won't be.
+ */
+bool
+panwrap_decode_cache_enabled()
+{
+	return size && !panwrap_workers_batch();
+}
+
+/**
+ * Look up a payload by the hash of its contents. Returns true and sets id to
+ * the ID of the earlier payload if we've decoded the same thing recently,
+ * otherwise remembers this payload and sets id to a new ID for it. The ID is
+ * 0 when the cache is disabled or bypassed.
+ */
+bool
+panwrap_decode_cache_lookup(u64 hash, unsigned int *id)
+{
+	struct decode_cache_entry *e = NULL;
+	bool hit = false;
+
+	*id = 0;
+	if (!panwrap_decode_cache_enabled())
+		return false;
+
+	pthread_mutex_lock(&cache_lock);
+	lookups++;
+
+	for (long i = 0; i < count; i++) {
+		if (entries[i].hash == hash) {
+			e = &entries[i];
+			hit = true;
+			break;
+		}
+
+		if (!e || entries[i].last_used < e->last_used)
+			e = &entries[i];
+	}
+
+	if (hit) {
+		hits++;
+	} else {
+		if (count < size)
+			e = &entries[count++];
+
+		e->hash = hash;
+		e->id = ++next_id;
+	}
+
+	e->last_used = lookups;
+	*id = e->id;
+
+	pthread_mutex_unlock(&cache_lock);
+	return hit;
+}
+
+static void __attribute__((constructor))
+panwrap_decode_cache_init()
+{
+	size = MAX(panwrap_parse_env_long("PANWRAP_DECODE_CACHE", 256), 0);
+	if (size)
+		entries = calloc(size, sizeof(*entries));
+}
+
+static void __attribute__((destructor))
+panwrap_decode_cache_fini()
+{
+	if (!lookups)
+		return;
+
+	panwrap_log("Decode cache: %" PRIu64 " of %" PRIu64 " payloads were the same as one decoded before\n",
+		    hits, lookups);
+	panwrap_log_flush();
+}
@@ -13,11 +13,19 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include "panwrap.h"
 #include <mali-ioctl.h>
 #include <mali-job.h>
+#include <mali-job-schema.h>
+#include <pandecode.h>
 
-static char *panwrap_job_type_name(enum mali_job_type type)
+/* The name of a job type, or NULL if we don't know it */
+const char *panwrap_job_type_lookup(enum mali_job_type type)
 {
 #define DEFINE_CASE(name) case JOB_TYPE_ ## name: return #name
 	switch (type) {
@@ -32,13 +40,24 @@ static char *panwrap_job_type_name(enum mali_job_type type)
 	case JOB_NOT_STARTED:
 		return "NOT_STARTED";
 	default:
+		return NULL;
+	}
+#undef DEFINE_CASE
+}
+
+const char *panwrap_job_type_name(enum mali_job_type type)
+{
+	const char *name = panwrap_job_type_lookup(type);
+
+	if (!name) {
 		panwrap_log("Warning! Unknown job type %x\n", type);
 		return "!?!?!?";
 	}
-#undef DEFINE_CASE
+
+	return name;
 }
 
-static char *panwrap_gl_mode_name(enum mali_gl_mode mode)
+const char *panwrap_gl_mode_name(enum mali_gl_mode mode)
 {
 #define DEFINE_CASE(name) case MALI_ ## name: return #name
 	switch(mode) {
@@ -52,55 +71,386 @@ static char *panwrap_gl_mode_name(enum mali_gl_mode mode)
 #undef DEFINE_CASE
 }
 
-void panwrap_decode_attributes(const struct panwrap_mapped_memory *mem,
-			       mali_ptr addr)
+/*
+ * Attribute buffers can hold thousands of vertices, so by default we only log
+ * a summary of each: the bounding box of every component, how many NaNs and
+ * denormals there are, and a hash of the contents. If the same contents show
+ * up in a different buffer, the driver uploaded them twice. Every vertex only
+ * gets dumped with PANWRAP_DUMP_ATTRIBUTES=1.
+ */
+#define ATTRIBUTE_HISTORY 64
+
+static bool dump_attributes;
+
+static struct {
+	u64 hash;
+	mali_ptr gpu_va;
+} attribute_history[ATTRIBUTE_HISTORY];
+static unsigned int attribute_history_next;
+static pthread_mutex_t attribute_history_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Returns the address of another buffer with the same contents, or 0 */
+static mali_ptr panwrap_attribute_history_add(u64 hash, mali_ptr gpu_va)
+{
+	mali_ptr other = 0;
+
+	/* Which buffer comes first depends on the order atoms get decoded in */
+	if (panwrap_workers_batch())
+		return 0;
+
+	pthread_mutex_lock(&attribute_history_lock);
+	for (int i = 0; i < ATTRIBUTE_HISTORY; i++) {
+		if (attribute_history[i].hash == hash &&
+		    attribute_history[i].gpu_va != gpu_va) {
+			other = attribute_history[i].gpu_va;
+			break;
+		}
+	}
+
+	if (!other) {
+		attribute_history[attribute_history_next].hash = hash;
+		attribute_history[attribute_history_next].gpu_va = gpu_va;
+		attribute_history_next =
+			(attribute_history_next + 1) % ATTRIBUTE_HISTORY;
+	}
+	pthread_mutex_unlock(&attribute_history_lock);
+
+	return other;
+}
+
+static void panwrap_log_components(const char *name, const float *values,
+				   size_t count)
+{
+	panwrap_log("%s <", name);
+	for (int i = 0; i < count; i++)
+		panwrap_log_cont("%f%s", values[i], i < count - 1 ? ", " : "");
+	panwrap_log_cont(">\n");
+}
+
+/*
+ * Kept to plain loops over the raw bits, with no branches in the inner loop,
+ * so that the compiler can vectorize them.
+ */
+static void panwrap_summarize_attributes(const float *buffer,
+					 size_t vertex_count,
+					 size_t component_count)
+{
+	const u32 *bits = (const u32 *) buffer;
+	float *min = calloc(component_count * 2, sizeof(float));
+	float *max = min + component_count;
+	size_t nans = 0, denormals = 0;
+
+	for (int i = 0; i < component_count; i++) {
+		min[i] = INFINITY;
+		max[i] = -INFINITY;
+	}
+
+	for (size_t row = 0; row < vertex_count; row++) {
+		const float *vertex = &buffer[row * component_count];
+		const u32 *vertex_bits = &bits[row * component_count];
+
+		for (int i = 0; i < component_count; i++) {
+			u32 exponent = vertex_bits[i] & 0x7F800000;
+			u32 mantissa = vertex_bits[i] & 0x007FFFFF;
+			bool nan = exponent == 0x7F800000 && mantissa;
+
+			nans += nan;
+			denormals += !exponent && mantissa;
+
+			/* Comparisons with NaN are false, so they're skipped */
+			min[i] = vertex[i] < min[i] ? vertex[i] : min[i];
+			max[i] = vertex[i] > max[i] ? vertex[i] : max[i];
+		}
+	}
+
+	if (vertex_count) {
+		panwrap_log_components("min", min, component_count);
+		panwrap_log_components("max", max, component_count);
+	}
+
+	if (nans || denormals)
+		panwrap_log("%zu NaNs, %zu denormals\n", nans, denormals);
+
+	free(min);
+}
+
+static void panwrap_decode_attributes(const struct mali_vertex_tiler_attr *attr,
+				      const float *buffer)
 {
-	struct mali_vertex_tiler_attr *attr =
-		panwrap_deref_gpu_mem(mem, addr, sizeof(*attr));
-	float *buffer = panwrap_deref_gpu_mem(
-	    NULL, attr->elements_upper << 2, attr->size);
+	mali_ptr elements = attr->elements_upper << 2;
 	size_t vertex_count;
 	size_t component_count;
+	mali_ptr other;
+	u64 hash;
+
+	panwrap_log(MALI_PTR_FORMAT " (%x): %zu bytes, stride %zu\n",
+		    elements, attr->flags, attr->size, attr->stride);
+
+	panwrap_indent++;
+
+	if (!buffer) {
+		panwrap_log("Attribute buffer isn't in mapped GPU memory\n");
+		goto out;
+	}
+
+	if (!attr->stride || attr->stride % sizeof(float)) {
+		panwrap_log("Stride isn't a multiple of %zu, can't decode vertices\n",
+			    sizeof(float));
+		goto out;
+	}
+
+	if (attr->size % attr->stride)
+		panwrap_log("Size isn't a multiple of the stride, ignoring the last %zu bytes\n",
+			    attr->size % attr->stride);
 
 	vertex_count = attr->size / attr->stride;
 	component_count = attr->stride / sizeof(float);
 
-	panwrap_log(MALI_PTR_FORMAT " (%x):\n",
-		    attr->elements_upper << 2, attr->flags);
+	hash = panwrap_hash(buffer, attr->size, PANWRAP_HASH_INIT);
+	other = panwrap_attribute_history_add(hash, elements);
+
+	panwrap_log("%zu vertices of %zu components, contents %016" PRIx64 "\n",
+		    vertex_count, component_count, hash);
+	if (other)
+		panwrap_log("Same contents as the attribute buffer @ " MALI_PTR_FORMAT ", uploaded twice?\n",
+			    other);
+
+	if (!dump_attributes) {
+		panwrap_summarize_attributes(buffer, vertex_count,
+					     component_count);
+		goto out;
+	}
+
+	for (size_t row = 0; row < vertex_count; row++) {
+		const float *vertex = &buffer[row * component_count];
 
-	panwrap_indent++;
-	for (int row = 0; row < vertex_count; row++) {
 		panwrap_log("<");
 		for (int i = 0; i < component_count; i++)
 			panwrap_log_cont("%f%s",
-					 buffer[i],
+					 vertex[i],
 					 i < component_count - 1 ? ", " : "");
 		panwrap_log_cont(">\n");
 	}
+
+out:
 	panwrap_indent--;
 }
 
-void panwrap_decode_vertex_or_tiler_job(const struct mali_job_descriptor_header *h,
-					const struct panwrap_mapped_memory *mem,
-					mali_ptr payload)
+/*
+ * Hashes everything decoding a vertex or tiler payload looks at: the payload
+ * itself, its shader_meta and shader, its attribute list along with the
+ * attributes it points to and their contents, and its index buffer. Returns 0
+ * if any of them aren't in mapped memory, in which case the payload shouldn't
+ * be memoized.
+ *
+ * Hashing the buffers' contents means going over every byte of them for each
+ * draw, as much work again as summarizing them. Hashing just their addresses
+ * would be cheaper, but drivers rewrite buffers in place all the time, and
+ * we'd end up referring back to a draw that used different data. This only
+ * happens while the decode cache is enabled.
+ */
+#define MAX_HASHED_ATTRIBUTES 256
+
+static u64 panwrap_vertex_tiler_hash(const struct mali_job_descriptor_header *h,
+				     const struct mali_payload_vertex_tiler *v)
+{
+	mali_ptr meta_ptr = v->shader_upper << 4;
+	struct mali_payload_vertex_tiler_unpacked vu;
+	u8 type = h->job_type;
+	u64 hash = PANWRAP_HASH_INIT;
+	const void *data;
+	size_t size;
+
+	hash = panwrap_hash(&type, sizeof(type), hash);
+	hash = panwrap_hash(v, sizeof(*v), hash);
+
+	if (meta_ptr) {
+		const struct mali_shader_meta *meta =
+			panwrap_try_deref_gpu_mem(meta_ptr, sizeof(*meta));
+		u64 shader;
+
+		if (!meta)
+			return 0;
+
+		shader = panwrap_shader_hash(meta->shader);
+		if (!shader)
+			return 0;
+
+		hash = panwrap_hash(meta, sizeof(*meta), hash);
+		hash = panwrap_hash(&shader, sizeof(shader), hash);
+	}
+
+	for (int i = 0; v->attribute_meta; i++) {
+		const struct mali_vertex_tiler_attr_meta *attr_meta =
+			panwrap_try_deref_gpu_mem(v->attribute_meta + i * sizeof(u64),
+						  sizeof(u64));
+		const struct mali_vertex_tiler_attr *attr;
+
+		if (!attr_meta || i == MAX_HASHED_ATTRIBUTES)
+			return 0;
+
+		hash = panwrap_hash(attr_meta, sizeof(u64), hash);
+		if (!*(const u64 *) attr_meta)
+			break;
+
+		attr = panwrap_try_deref_gpu_mem(v->attributes + attr_meta->index,
+						 sizeof(*attr));
+		if (!attr)
+			return 0;
+
+		hash = panwrap_hash(attr, sizeof(*attr), hash);
+
+		data = panwrap_try_deref_gpu_mem(attr->elements_upper << 2,
+						 attr->size);
+		if (!data)
+			return 0;
+
+		hash = panwrap_hash(data, attr->size, hash);
+	}
+
+	if (h->job_type == JOB_TYPE_TILER) {
+		mali_payload_vertex_tiler_unpack(v, &vu);
+		size = panwrap_indices_size(&vu);
+
+		if (size) {
+			data = panwrap_try_deref_gpu_mem(vu.indices, size);
+			if (!data)
+				return 0;
+
+			hash = panwrap_hash(data, size, hash);
+		}
+	}
+
+	return hash;
+}
+
+/* What we keep track of while decoding a chain, for the totals at the end */
+struct panwrap_chain_state {
+	struct panwrap_job_node *nodes;
+	size_t nodes_size;
+	unsigned int type_counts[1 << 7];
+	size_t payload_bytes;
+	int unknown_payloads;
+	bool in_attribute_list;
+	bool muted;
+	const struct mali_payload_fragment *fragment;
+};
+
+static long max_chain_jobs;
+
+static const void *panwrap_resolve(void *data, mali_ptr gpu_va, size_t size)
+{
+	return panwrap_try_deref_gpu_mem(gpu_va, size);
+}
+
+static bool panwrap_visit_job(void *data, int index, mali_ptr gpu_va,
+			      const struct mali_job_descriptor_header *h)
+{
+	struct panwrap_chain_state *state = data;
+
+	if (index == state->nodes_size) {
+		state->nodes_size = MAX(state->nodes_size * 2, 16);
+		state->nodes = realloc(state->nodes,
+				       sizeof(*state->nodes) * state->nodes_size);
+	}
+	state->nodes[index] = (struct panwrap_job_node) {
+		.gpu_va = gpu_va,
+		.type = h->job_type,
+		.index = h->job_index,
+		.deps = { h->job_dependency_index_1,
+			  h->job_dependency_index_2 },
+		.barrier = h->job_barrier,
+	};
+
+	panwrap_log("Job %d @ " MALI_PTR_FORMAT ":\n", index, gpu_va);
+	panwrap_indent++;
+
+	panwrap_log("%s job, %d-bit, status %X, incomplete %X\n",
+		    panwrap_job_type_name(h->job_type),
+		    h->job_descriptor_size ? 64 : 32,
+		    h->exception_status,
+		    h->first_incomplete_task);
+	panwrap_log("fault %" PRIX64 ", barrier %d, index %hX\n",
+		    h->fault_pointer,
+		    h->job_barrier,
+		    h->job_index);
+	panwrap_log("dependencies (%hX, %hX)\n",
+		    h->job_dependency_index_1,
+		    h->job_dependency_index_2);
+
+	panwrap_indent++;
+
+	return true;
+}
+
+static void panwrap_visit_job_end(void *data, int index, size_t payload_size)
 {
-	struct mali_payload_vertex_tiler *v =
-		PANWRAP_PTR(mem, payload, typeof(*v));
-	struct mali_shader_meta *meta;
-	struct panwrap_mapped_memory *attr_mem;
-	struct mali_vertex_tiler_attr_meta *attr_meta;
+	struct panwrap_chain_state *state = data;
+
+	panwrap_indent -= 2;
+
+	state->type_counts[state->nodes[index].type]++;
+	state->payload_bytes += payload_size;
+	if (!payload_size)
+		state->unknown_payloads++;
+}
+
+static void panwrap_visit_set_value(void *data, mali_ptr gpu_va,
+				    const struct mali_payload_set_value *s)
+{
+	panwrap_log("set value -> %" PRIX64 " (%" PRIX64 ")\n",
+		    s->out, s->unknown);
+}
+
+/* Logs each non-zero field of a descriptor, as described by its schema */
+static void panwrap_log_fields(const struct mali_field *fields, size_t count,
+			       const void *packed)
+{
+	for (int i = 0; i < count; i++) {
+		u64 value = mali_get_bits(packed, fields[i].offset,
+					  fields[i].bits);
+
+		if (value)
+			panwrap_log("%s = 0x%" PRIx64 "\n", fields[i].name,
+				    value);
+	}
+}
+
+static bool panwrap_visit_vertex_tiler(void *data, mali_ptr gpu_va,
+				       const struct mali_job_descriptor_header *h,
+				       const struct mali_payload_vertex_tiler *v)
+{
+	struct panwrap_chain_state *state = data;
 	mali_ptr meta_ptr = v->shader_upper << 4;
-	mali_ptr p;
+	u64 hash = 0;
+	unsigned int id;
+
+	if (panwrap_decode_cache_enabled())
+		hash = panwrap_vertex_tiler_hash(h, v);
+
+	if (hash) {
+		if (panwrap_decode_cache_lookup(hash, &id)) {
+			panwrap_log("Same as payload #%u\n", id);
+
+			/*
+			 * Still decode it quietly, so that it counts towards
+			 * the statistics like any other payload
+			 */
+			panwrap_log_mute(true);
+			state->muted = true;
+		} else if (id) {
+			panwrap_log("Payload #%u:\n", id);
+		}
+	}
 
 	/* From chai, no idea what this is for */
 	if ((meta_ptr & 0xFFF00000) == 0x5AB00000) {
 		panwrap_log("Job sabotaged\n");
 	}
 
-	attr_mem = panwrap_find_mapped_gpu_mem_containing(v->attribute_meta);
-
 	panwrap_log("%s shader @ " MALI_PTR_FORMAT " (flags 0x%x)\n",
-		    h->job_type == JOB_TYPE_VERTEX ? "Vertex" : "Fragment",
+		    h->job_type == JOB_TYPE_VERTEX ? "Vertex" :
+		    h->job_type == JOB_TYPE_COMPUTE ? "Compute" : "Fragment",
 		    meta_ptr, v->flags);
 
 	panwrap_log("Block #1:\n");
@@ -108,110 +458,420 @@ void panwrap_decode_vertex_or_tiler_job(const struct mali_job_descriptor_header
 	panwrap_log_hexdump(v->block1, sizeof(v->block1));
 	panwrap_indent--;
 
-	if (meta_ptr) {
-		meta = panwrap_deref_gpu_mem(NULL, meta_ptr, sizeof(*meta));
+	panwrap_log("Fields:\n");
+	panwrap_indent++;
+	panwrap_log_fields(mali_payload_vertex_tiler_fields,
+			   ARRAY_SIZE(mali_payload_vertex_tiler_fields), v);
+	panwrap_indent--;
 
-		panwrap_log("Shader blob:\n");
-		panwrap_indent++;
-		panwrap_log_hexdump(
-		    panwrap_deref_gpu_mem(NULL, meta->shader, 832), 832);
-		panwrap_indent--;
-	} else
+	if (h->job_type == JOB_TYPE_TILER) {
+		struct mali_payload_vertex_tiler_unpacked vu;
+
+		mali_payload_vertex_tiler_unpack(v, &vu);
+		panwrap_log("Drawing %" PRIu64 " vertices in %s\n",
+			    vu.index_count + 1,
+			    panwrap_gl_mode_name(vu.draw_mode));
+		panwrap_indices_log(&vu);
+	} else if (h->job_type == JOB_TYPE_COMPUTE) {
+		panwrap_compute_log(v);
+	}
+
+	return true;
+}
+
+static void panwrap_visit_shader(void *data, mali_ptr meta_ptr,
+				 const struct mali_shader_meta *meta)
+{
+	if (meta)
+		panwrap_shader_log(meta->shader);
+	else
 		panwrap_log("<no shader>\n");
+}
+
+static void panwrap_visit_attribute(void *data, int index,
+				    const struct mali_vertex_tiler_attr_meta *meta,
+				    mali_ptr gpu_va,
+				    const struct mali_vertex_tiler_attr *attr,
+				    const void *elements)
+{
+	struct panwrap_chain_state *state = data;
+	struct mali_vertex_tiler_attr_meta_unpacked m;
 
-	if (v->attribute_meta) {
+	mali_vertex_tiler_attr_meta_unpack(meta, &m);
+
+	if (!state->in_attribute_list) {
 		panwrap_log("Attribute list:\n");
 		panwrap_indent++;
-		for (p = v->attribute_meta;
-		     *PANWRAP_PTR(attr_mem, p, u64) != 0;
-		     p += sizeof(u64)) {
-			attr_meta = panwrap_deref_gpu_mem(attr_mem, p,
-							  sizeof(*attr_mem));
+		state->in_attribute_list = true;
+	}
 
-			panwrap_log("%x:\n", attr_meta->index);
-			panwrap_indent++;
+	panwrap_log("%" PRIx64 ":\n", m.index);
+	panwrap_indent++;
 
-			panwrap_log("flags = 0x%014" PRIx64 "\n",
-				    attr_meta->flags);
-			panwrap_decode_attributes(
-			    NULL, v->attributes + attr_meta->index);
+	panwrap_log("flags = 0x%014" PRIx64 "\n", m.flags);
+	panwrap_decode_attributes(attr, elements);
 
-			panwrap_indent--;
-		}
+	panwrap_indent--;
+}
+
+static void panwrap_visit_vertex_tiler_end(void *data,
+					   const struct mali_payload_vertex_tiler *v)
+{
+	struct panwrap_chain_state *state = data;
+
+	if (state->in_attribute_list) {
 		panwrap_indent--;
-	} else
+		state->in_attribute_list = false;
+	} else if (!v->attribute_meta) {
 		panwrap_log("<no attributes>\n");
+	}
 
 	panwrap_log("Block #2:\n");
 	panwrap_indent++;
 	panwrap_log_hexdump(v->block2, sizeof(v->block2));
 	panwrap_indent--;
 
-	/*panwrap_assert_gpu_mem_zero(mem, */
+	if (state->muted) {
+		panwrap_log_mute(false);
+		state->muted = false;
+	}
+}
+
+static void panwrap_visit_fragment(void *data, mali_ptr gpu_va,
+				   const struct mali_payload_fragment *f)
+{
+	struct panwrap_chain_state *state = data;
+	struct mali_payload_fragment_unpacked fu;
+
+	mali_payload_fragment_unpack(f, &fu);
+
+	panwrap_log("Tiles (%" PRIu64 ", %" PRIu64 ") to (%" PRIu64 ", %" PRIu64 "), %s @ 0x%" PRIx64 "\n",
+		    fu.min_tile_x, fu.min_tile_y, fu.max_tile_x, fu.max_tile_y,
+		    fu.framebuffer & MALI_MFBD ? "MFBD" : "SFBD",
+		    fu.framebuffer & MALI_FBD_POINTER_MASK);
 
-	/*if (h->job_type == JOB_TYPE_TILER) {*/
-		/*panwrap_log(*/
-		    /*"Drawing in %s\n",*/
-		    /*panwrap_gl_mode_name(*PANWRAP_PTR(NULL, v->block1[8], u8)));*/
-	/*}*/
+	if (!(fu.framebuffer & MALI_MFBD))
+		panwrap_log("Single framebuffer descriptors aren't supported yet\n");
+
+	state->fragment = f;
 }
 
-void panwrap_trace_hw_chain(mali_ptr jc_gpu_va)
+static void panwrap_visit_framebuffer(void *data, mali_ptr gpu_va,
+				      const struct mali_framebuffer *fb,
+				      const struct mali_framebuffer_extra *extra,
+				      const struct mali_render_target *rts)
 {
-	struct panwrap_mapped_memory *mem =
-		panwrap_find_mapped_gpu_mem_containing(jc_gpu_va);
-	struct mali_job_descriptor_header *h =
-		panwrap_deref_gpu_mem(mem, jc_gpu_va, sizeof(*h));
-	mali_ptr payload = jc_gpu_va + sizeof(*h);
+	struct panwrap_chain_state *state = data;
+	struct mali_framebuffer_unpacked fu;
 
-	panwrap_log("%s job, %d-bit, status %X, incomplete %X\n",
-		    panwrap_job_type_name(h->job_type),
-		    h->job_descriptor_size ? 64 : 32,
-		    h->exception_status,
-		    h->first_incomplete_task);
-	panwrap_log("fault %" PRIX64 ", barrier %d, index %hX\n",
-		    h->fault_pointer,
-		    h->job_barrier,
-		    h->job_index);
-	panwrap_log("dependencies (%hX, %hX)\n",
-		    h->job_dependency_index_1,
-		    h->job_dependency_index_2);
+	/* Every draw points to the framebuffer, so only fragment jobs get to
+	 * decode it in full */
+	if (!state->fragment) {
+		mali_framebuffer_unpack(fb, &fu);
+		panwrap_log("Framebuffer @ " MALI_PTR_FORMAT ": %" PRIu64 "x%" PRIu64 "\n",
+			    gpu_va, fu.width1 + 1, fu.height1 + 1);
+		return;
+	}
+
+	panwrap_framebuffer_log(gpu_va, fb, extra, rts);
+	panwrap_fragment_log_bandwidth(state->fragment, fb, extra, rts);
+}
+
+static void panwrap_visit_fragment_end(void *data,
+				       const struct mali_payload_fragment *f)
+{
+	struct panwrap_chain_state *state = data;
+
+	state->fragment = NULL;
+}
+
+static void panwrap_visit_unknown_payload(void *data, mali_ptr gpu_va,
+					  const struct mali_job_descriptor_header *h,
+					  const void *bytes)
+{
+	if (!bytes) {
+		panwrap_log("Payload @ " MALI_PTR_FORMAT " isn't in mapped GPU memory\n",
+			    gpu_va);
+		return;
+	}
+
+	panwrap_log("Dumping payload " MALI_PTR_FORMAT ":\n", gpu_va);
 
 	panwrap_indent++;
+	panwrap_log_hexdump(bytes, PANDECODE_UNKNOWN_PAYLOAD_SIZE);
+	panwrap_indent--;
+}
 
-	switch (h->job_type) {
-	case JOB_TYPE_SET_VALUE:
-		{
-			struct mali_payload_set_value *s =
-				panwrap_deref_gpu_mem(mem, payload, sizeof(*s));
+static void panwrap_visit_error(void *data, enum pandecode_error error,
+				const char *what, mali_ptr gpu_va)
+{
+	struct panwrap_chain_state *state = data;
+	int i;
 
-			panwrap_log("set value -> %" PRIX64 " (%" PRIX64 ")\n",
-				    s->out, s->unknown);
-			break;
-		}
-	case JOB_TYPE_TILER:
-	case JOB_TYPE_VERTEX:
-		panwrap_decode_vertex_or_tiler_job(h, mem, payload);
+	switch (error) {
+	case PANDECODE_ERROR_CHAIN_LOOP:
+		for (i = 0; state->nodes[i].gpu_va != gpu_va; i++);
+		panwrap_log("Job chain loops back to job %d @ " MALI_PTR_FORMAT "\n",
+			    i, gpu_va);
 		break;
-	default:
-		panwrap_log("Dumping payload " MALI_PTR_FORMAT ":\n",
-			    payload);
+	case PANDECODE_ERROR_CHAIN_TOO_LONG:
+		panwrap_log("Job chain is longer than %ld jobs, not following it any further\n",
+			    max_chain_jobs);
+		break;
+	case PANDECODE_ERROR_UNMAPPED:
+		if (strcmp(what, "job") == 0)
+			panwrap_log("Job @ " MALI_PTR_FORMAT " isn't in mapped GPU memory, not following the chain any further\n",
+				    gpu_va);
+		else
+			panwrap_log("Can't decode %s @ " MALI_PTR_FORMAT ", it isn't in mapped GPU memory\n",
+				    what, gpu_va);
+		break;
+	}
+}
 
-		panwrap_indent++;
-		panwrap_log_hexdump(panwrap_deref_gpu_mem(mem, payload, 256),
-				    256);
-		panwrap_indent--;
+static const struct pandecode_visitor panwrap_visitor = {
+	.job = panwrap_visit_job,
+	.job_end = panwrap_visit_job_end,
+	.set_value = panwrap_visit_set_value,
+	.vertex_tiler = panwrap_visit_vertex_tiler,
+	.vertex_tiler_end = panwrap_visit_vertex_tiler_end,
+	.shader = panwrap_visit_shader,
+	.attribute = panwrap_visit_attribute,
+	.framebuffer = panwrap_visit_framebuffer,
+	.fragment = panwrap_visit_fragment,
+	.fragment_end = panwrap_visit_fragment_end,
+	.unknown_payload = panwrap_visit_unknown_payload,
+	.error = panwrap_visit_error,
+};
+
+/*
+ * Decodes every job in a chain with libpandecode, logging each descriptor as
+ * it gets visited. The chain walker stops at jobs that aren't in mapped
+ * memory, at jobs it's already seen, and after max_chain_jobs
+ * (PANWRAP_MAX_CHAIN_JOBS) jobs.
+ */
+void panwrap_trace_hw_chain(mali_ptr jc_gpu_va)
+{
+	struct panwrap_chain_state state = {};
+	struct pandecode_context ctx = {
+		.resolve = panwrap_resolve,
+		.visitor = &panwrap_visitor,
+		.data = &state,
+		.max_jobs = max_chain_jobs,
+	};
+	int jobs;
+
+	if (!jc_gpu_va) {
+		panwrap_log("<no job chain>\n");
+		return;
+	}
+
+	jobs = pandecode_chain(&ctx, jc_gpu_va);
+
+	/* Whatever stopped the walk at the first job has been logged already */
+	if (!jobs) {
+		free(state.nodes);
+		return;
 	}
 
+	panwrap_log("Chain totals: %d job%s (", jobs, jobs == 1 ? "" : "s");
+	for (int i = 0, first = 1; i < ARRAY_SIZE(state.type_counts); i++) {
+		if (!state.type_counts[i])
+			continue;
+
+		panwrap_log_cont("%s%u %s", first ? "" : ", ",
+				 state.type_counts[i], panwrap_job_type_name(i));
+		first = 0;
+	}
+	panwrap_log_cont("), %zu payload bytes", state.payload_bytes);
+	if (state.unknown_payloads)
+		panwrap_log_cont(", not counting %d payload%s of unknown size",
+				 state.unknown_payloads,
+				 state.unknown_payloads == 1 ? "" : "s");
+	panwrap_log_cont("\n");
+
+	panwrap_job_graph_analyze(jc_gpu_va, state.nodes, jobs);
+	free(state.nodes);
+}
+
+/*
+ * To decode a chain later on, we need a snapshot of everything
+ * panwrap_trace_hw_chain() is going to read. So we walk the chain the same
+ * way, and copy each mapping the walk resolves memory in, along with the ones
+ * holding the shader binaries and index buffers that get read on the side.
+ */
+static const void *panwrap_snapshot_resolve(void *data, mali_ptr gpu_va,
+					    size_t size)
+{
+	const void *ptr = panwrap_try_deref_gpu_mem(gpu_va, size);
+
+	if (ptr)
+		panwrap_snapshot_add_gpu_mem(data, gpu_va);
+
+	return ptr;
+}
+
+static bool panwrap_snapshot_visit_vertex_tiler(void *data, mali_ptr gpu_va,
+						const struct mali_job_descriptor_header *h,
+						const struct mali_payload_vertex_tiler *v)
+{
+	struct mali_payload_vertex_tiler_unpacked vu;
+
+	mali_payload_vertex_tiler_unpack(v, &vu);
+	if (h->job_type == JOB_TYPE_TILER && vu.indices)
+		panwrap_snapshot_add_gpu_mem(data, vu.indices);
+
+	return true;
+}
+
+static void panwrap_snapshot_visit_shader(void *data, mali_ptr meta_ptr,
+					  const struct mali_shader_meta *meta)
+{
+	if (meta)
+		panwrap_snapshot_add_gpu_mem(data, meta->shader & ~(mali_ptr) 0xF);
+}
+
+static const struct pandecode_visitor panwrap_snapshot_visitor = {
+	.vertex_tiler = panwrap_snapshot_visit_vertex_tiler,
+	.shader = panwrap_snapshot_visit_shader,
+};
+
+void panwrap_snapshot_add_chain(struct panwrap_snapshot *snapshot,
+				mali_ptr jc_gpu_va)
+{
+	struct pandecode_context ctx = {
+		.resolve = panwrap_snapshot_resolve,
+		.visitor = &panwrap_snapshot_visitor,
+		.data = snapshot,
+		.max_jobs = max_chain_jobs,
+	};
+
+	if (jc_gpu_va)
+		pandecode_chain(&ctx, jc_gpu_va);
+}
+
+static void __attribute__((constructor)) panwrap_decoder_init()
+{
+	max_chain_jobs = panwrap_parse_env_long("PANWRAP_MAX_CHAIN_JOBS", 1024);
+	dump_attributes = panwrap_parse_env_bool("PANWRAP_DUMP_ATTRIBUTES", false);
+}
+
+static void
+panwrap_trace_ext_res_list(const struct mali_jd_atom_v2 *atom)
+{
+	const struct mali_external_resource *list =
+		panwrap_cpu_mem((void *) (uintptr_t) atom->jc, sizeof(*list));
+
+	if (!list) {
+		panwrap_log("External resource list @ " MALI_PTR_FORMAT " wasn't captured\n",
+			    atom->jc);
+		return;
+	}
+
+	if (list->count > MALI_EXT_RES_MAX) {
+		panwrap_log("%" PRIu64 " external resources, more than the kernel takes (%d)\n",
+			    list->count, MALI_EXT_RES_MAX);
+		return;
+	}
+
+	list = panwrap_cpu_mem((void *) (uintptr_t) atom->jc,
+			       sizeof(list->count) +
+			       sizeof(list->ext_resource[0]) * list->count);
+	if (!list)
+		return;
+
+	panwrap_log("%" PRIu64 " external resources:\n", list->count);
+	panwrap_indent++;
+	for (int i = 0; i < list->count; i++) {
+		u64 res = list->ext_resource[i];
+
+		panwrap_log(MALI_PTR_FORMAT " (%s)\n", (mali_ptr) (res & ~3ull),
+			    res & MALI_EXT_RES_ACCESS_EXCLUSIVE ?
+			    "exclusive" : "shared");
+	}
 	panwrap_indent--;
 }
 
-void panwrap_trace_atom(const struct mali_jd_atom_v2 *atom)
+/**
+ * Log what a soft job does. Unlike hardware atoms, their jc doesn't point to
+ * a job chain, but to a job-specific payload in CPU or GPU memory, or in some
+ * cases is the payload itself.
+ */
+void panwrap_trace_soft_job(const struct mali_jd_atom_v2 *atom)
 {
-	if (atom->core_req & MALI_JD_REQ_SOFT_JOB) {
-		/* We don't support decoding these, or need them just yet */
-		panwrap_log("Soft job, cannot decode these yet!\n");
-	} else {
+	const struct mali_jd_jit_alloc_info *jit;
+	const struct mali_jd_fence *fence;
+	const u8 *event;
+
+	switch (atom->core_req & MALI_JD_REQ_SOFT_JOB_TYPE) {
+	case MALI_JD_REQ_SOFT_JIT_ALLOC:
+		jit = panwrap_cpu_mem((void *) (uintptr_t) atom->jc,
+				      sizeof(*jit));
+		if (!jit) {
+			panwrap_log("JIT allocation info @ " MALI_PTR_FORMAT " wasn't captured\n",
+				    atom->jc);
+			break;
+		}
 
+		panwrap_log("JIT allocation #%u: %" PRIu64 " pages, %" PRIu64 " committed, extent %" PRIu64 ", GPU VA written to 0x%" PRIx64 "\n",
+			    jit->id, jit->va_pages, jit->commit_pages,
+			    jit->extent, jit->gpu_alloc_addr);
+		break;
+	case MALI_JD_REQ_SOFT_JIT_FREE:
+		panwrap_log("Frees JIT allocation #%u\n",
+			    (unsigned int) (atom->jc & 0xFF));
+		break;
+	case MALI_JD_REQ_SOFT_EXT_RES_MAP:
+	case MALI_JD_REQ_SOFT_EXT_RES_UNMAP:
+		panwrap_log("%s external resources\n",
+			    (atom->core_req & MALI_JD_REQ_SOFT_JOB_TYPE) ==
+			    MALI_JD_REQ_SOFT_EXT_RES_MAP ? "Maps" : "Unmaps");
+		panwrap_trace_ext_res_list(atom);
+		break;
+	case MALI_JD_REQ_SOFT_FENCE_TRIGGER:
+	case MALI_JD_REQ_SOFT_FENCE_WAIT:
+		fence = panwrap_cpu_mem((void *) (uintptr_t) atom->jc,
+					sizeof(*fence));
+		panwrap_log("%s fence",
+			    (atom->core_req & MALI_JD_REQ_SOFT_JOB_TYPE) ==
+			    MALI_JD_REQ_SOFT_FENCE_WAIT ? "Waits on" : "Triggers");
+		if (fence)
+			panwrap_log_cont(" fd %d (stream fd %d)\n",
+					 fence->fd, fence->stream_fd);
+		else
+			panwrap_log_cont(" @ " MALI_PTR_FORMAT "\n", atom->jc);
+		break;
+	case MALI_JD_REQ_SOFT_EVENT_WAIT:
+	case MALI_JD_REQ_SOFT_EVENT_SET:
+	case MALI_JD_REQ_SOFT_EVENT_RESET:
+		event = panwrap_try_deref_gpu_mem(atom->jc, sizeof(*event));
+		panwrap_log("%s event @ " MALI_PTR_FORMAT,
+			    (atom->core_req & MALI_JD_REQ_SOFT_JOB_TYPE) ==
+			    MALI_JD_REQ_SOFT_EVENT_WAIT ? "Waits on" :
+			    (atom->core_req & MALI_JD_REQ_SOFT_JOB_TYPE) ==
+			    MALI_JD_REQ_SOFT_EVENT_SET ? "Sets" : "Resets",
+			    atom->jc);
+		if (event)
+			panwrap_log_cont(", currently %s\n",
+					 *event ? "set" : "reset");
+		else
+			panwrap_log_cont(", which isn't mapped\n");
+		break;
+	case MALI_JD_REQ_SOFT_DUMP_CPU_GPU_TIME:
+		panwrap_log("Writes the CPU and GPU time to " MALI_PTR_FORMAT "\n",
+			    atom->jc);
+		break;
+	case MALI_JD_REQ_SOFT_REPLAY:
+		panwrap_log("Replays the jobs in the list @ " MALI_PTR_FORMAT " if the atom before it fails\n",
+			    atom->jc);
+		break;
+	case MALI_JD_REQ_SOFT_DEBUG_COPY:
+		panwrap_log("Copies the buffers in the list @ " MALI_PTR_FORMAT " once done\n",
+			    atom->jc);
+		break;
+	default:
+		panwrap_log("Unknown soft job type 0x%x, jc = " MALI_PTR_FORMAT "\n",
+			    atom->core_req & MALI_JD_REQ_SOFT_JOB_TYPE, atom->jc);
+		break;
 	}
 }
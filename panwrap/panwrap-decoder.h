@@ -20,7 +20,13 @@
 #include <mali-job.h>
 #include "panwrap.h"
 
+const char *panwrap_job_type_lookup(enum mali_job_type type);
+const char *panwrap_job_type_name(enum mali_job_type type);
+const char *panwrap_gl_mode_name(enum mali_gl_mode mode);
 void panwrap_trace_hw_chain(mali_ptr jc_gpu_va);
+void panwrap_snapshot_add_chain(struct panwrap_snapshot *snapshot,
+				mali_ptr jc_gpu_va);
+void panwrap_trace_soft_job(const struct mali_jd_atom_v2 *atom);
 
 
 #endif /* !PANWRAP_DECODER_H */
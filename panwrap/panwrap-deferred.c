@@ -0,0 +1,184 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Deferred decoding
+ *
+ * Decoding everything right in the middle of the application's ioctl() calls
+ * adds a lot of latency to each call, especially for JOB_SUBMIT where we walk
+ * entire job chains. When PANWRAP_DEFERRED_DECODE=1 is set, the ioctl wrappers
+ * only copy the ioctl's arguments along with a snapshot of any memory they
+ * reference, and hand them off to a separate decoding thread. Any other log
+ * lines get queued up alongside them, so the log still comes out in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <list.h>
+#include "panwrap.h"
+
+struct deferred_text {
+	struct panwrap_deferred_item item;
+	size_t len;
+	char text[];
+};
+
+static bool enabled;
+static size_t max_pending;
+
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static pthread_t thread;
+static bool thread_running, stopping;
+static __thread bool is_decoder_thread;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
+static LIST_HEAD(queue);
+static size_t pending;
+
+static void *
+panwrap_deferred_thread(void *data)
+{
+	struct panwrap_deferred_item *item;
+	size_t size;
+
+	is_decoder_thread = true;
+
+	pthread_mutex_lock(&queue_lock);
+	for (;;) {
+		while (list_is_empty(&queue) && !stopping)
+			pthread_cond_wait(&queue_cond, &queue_lock);
+
+		if (list_is_empty(&queue))
+			break;
+
+		item = list_first_entry(&queue, typeof(*item), node);
+		list_del(&item->node);
+		pthread_mutex_unlock(&queue_lock);
+
+		size = item->size;
+		item->run(item);
+
+		pthread_mutex_lock(&queue_lock);
+		pending -= size;
+		pthread_cond_broadcast(&space_cond);
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	panwrap_log_flush();
+	return NULL;
+}
+
+static void
+panwrap_deferred_start_thread()
+{
+	int ret = pthread_create(&thread, NULL, panwrap_deferred_thread, NULL);
+
+	if (ret) {
+		fprintf(stderr, "Failed to start deferred decoding thread: %s\n",
+			strerror(ret));
+		exit(1);
+	}
+
+	thread_running = true;
+}
+
+bool
+panwrap_deferred_enabled()
+{
+	return enabled;
+}
+
+/**
+ * Whether or not output from the current thread needs to go through the
+ * queue, instead of being written out directly
+ */
+bool
+panwrap_deferred_should_queue()
+{
+	return enabled && !is_decoder_thread;
+}
+
+void
+panwrap_deferred_queue(struct panwrap_deferred_item *item)
+{
+	pthread_once(&thread_once, panwrap_deferred_start_thread);
+
+	pthread_mutex_lock(&queue_lock);
+
+	/* If the decoder is falling too far behind, wait for it to catch up */
+	while (pending && pending + item->size > max_pending)
+		pthread_cond_wait(&space_cond, &queue_lock);
+
+	pending += item->size;
+	list_add(&item->node, queue.prev);
+	pthread_cond_signal(&queue_cond);
+
+	pthread_mutex_unlock(&queue_lock);
+}
+
+static void
+deferred_text_run(struct panwrap_deferred_item *item)
+{
+	struct deferred_text *t = (struct deferred_text *)item;
+
+	panwrap_log_write(t->text, t->len);
+	free(t);
+}
+
+void
+panwrap_deferred_queue_text(const char *text, size_t len)
+{
+	struct deferred_text *t = malloc(sizeof(*t) + len);
+
+	t->item.run = deferred_text_run;
+	t->item.size = sizeof(*t) + len;
+	t->len = len;
+	memcpy(t->text, text, len);
+
+	panwrap_deferred_queue(&t->item);
+}
+
+static void __attribute__((constructor))
+panwrap_deferred_init()
+{
+	enabled = panwrap_parse_env_bool("PANWRAP_DEFERRED_DECODE", false);
+	max_pending = panwrap_parse_env_long("PANWRAP_DEFERRED_MAX_MB", 256)
+		* 1024 * 1024;
+}
+
+static void __attribute__((destructor))
+panwrap_deferred_fini()
+{
+	if (!thread_running)
+		return;
+
+	/* Make sure everything that's still queued gets written out */
+	panwrap_log_flush();
+
+	pthread_mutex_lock(&queue_lock);
+	stopping = true;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+
+	pthread_join(thread, NULL);
+	thread_running = false;
+
+	/* Anything logged from here on out gets written directly */
+	enabled = false;
+}
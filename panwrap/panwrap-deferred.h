@@ -0,0 +1,40 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_DEFERRED_H__
+#define __PANWRAP_DEFERRED_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <list.h>
+
+/*
+ * Something for the deferred decoding thread to do. run() is called from the
+ * decoding thread in the same order items were queued, and is responsible for
+ * freeing the item. size is the amount of memory the item is holding onto,
+ * and is used to keep the queue from growing without bound.
+ */
+struct panwrap_deferred_item {
+	void (*run)(struct panwrap_deferred_item *item);
+	size_t size;
+
+	struct list node;
+};
+
+bool panwrap_deferred_enabled();
+bool panwrap_deferred_should_queue();
+void panwrap_deferred_queue(struct panwrap_deferred_item *item);
+void panwrap_deferred_queue_text(const char *text, size_t len);
+
+#endif /* __PANWRAP_DEFERRED_H__ */
@@ -0,0 +1,222 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Job completion events
+ *
+ * The kernel tells userspace about finished atoms through struct
+ * mali_jd_event_v2 records read() from the device file, usually after waiting
+ * for it to become readable with poll() or friends. We note when each atom
+ * number gets submitted, decode the events as they're read, and match them
+ * back up to work out how long each atom took from submission to completion.
+ *
+ * We can only see an atom complete once the application asks, so if it
+ * waited for the fd to become readable first, the end of that wait is used as
+ * the completion time. Otherwise, it's when the read() returned. The time
+ * spent blocked in read() and in the waits is added up as well.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <mali-ioctl.h>
+#include "panwrap.h"
+
+#define ENUM_INFO(value, name) { MALI_JD_EVENT_##value, name }
+static const struct panwrap_enum_info event_code_enum_info[] = {
+	ENUM_INFO(NOT_STARTED,        "NOT_STARTED"),
+	ENUM_INFO(DONE,               "DONE"),
+	ENUM_INFO(STOPPED,            "STOPPED"),
+	ENUM_INFO(TERMINATED,         "TERMINATED"),
+	ENUM_INFO(ACTIVE,             "ACTIVE"),
+	ENUM_INFO(JOB_CONFIG_FAULT,   "JOB_CONFIG_FAULT"),
+	ENUM_INFO(JOB_POWER_FAULT,    "JOB_POWER_FAULT"),
+	ENUM_INFO(JOB_READ_FAULT,     "JOB_READ_FAULT"),
+	ENUM_INFO(JOB_WRITE_FAULT,    "JOB_WRITE_FAULT"),
+	ENUM_INFO(JOB_AFFINITY_FAULT, "JOB_AFFINITY_FAULT"),
+	ENUM_INFO(JOB_BUS_FAULT,      "JOB_BUS_FAULT"),
+	ENUM_INFO(INSTR_INVALID_PC,   "INSTR_INVALID_PC"),
+	ENUM_INFO(INSTR_INVALID_ENC,  "INSTR_INVALID_ENC"),
+	ENUM_INFO(DATA_INVALID_FAULT, "DATA_INVALID_FAULT"),
+	ENUM_INFO(TILE_RANGE_FAULT,   "TILE_RANGE_FAULT"),
+	ENUM_INFO(STATE_FAULT,        "STATE_FAULT"),
+	ENUM_INFO(OUT_OF_MEMORY,      "OUT_OF_MEMORY"),
+	ENUM_INFO(UNKNOWN,            "UNKNOWN"),
+	{}
+};
+#undef ENUM_INFO
+
+static void
+log_context_label()
+{
+	unsigned int label = panwrap_context_label();
+
+	if (label)
+		panwrap_log_cont(" [context %u]", label);
+}
+
+/**
+ * Remember when each atom of a successful JOB_SUBMIT was handed to the
+ * kernel. Atoms that won't get an event when they complete successfully
+ * aren't waited for.
+ */
+void
+panwrap_events_submit(struct panwrap_context *ctx,
+		      const struct mali_ioctl_job_submit *args, u64 submit_ns)
+{
+	const struct mali_jd_atom_v2 *atoms = args->addr;
+	struct panwrap_events *events = &ctx->events;
+	int in_flight = 0;
+	bool fragment = false;
+
+	if (args->stride != sizeof(*atoms))
+		return;
+
+	for (int i = 0; i < args->nr_atoms; i++) {
+		const struct mali_jd_atom_v2 *a = &atoms[i];
+		__typeof__(events->atoms[0]) *atom =
+			&events->atoms[a->atom_number];
+		bool soft = a->core_req & MALI_JD_REQ_SOFT_JOB;
+
+		atom->submit_ns = submit_ns;
+		atom->pending =
+			!(a->core_req & (MALI_JD_REQ_EVENT_NEVER |
+					 MALI_JD_REQ_EVENT_ONLY_ON_FAILURE));
+
+		if (atom->pending && !soft && !atom->in_flight) {
+			atom->in_flight = true;
+			in_flight++;
+		}
+
+		if (!soft && (a->core_req & MALI_JD_REQ_FS))
+			fragment = true;
+	}
+
+	panwrap_timeline_submit(ctx, submit_ns, in_flight, fragment);
+}
+
+void
+panwrap_events_read(struct panwrap_context *ctx, const void *buf,
+		    ssize_t size, u64 start_ns, u64 end_ns)
+{
+	struct panwrap_events *events = &ctx->events;
+	const struct mali_jd_event_v2 *ev = buf;
+	int count = size > 0 ? size / sizeof(*ev) : 0;
+	u64 complete_ns;
+	int completed = 0;
+
+	events->blocked_ns += end_ns - start_ns;
+	panwrap_timeline_blocked(ctx, end_ns - start_ns);
+
+	/* If a wait saw the events arrive before we started reading them,
+	 * that's the closer estimate of when they completed */
+	complete_ns = events->ready_ns && events->ready_ns <= start_ns ?
+		events->ready_ns : end_ns;
+	events->ready_ns = 0;
+
+	panwrap_log("read() returned %d event%s after %.3f ms",
+		    count, count == 1 ? "" : "s",
+		    (end_ns - start_ns) / 1000000.0);
+	log_context_label();
+	panwrap_log_cont("\n");
+
+	panwrap_indent++;
+	for (int i = 0; i < count; i++) {
+		__typeof__(events->atoms[0]) *atom =
+			&events->atoms[ev[i].atom_number];
+
+		panwrap_log("Atom %d: %s", ev[i].atom_number,
+			    panwrap_enum_name(event_code_enum_info,
+					      ev[i].event_code));
+
+		if (ev[i].event_code != MALI_JD_EVENT_DONE)
+			events->failed++;
+
+		if (atom->pending || atom->submit_ns) {
+			u64 latency = complete_ns - atom->submit_ns;
+
+			panwrap_log_cont(", %.3f ms after submission\n",
+					 latency / 1000000.0);
+			panwrap_histogram_record(&events->latency, latency);
+			events->completed++;
+		} else {
+			panwrap_log_cont(", never submitted\n");
+			events->unmatched++;
+		}
+
+		panwrap_tiler_heap_complete(ctx, ev[i].atom_number);
+
+		completed += atom->in_flight;
+		atom->pending = false;
+		atom->in_flight = false;
+		atom->submit_ns = 0;
+	}
+	panwrap_indent--;
+
+	panwrap_timeline_complete(ctx, complete_ns, completed);
+}
+
+/**
+ * Record the time spent in a poll(), select() or epoll_wait() that was
+ * waiting on the context's fd, and whether it came back readable.
+ */
+void
+panwrap_events_wait(struct panwrap_context *ctx, const char *func,
+		    bool ready, u64 start_ns, u64 end_ns)
+{
+	struct panwrap_events *events = &ctx->events;
+
+	events->waits++;
+	events->blocked_ns += end_ns - start_ns;
+	panwrap_timeline_blocked(ctx, end_ns - start_ns);
+	if (ready && !events->ready_ns)
+		events->ready_ns = end_ns;
+
+	panwrap_log("%s() %s after %.3f ms", func,
+		    ready ? "returned events" : "returned nothing",
+		    (end_ns - start_ns) / 1000000.0);
+	log_context_label();
+	panwrap_log_cont("\n");
+}
+
+void
+panwrap_events_log_stats(const struct panwrap_context *ctx)
+{
+	const struct panwrap_events *events = &ctx->events;
+	const struct panwrap_histogram *h = &events->latency;
+	int pending = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(events->atoms); i++)
+		pending += events->atoms[i].pending;
+
+	if (!h->count && !events->unmatched && !events->waits)
+		return;
+
+	panwrap_log("Atom completion on context %u: %" PRIu64 " completed (%" PRIu64 " failed), %" PRIu64 " unmatched, %d still pending\n",
+		    ctx->id, events->completed, events->failed,
+		    events->unmatched, pending);
+
+	panwrap_indent++;
+	if (h->count) {
+		panwrap_log("Submit to completion: avg %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			    h->sum / 1000000.0 / h->count,
+			    panwrap_histogram_percentile(h, 50) / 1000000.0,
+			    panwrap_histogram_percentile(h, 90) / 1000000.0,
+			    panwrap_histogram_percentile(h, 99) / 1000000.0,
+			    h->max / 1000000.0);
+	}
+	panwrap_log("Blocked in read() and %" PRIu64 " waits: %.3f ms\n",
+		    events->waits, events->blocked_ns / 1000000.0);
+	panwrap_indent--;
+}
@@ -0,0 +1,54 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_EVENTS_H__
+#define __PANWRAP_EVENTS_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <mali-ioctl.h>
+#include "panwrap-latency.h"
+
+struct panwrap_context;
+
+/* Completion tracking for one context, see panwrap-events.c */
+struct panwrap_events {
+	struct {
+		u64 submit_ns;
+		bool pending;
+		bool in_flight;
+	} atoms[256];
+
+	/* When a wait last reported the fd as readable, or 0 */
+	u64 ready_ns;
+
+	struct panwrap_histogram latency;
+	u64 completed;
+	u64 failed;
+	u64 unmatched;
+
+	u64 waits;
+	u64 blocked_ns;
+};
+
+void panwrap_events_submit(struct panwrap_context *ctx,
+			   const struct mali_ioctl_job_submit *args,
+			   u64 submit_ns);
+void panwrap_events_read(struct panwrap_context *ctx, const void *buf,
+			 ssize_t size, u64 start_ns, u64 end_ns);
+void panwrap_events_wait(struct panwrap_context *ctx, const char *func,
+			 bool ready, u64 start_ns, u64 end_ns);
+void panwrap_events_log_stats(const struct panwrap_context *ctx);
+
+#endif /* __PANWRAP_EVENTS_H__ */
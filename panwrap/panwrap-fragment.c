@@ -0,0 +1,237 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Framebuffers and render passes
+ *
+ * Each fragment job is one render pass: it goes over every tile between its
+ * min and max tile coordinates, and writes the results out to the render
+ * targets of its framebuffer descriptor. Besides decoding those, we estimate
+ * how much memory traffic each render pass causes:
+ *
+ *  - Every render target gets written for every pixel covered. We can't
+ *    decode the actual formats yet, so we assume a byte per channel. With
+ *    AFBC the data gets compressed, so that's an upper bound.
+ *  - Depth/stencil only get written back with MALI_MFBD_DEPTH_WRITE, at 4
+ *    bytes per pixel for depth (or combined depth/stencil) and 1 for stencil.
+ *  - Transaction elimination checksums take 8 bytes per tile.
+ *  - The blob loads a render target's previous contents by drawing them, and
+ *    we can't tell that apart from any other draw. Instead, when a render pass
+ *    uses the same render target or depth buffer as the render pass right
+ *    before it on the same context, we assume it carries on where the other
+ *    left off and has to load it back in first. That usually means the frame
+ *    got flushed halfway, which is worth knowing about in itself.
+ *
+ * The totals over every render pass get logged at exit.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <mali-job-schema.h>
+#include "panwrap.h"
+
+#define ENUM_INFO(value) { MALI_RT_BLOCK_##value, #value }
+static const struct panwrap_enum_info rt_block_enum_info[] = {
+	ENUM_INFO(TILED),
+	ENUM_INFO(UNKNOWN),
+	ENUM_INFO(LINEAR),
+	ENUM_INFO(AFBC),
+	{}
+};
+#undef ENUM_INFO
+
+static struct {
+	u64 passes;
+	u64 reloads;
+	u64 written;
+	u64 read;
+} totals;
+
+static pthread_mutex_t pass_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static float
+fbd_float(u64 bits)
+{
+	u32 word = bits;
+	float f;
+
+	memcpy(&f, &word, sizeof(f));
+	return f;
+}
+
+static int
+fbd_rt_count(const struct mali_framebuffer_unpacked *fu)
+{
+	return MIN(fu->rt_count_1 + 1, PANWRAP_MAX_RENDER_TARGETS);
+}
+
+/**
+ * Log everything we know about a framebuffer descriptor: its size, clear
+ * values, tiler memory, depth/stencil buffers and render targets.
+ */
+void
+panwrap_framebuffer_log(mali_ptr gpu_va, const struct mali_framebuffer *fb,
+			const struct mali_framebuffer_extra *extra,
+			const struct mali_render_target *rts)
+{
+	struct mali_framebuffer_unpacked fu;
+
+	mali_framebuffer_unpack(fb, &fu);
+
+	panwrap_log("Framebuffer @ " MALI_PTR_FORMAT ": %" PRIu64 "x%" PRIu64 ", %d render target%s, flags 0x%" PRIx64 "\n",
+		    gpu_va, fu.width1 + 1, fu.height1 + 1, fbd_rt_count(&fu),
+		    fbd_rt_count(&fu) == 1 ? "" : "s", fu.mfbd_flags);
+	panwrap_indent++;
+
+	panwrap_log("Clear depth %f, clear stencil %" PRIu64 "%s\n",
+		    fbd_float(fu.clear_depth), fu.clear_stencil,
+		    fu.mfbd_flags & MALI_MFBD_DEPTH_WRITE ?
+		    ", depth/stencil written back" : "");
+	panwrap_log("Scratchpad @ 0x%" PRIx64 ", tiler heap 0x%" PRIx64 "-0x%" PRIx64 "\n",
+		    fu.scratchpad, fu.tiler_heap_start, fu.tiler_heap_end);
+
+	if (extra) {
+		struct mali_framebuffer_extra_unpacked eu;
+
+		mali_framebuffer_extra_unpack(extra, &eu);
+		panwrap_log("Depth @ 0x%" PRIx64 " (stride %" PRIu64 "), stencil @ 0x%" PRIx64 " (stride %" PRIu64 "), checksums @ 0x%" PRIx64 "\n",
+			    eu.depth, eu.depth_stride << 4, eu.stencil,
+			    eu.stencil_stride << 4, eu.checksum);
+	}
+
+	for (int i = 0; rts && i < fbd_rt_count(&fu); i++) {
+		struct mali_render_target_unpacked ru;
+
+		mali_render_target_unpack(&rts[i], &ru);
+		panwrap_log("Render target %d @ 0x%" PRIx64 ": %" PRIu64 " channels, %s, stride %" PRIu64 ", format 0x%08" PRIx64 ", clear colour 0x%08" PRIx64 "\n",
+			    i, ru.framebuffer, ru.nr_channels + 1,
+			    panwrap_enum_name(rt_block_enum_info, ru.block),
+			    ru.framebuffer_stride << 4, ru.format_unk1,
+			    ru.clear_color_1);
+	}
+
+	panwrap_indent--;
+}
+
+/**
+ * Estimate how many bytes the render pass of fragment job f reads and writes,
+ * see the top of this file.
+ */
+void
+panwrap_fragment_log_bandwidth(const struct mali_payload_fragment *f,
+			       const struct mali_framebuffer *fb,
+			       const struct mali_framebuffer_extra *extra,
+			       const struct mali_render_target *rts)
+{
+	struct mali_payload_fragment_unpacked pu;
+	struct mali_framebuffer_unpacked fu;
+	struct mali_framebuffer_extra_unpacked eu = {};
+	struct panwrap_fragment *last_pass =
+		&panwrap_context_current()->last_pass;
+	struct panwrap_fragment scratch = {};
+	u64 colour = 0, zs = 0, checksums = 0, read = 0;
+	u64 targets[PANWRAP_MAX_RENDER_TARGETS];
+	u64 tiles, pixels;
+	bool depth_write;
+	int rt_count;
+
+	mali_payload_fragment_unpack(f, &pu);
+	mali_framebuffer_unpack(fb, &fu);
+	if (extra)
+		mali_framebuffer_extra_unpack(extra, &eu);
+
+	tiles = (pu.max_tile_x - MIN(pu.min_tile_x, pu.max_tile_x) + 1) *
+		(pu.max_tile_y - MIN(pu.min_tile_y, pu.max_tile_y) + 1);
+	pixels = tiles * MALI_FRAGMENT_TILE_SIZE * MALI_FRAGMENT_TILE_SIZE;
+	depth_write = fu.mfbd_flags & MALI_MFBD_DEPTH_WRITE;
+	rt_count = rts ? fbd_rt_count(&fu) : 0;
+
+	if (depth_write)
+		zs = pixels * ((eu.depth ? 4 : 0) + (eu.stencil ? 1 : 0));
+	if (eu.checksum)
+		checksums = tiles * 8;
+
+	pthread_mutex_lock(&pass_lock);
+
+	/*
+	 * While decoding in parallel we can't tell which pass came before, so
+	 * forget the last one and don't keep track of this one either.
+	 */
+	if (panwrap_workers_batch()) {
+		memset(last_pass, 0, sizeof(*last_pass));
+		last_pass = &scratch;
+	}
+
+	for (int i = 0; i < rt_count; i++) {
+		struct mali_render_target_unpacked ru;
+		u64 bytes;
+
+		mali_render_target_unpack(&rts[i], &ru);
+		bytes = pixels * (ru.nr_channels + 1);
+		colour += bytes;
+		targets[i] = ru.framebuffer;
+
+		for (int j = 0; j < last_pass->rt_count; j++) {
+			if (last_pass->rts[j] != ru.framebuffer)
+				continue;
+
+			panwrap_log("Render target %d @ 0x%" PRIx64 " was rendered to by the previous render pass too, so it likely gets loaded back in (%" PRIu64 " KiB)\n",
+				    i, ru.framebuffer, bytes / 1024);
+			read += bytes;
+			totals.reloads++;
+			break;
+		}
+	}
+
+	if (eu.depth && eu.depth == last_pass->depth && last_pass->depth_written) {
+		u64 bytes = pixels * 4;
+
+		panwrap_log("Depth @ 0x%" PRIx64 " was written back by the previous render pass, so it likely gets loaded back in (%" PRIu64 " KiB)\n",
+			    eu.depth, bytes / 1024);
+		read += bytes;
+		totals.reloads++;
+	}
+
+	last_pass->rt_count = rt_count;
+	memcpy(last_pass->rts, targets, sizeof(targets[0]) * rt_count);
+	last_pass->depth = eu.depth;
+	last_pass->depth_written = depth_write;
+
+	totals.passes++;
+	totals.written += colour + zs + checksums;
+	totals.read += read;
+
+	pthread_mutex_unlock(&pass_lock);
+
+	panwrap_log("Bandwidth estimate: %" PRIu64 " KiB written (colour %" PRIu64 ", depth/stencil %" PRIu64 ", checksums %" PRIu64 "), %" PRIu64 " KiB read, over %" PRIu64 " tiles\n",
+		    (colour + zs + checksums) / 1024, colour / 1024, zs / 1024,
+		    checksums / 1024, read / 1024, tiles);
+}
+
+static void __attribute__((destructor))
+panwrap_fragment_fini()
+{
+	if (!totals.passes)
+		return;
+
+	panwrap_log("Render passes: %" PRIu64 ", estimated %.2f MiB written and %.2f MiB read, %.2f MiB per render pass, %" PRIu64 " likely reloads\n",
+		    totals.passes, totals.written / (1024.0 * 1024.0),
+		    totals.read / (1024.0 * 1024.0),
+		    (totals.written + totals.read) / (1024.0 * 1024.0) /
+		    totals.passes, totals.reloads);
+	panwrap_log_flush();
+}
@@ -0,0 +1,41 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_FRAGMENT_H__
+#define __PANWRAP_FRAGMENT_H__
+
+#include <stdbool.h>
+#include <mali-ioctl.h>
+#include <mali-job.h>
+
+#define PANWRAP_MAX_RENDER_TARGETS 4
+
+/* What a context's previous render pass rendered to, see panwrap-fragment.c */
+struct panwrap_fragment {
+	u64 rts[PANWRAP_MAX_RENDER_TARGETS];
+	int rt_count;
+	u64 depth;
+	bool depth_written;
+};
+
+void panwrap_framebuffer_log(mali_ptr gpu_va,
+			     const struct mali_framebuffer *fb,
+			     const struct mali_framebuffer_extra *extra,
+			     const struct mali_render_target *rts);
+void panwrap_fragment_log_bandwidth(const struct mali_payload_fragment *f,
+				    const struct mali_framebuffer *fb,
+				    const struct mali_framebuffer_extra *extra,
+				    const struct mali_render_target *rts);
+
+#endif /* __PANWRAP_FRAGMENT_H__ */
@@ -0,0 +1,249 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Per-frame statistics
+ *
+ * With PANWRAP_FRAME_STATS=1, we count what each context does in a frame:
+ * draws by primitive mode, vertices drawn, jobs by type, atoms, submits,
+ * bytes synced to the GPU and bytes of new GPU allocations. Every frame gets
+ * a line in the log, and the median, 90th percentile and maximum of each
+ * counter over the whole run get logged along with the other context stats,
+ * which is handy for comparing two builds of the same application.
+ *
+ * Draws and jobs are counted by walking each job chain with libpandecode as
+ * it gets submitted, so they don't depend on whether that submit was sampled
+ * or decoded in full. A draw is a tiler job.
+ *
+ * Like in panwrap-timeline.c, each fragment atom ends a frame. Applications
+ * that never render anything can use PANWRAP_FRAME_SUBMITS=n instead to end
+ * a frame every n submits.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <mali-job-schema.h>
+#include <pandecode.h>
+#include "panwrap.h"
+
+#define MALI_PAGE_SIZE 4096
+#define MAX_CHAIN_JOBS 4096
+
+static bool enabled;
+static long frame_submits;
+
+static const char *counter_names[PANWRAP_FRAME_COUNTERS] = {
+	[PANWRAP_FRAME_DRAWS]     = "draws",
+	[PANWRAP_FRAME_VERTICES]  = "vertices",
+	[PANWRAP_FRAME_JOBS]      = "jobs",
+	[PANWRAP_FRAME_ATOMS]     = "atoms",
+	[PANWRAP_FRAME_SUBMITS]   = "submits",
+	[PANWRAP_FRAME_SYNCED]    = "bytes synced",
+	[PANWRAP_FRAME_ALLOCATED] = "bytes allocated",
+};
+
+static const void *
+frame_stats_resolve(void *data, mali_ptr gpu_va, size_t size)
+{
+	return panwrap_try_deref_gpu_mem(gpu_va, size);
+}
+
+static bool
+frame_stats_visit_job(void *data, int index, mali_ptr gpu_va,
+		      const struct mali_job_descriptor_header *h)
+{
+	struct panwrap_frame_stats *fs = data;
+	struct mali_job_descriptor_header_unpacked hu;
+
+	mali_job_descriptor_header_unpack(h, &hu);
+	fs->counters[PANWRAP_FRAME_JOBS]++;
+	fs->jobs_by_type[hu.job_type]++;
+
+	return hu.job_type == JOB_TYPE_TILER;
+}
+
+static bool
+frame_stats_visit_vertex_tiler(void *data, mali_ptr gpu_va,
+			       const struct mali_job_descriptor_header *h,
+			       const struct mali_payload_vertex_tiler *v)
+{
+	struct panwrap_frame_stats *fs = data;
+	struct mali_payload_vertex_tiler_unpacked vu;
+
+	mali_payload_vertex_tiler_unpack(v, &vu);
+	fs->counters[PANWRAP_FRAME_DRAWS]++;
+	fs->counters[PANWRAP_FRAME_VERTICES] += vu.index_count + 1;
+	fs->draws_by_mode[vu.draw_mode]++;
+
+	/* We've got everything we need from this job */
+	return false;
+}
+
+static const struct pandecode_visitor frame_stats_visitor = {
+	.job = frame_stats_visit_job,
+	.vertex_tiler = frame_stats_visit_vertex_tiler,
+};
+
+static void
+frame_stats_log_frame(const struct panwrap_frame_stats *fs)
+{
+	panwrap_log("Frame %" PRIu64 ": %" PRIu64 " draws", fs->frames,
+		    fs->counters[PANWRAP_FRAME_DRAWS]);
+	for (int i = 0, first = 1; i < ARRAY_SIZE(fs->draws_by_mode); i++) {
+		if (!fs->draws_by_mode[i])
+			continue;
+
+		panwrap_log_cont("%s%u %s", first ? " (" : ", ",
+				 fs->draws_by_mode[i], panwrap_gl_mode_name(i));
+		first = 0;
+	}
+	if (fs->counters[PANWRAP_FRAME_DRAWS])
+		panwrap_log_cont(")");
+
+	panwrap_log_cont(", %" PRIu64 " vertices, %" PRIu64 " jobs",
+			 fs->counters[PANWRAP_FRAME_VERTICES],
+			 fs->counters[PANWRAP_FRAME_JOBS]);
+	for (int i = 0, first = 1; i < ARRAY_SIZE(fs->jobs_by_type); i++) {
+		const char *name = panwrap_job_type_lookup(i);
+
+		if (!fs->jobs_by_type[i])
+			continue;
+
+		if (name)
+			panwrap_log_cont("%s%u %s", first ? " (" : ", ",
+					 fs->jobs_by_type[i], name);
+		else
+			panwrap_log_cont("%s%u of unknown type %d",
+					 first ? " (" : ", ",
+					 fs->jobs_by_type[i], i);
+		first = 0;
+	}
+	if (fs->counters[PANWRAP_FRAME_JOBS])
+		panwrap_log_cont(")");
+
+	panwrap_log_cont(", %" PRIu64 " atoms in %" PRIu64 " submits, %" PRIu64 " KiB synced, %" PRIu64 " KiB allocated\n",
+			 fs->counters[PANWRAP_FRAME_ATOMS],
+			 fs->counters[PANWRAP_FRAME_SUBMITS],
+			 fs->counters[PANWRAP_FRAME_SYNCED] / 1024,
+			 fs->counters[PANWRAP_FRAME_ALLOCATED] / 1024);
+}
+
+static void
+frame_stats_end_frame(struct panwrap_frame_stats *fs)
+{
+	fs->frames++;
+	frame_stats_log_frame(fs);
+
+	for (int i = 0; i < PANWRAP_FRAME_COUNTERS; i++)
+		panwrap_histogram_record(&fs->histograms[i], fs->counters[i]);
+
+	memset(fs->counters, 0, sizeof(fs->counters));
+	memset(fs->draws_by_mode, 0, sizeof(fs->draws_by_mode));
+	memset(fs->jobs_by_type, 0, sizeof(fs->jobs_by_type));
+}
+
+static void
+frame_stats_submit(struct panwrap_frame_stats *fs,
+		   const struct mali_ioctl_job_submit *args)
+{
+	const struct mali_jd_atom_v2 *atoms = args->addr;
+	struct pandecode_context decode = {
+		.resolve = frame_stats_resolve,
+		.visitor = &frame_stats_visitor,
+		.data = fs,
+		.max_jobs = MAX_CHAIN_JOBS,
+	};
+	bool frame_done = false;
+
+	if (args->stride != sizeof(*atoms))
+		return;
+
+	fs->counters[PANWRAP_FRAME_SUBMITS]++;
+	fs->counters[PANWRAP_FRAME_ATOMS] += args->nr_atoms;
+
+	for (int i = 0; i < args->nr_atoms; i++) {
+		if (atoms[i].core_req & MALI_JD_REQ_SOFT_JOB)
+			continue;
+
+		if (atoms[i].jc)
+			pandecode_chain(&decode, atoms[i].jc);
+		if (atoms[i].core_req & MALI_JD_REQ_FS)
+			frame_done = true;
+	}
+
+	if (frame_submits)
+		frame_done = fs->counters[PANWRAP_FRAME_SUBMITS] == frame_submits;
+
+	if (frame_done)
+		frame_stats_end_frame(fs);
+}
+
+/**
+ * Count whatever a successful ioctl on ctx adds to the current frame.
+ */
+void
+panwrap_frame_stats_ioctl(struct panwrap_context *ctx,
+			  unsigned long int request, const void *ptr)
+{
+	struct panwrap_frame_stats *fs = &ctx->frame_stats;
+
+	if (!enabled || !ptr)
+		return;
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		frame_stats_submit(fs, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_SYNC)) {
+		const struct mali_ioctl_sync *args = ptr;
+
+		if (args->type == MALI_SYNC_TO_DEVICE)
+			fs->counters[PANWRAP_FRAME_SYNCED] += args->size;
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_ALLOC)) {
+		const struct mali_ioctl_mem_alloc *args = ptr;
+
+		fs->counters[PANWRAP_FRAME_ALLOCATED] +=
+			args->commit_pages * MALI_PAGE_SIZE;
+	}
+}
+
+void
+panwrap_frame_stats_log_stats(const struct panwrap_context *ctx)
+{
+	const struct panwrap_frame_stats *fs = &ctx->frame_stats;
+
+	if (!fs->frames)
+		return;
+
+	panwrap_log("Frame stats on context %u over %" PRIu64 " frames (median / 90th percentile / max):\n",
+		    ctx->id, fs->frames);
+	panwrap_indent++;
+	for (int i = 0; i < PANWRAP_FRAME_COUNTERS; i++) {
+		const struct panwrap_histogram *h = &fs->histograms[i];
+
+		panwrap_log("%s: %" PRIu64 " / %" PRIu64 " / %" PRIu64 ", avg %.1f\n",
+			    counter_names[i],
+			    panwrap_histogram_percentile(h, 50),
+			    panwrap_histogram_percentile(h, 90),
+			    h->max, (double) h->sum / h->count);
+	}
+	panwrap_indent--;
+}
+
+static void __attribute__((constructor))
+panwrap_frame_stats_init()
+{
+	enabled = panwrap_parse_env_bool("PANWRAP_FRAME_STATS", false);
+	frame_submits = MAX(panwrap_parse_env_long("PANWRAP_FRAME_SUBMITS", 0), 0);
+}
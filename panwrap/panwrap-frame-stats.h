@@ -0,0 +1,54 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_FRAME_STATS_H__
+#define __PANWRAP_FRAME_STATS_H__
+
+#include <panloader-util.h>
+#include "panwrap-latency.h"
+
+struct panwrap_context;
+
+/* job_type is a 7-bit field of the job header */
+#define PANWRAP_JOB_TYPES (1 << 7)
+
+enum panwrap_frame_counter {
+	PANWRAP_FRAME_DRAWS,
+	PANWRAP_FRAME_VERTICES,
+	PANWRAP_FRAME_JOBS,
+	PANWRAP_FRAME_ATOMS,
+	PANWRAP_FRAME_SUBMITS,
+	PANWRAP_FRAME_SYNCED,
+	PANWRAP_FRAME_ALLOCATED,
+
+	PANWRAP_FRAME_COUNTERS
+};
+
+/* What one context did in its current frame, and the distribution of each
+ * counter over all of the frames before it, see panwrap-frame-stats.c */
+struct panwrap_frame_stats {
+	u64 frames;
+
+	u64 counters[PANWRAP_FRAME_COUNTERS];
+	u32 draws_by_mode[16];
+	u32 jobs_by_type[PANWRAP_JOB_TYPES];
+
+	struct panwrap_histogram histograms[PANWRAP_FRAME_COUNTERS];
+};
+
+void panwrap_frame_stats_ioctl(struct panwrap_context *ctx,
+			       unsigned long int request, const void *ptr);
+void panwrap_frame_stats_log_stats(const struct panwrap_context *ctx);
+
+#endif /* __PANWRAP_FRAME_STATS_H__ */
@@ -0,0 +1,361 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Index buffers
+ *
+ * For indexed draws, we go through the index buffer and log:
+ *
+ *  - The range of indices used, and how many unique vertices are in it.
+ *    Midgard vertex jobs shade every vertex in the range, so any vertex in
+ *    the range that isn't referenced is shaded for nothing.
+ *  - How a FIFO post-transform vertex cache of PANWRAP_VERTEX_CACHE entries
+ *    (16 by default) would do on the index stream: the average cache miss
+ *    ratio (ACMR, misses per triangle, 0.5 at best and 3 at worst) and the
+ *    average transform to vertex ratio (ATVR, misses per unique vertex, 1 at
+ *    best). High numbers mean the mesh would benefit from being reordered
+ *    for the vertex cache.
+ *  - Degenerate triangles, with the same vertex more than once.
+ *
+ * The all-ones index of each index type is taken to be a primitive restart,
+ * since GLES 3 always has fixed index primitive restart enabled. Restarts
+ * split strips and fans up, and aren't vertices themselves.
+ *
+ * Totals over every draw we decoded get logged on exit, including draws
+ * that were only logged as the same as an earlier one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "panwrap.h"
+
+/* Past this, we don't bother tracking each vertex in the range */
+#define MAX_RANGE (1 << 22)
+#define MAX_CACHE_SIZE 1024
+
+/* Anything past these is worth pointing out */
+#define POOR_ATVR 1.5
+#define POOR_RANGE_USE 0.5
+
+static unsigned int cache_size;
+
+static struct {
+	u64 draws;
+	u64 indices;
+	u64 triangles;
+	u64 misses;
+	u64 unique;
+	u64 range;
+	u64 degenerate;
+} totals;
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static u32
+index_get(const void *indices, enum mali_index_type type, u64 i)
+{
+	switch (type) {
+	case MALI_INDEX_UINT8:  return ((const u8 *) indices)[i];
+	case MALI_INDEX_UINT16: return ((const u16 *) indices)[i];
+	default:                return ((const u32 *) indices)[i];
+	}
+}
+
+/* The primitive restart index of type */
+static u32
+index_restart(enum mali_index_type type)
+{
+	switch (type) {
+	case MALI_INDEX_UINT8:  return 0xFF;
+	case MALI_INDEX_UINT16: return 0xFFFF;
+	default:                return 0xFFFFFFFF;
+	}
+}
+
+/* Number of triangles in count vertices of mode, or 0 for other primitives */
+static u64
+indices_triangles(enum mali_gl_mode mode, u64 count)
+{
+	switch (mode) {
+	case MALI_GL_TRIANGLES:
+		return count / 3;
+	case MALI_GL_TRIANGLE_STRIP:
+	case MALI_GL_TRIANGLE_FAN:
+		return count >= 3 ? count - 2 : 0;
+	default:
+		return 0;
+	}
+}
+
+/* Degenerate triangles among the first triangles starting at index first */
+static u64
+indices_count_degenerate(const void *indices, enum mali_index_type type,
+			 enum mali_gl_mode mode, u64 first, u64 triangles)
+{
+	u64 degenerate = 0;
+
+	for (u64 t = 0; t < triangles; t++) {
+		u32 a, b, c;
+
+		switch (mode) {
+		case MALI_GL_TRIANGLES:
+			a = index_get(indices, type, first + t * 3);
+			b = index_get(indices, type, first + t * 3 + 1);
+			c = index_get(indices, type, first + t * 3 + 2);
+			break;
+		case MALI_GL_TRIANGLE_STRIP:
+			a = index_get(indices, type, first + t);
+			b = index_get(indices, type, first + t + 1);
+			c = index_get(indices, type, first + t + 2);
+			break;
+		default:
+			a = index_get(indices, type, first);
+			b = index_get(indices, type, first + t + 1);
+			c = index_get(indices, type, first + t + 2);
+			break;
+		}
+
+		if (a == b || b == c || a == c)
+			degenerate++;
+	}
+
+	return degenerate;
+}
+
+/*
+ * Run the index stream through a FIFO cache. Rather than keeping the FIFO
+ * itself, we remember when each vertex was last loaded into it (counted in
+ * misses): it's still cached if fewer than cache_size misses happened since.
+ * Returns the number of misses, and the number of unique vertices in unique.
+ */
+static u64
+indices_simulate_cache(const void *indices, enum mali_index_type type,
+		       u64 count, u32 min, u64 range, u64 *unique)
+{
+	u32 *loaded = calloc(range, sizeof(*loaded));
+	u32 restart = index_restart(type);
+	u64 misses = 0;
+
+	*unique = 0;
+	if (!loaded)
+		return 0;
+
+	for (u64 i = 0; i < count; i++) {
+		u32 index = index_get(indices, type, i);
+		u32 *v;
+
+		if (index == restart)
+			continue;
+
+		v = &loaded[index - min];
+
+		if (!*v)
+			(*unique)++;
+		else if (misses - *v < cache_size)
+			continue;
+
+		*v = ++misses;
+	}
+
+	free(loaded);
+	return misses;
+}
+
+/**
+ * Size of the index buffer of a tiler job in bytes, or 0 if it isn't indexed
+ */
+size_t
+panwrap_indices_size(const struct mali_payload_vertex_tiler_unpacked *vu)
+{
+	if (vu->index_type == MALI_INDEX_NONE || !vu->indices)
+		return 0;
+
+	return (vu->index_count + 1) << (vu->index_type - 1);
+}
+
+/* What we found out about one index buffer */
+struct indices_stats {
+	u64 count;
+	u64 restarts;
+	u64 triangles;
+	u64 misses;
+	u64 unique;
+	u64 degenerate;
+	u32 min, max;
+
+	/* 0 if every index is a restart */
+	u64 range;
+
+	/* Whether the range was small enough to simulate the cache */
+	bool simulated;
+};
+
+/* Go through the index buffer of vu, returning false if it isn't mapped */
+static bool
+indices_analyse(const struct mali_payload_vertex_tiler_unpacked *vu,
+		struct indices_stats *st)
+{
+	enum mali_index_type type = vu->index_type;
+	enum mali_gl_mode mode = vu->draw_mode;
+	u32 restart = index_restart(type);
+	const void *indices;
+
+	*st = (struct indices_stats) {
+		.count = vu->index_count + 1,
+		.min = ~0,
+	};
+
+	indices = panwrap_try_deref_gpu_mem(vu->indices,
+					    panwrap_indices_size(vu));
+	if (!indices)
+		return false;
+
+	/* Each run of indices between restarts is a primitive of its own */
+	for (u64 first = 0, i = 0; i <= st->count; i++) {
+		u64 triangles;
+		u32 index;
+
+		if (i < st->count) {
+			index = index_get(indices, type, i);
+			if (index != restart) {
+				st->min = MIN(st->min, index);
+				st->max = MAX(st->max, index);
+				continue;
+			}
+
+			st->restarts++;
+		}
+
+		triangles = indices_triangles(mode, i - first);
+		st->triangles += triangles;
+		st->degenerate += indices_count_degenerate(indices, type, mode,
+							   first, triangles);
+		first = i + 1;
+	}
+
+	if (st->min <= st->max)
+		st->range = (u64) st->max - st->min + 1;
+
+	st->simulated = st->range && st->range <= MAX_RANGE;
+	if (st->simulated)
+		st->misses = indices_simulate_cache(indices, type, st->count,
+						    st->min, st->range,
+						    &st->unique);
+
+	return true;
+}
+
+static void
+indices_add_totals(const struct indices_stats *st)
+{
+	pthread_mutex_lock(&totals_lock);
+	totals.draws++;
+	totals.indices += st->count;
+	totals.degenerate += st->degenerate;
+	if (st->simulated) {
+		totals.triangles += st->triangles;
+		totals.misses += st->misses;
+		totals.unique += st->unique;
+		totals.range += st->range;
+	}
+	pthread_mutex_unlock(&totals_lock);
+}
+
+/**
+ * Log the index buffer of an indexed tiler job, along with how well it uses
+ * the vertex cache.
+ */
+void
+panwrap_indices_log(const struct mali_payload_vertex_tiler_unpacked *vu)
+{
+	unsigned int size = 1 << (vu->index_type - 1);
+	struct indices_stats st;
+
+	if (!panwrap_indices_size(vu))
+		return;
+
+	if (!indices_analyse(vu, &st)) {
+		panwrap_log("Index buffer @ " MALI_PTR_FORMAT " (%" PRIu64 " bytes) isn't mapped\n",
+			    (mali_ptr) vu->indices, st.count * size);
+		return;
+	}
+
+	panwrap_log("%" PRIu64 " %u-bit indices @ " MALI_PTR_FORMAT,
+		    st.count, size * 8, (mali_ptr) vu->indices);
+	if (st.range)
+		panwrap_log_cont(", range %u-%u", st.min, st.max);
+	if (st.restarts)
+		panwrap_log_cont(", %" PRIu64 " primitive restart%s",
+				 st.restarts, st.restarts == 1 ? "" : "s");
+	panwrap_log_cont("\n");
+	panwrap_indent++;
+
+	if (!st.range) {
+		/* Nothing but restarts */
+	} else if (!st.simulated) {
+		panwrap_log("Range of %" PRIu64 " vertices is too large to simulate the vertex cache\n",
+			    st.range);
+	} else {
+		panwrap_log("%" PRIu64 " unique vertices (%.0f%% of the range)",
+			    st.unique, 100.0 * st.unique / st.range);
+		if (st.triangles)
+			panwrap_log_cont(", ACMR %.3f, ATVR %.3f with a %u entry FIFO cache",
+					 (double) st.misses / st.triangles,
+					 (double) st.misses / MAX(st.unique, 1),
+					 cache_size);
+		panwrap_log_cont("\n");
+
+		if ((double) st.unique / st.range < POOR_RANGE_USE)
+			panwrap_log("%" PRIu64 " vertices in the range aren't referenced, but get shaded anyway\n",
+				    st.range - st.unique);
+		if (st.triangles &&
+		    (double) st.misses / MAX(st.unique, 1) > POOR_ATVR)
+			panwrap_log("Each vertex gets transformed %.1f times on average, reordering the indices for the vertex cache would help\n",
+				    (double) st.misses / MAX(st.unique, 1));
+	}
+
+	if (st.degenerate)
+		panwrap_log("%" PRIu64 " of %" PRIu64 " triangles are degenerate\n",
+			    st.degenerate, st.triangles);
+
+	panwrap_indent--;
+
+	indices_add_totals(&st);
+}
+
+static void __attribute__((constructor))
+panwrap_indices_init()
+{
+	cache_size = MIN(MAX(panwrap_parse_env_long("PANWRAP_VERTEX_CACHE", 16),
+			     1), MAX_CACHE_SIZE);
+}
+
+static void __attribute__((destructor))
+panwrap_indices_fini()
+{
+	if (!totals.draws)
+		return;
+
+	panwrap_log("Index buffers: %" PRIu64 " indexed draws, %" PRIu64 " indices, %" PRIu64 " unique vertices out of %" PRIu64 " in their ranges",
+		    totals.draws, totals.indices, totals.unique, totals.range);
+	if (totals.triangles)
+		panwrap_log_cont(", ACMR %.3f, ATVR %.3f, %" PRIu64 " degenerate triangles",
+				 (double) totals.misses / totals.triangles,
+				 (double) totals.misses / MAX(totals.unique, 1),
+				 totals.degenerate);
+	panwrap_log_cont("\n");
+	panwrap_log_flush();
+}
@@ -0,0 +1,234 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * JIT memory accounting
+ *
+ * JIT_ALLOC soft jobs get the kernel to allocate GPU memory for the jobs that
+ * depend on them, and JIT_FREE soft jobs give it back. The kernel doesn't
+ * actually free it though: freed regions go into a per-context pool, and later
+ * allocations take the pooled region that's large enough and closest in
+ * committed size, growing its backing if needed. Only when nothing in the
+ * pool fits does it make a fresh allocation, which is the slow path.
+ *
+ * We can't see the kernel's pool, so we follow the same rules on each
+ * context's JIT atoms to work out which allocations were likely reused and
+ * which were fresh, along with how much memory is live and pooled. Fresh
+ * allocations should stop once an app reaches a steady state, so we count
+ * them per frame (a frame ending with each fragment atom, like in
+ * panwrap-timeline.c), and point out the ones made while the pool wasn't
+ * empty.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "panwrap.h"
+
+static void
+jit_update_peaks(struct panwrap_jit *jit)
+{
+	jit->peak_live_pages = MAX(jit->peak_live_pages, jit->live_pages);
+	jit->peak_pages = MAX(jit->peak_pages,
+			      jit->live_pages + jit->pool_pages);
+	jit->peak_va_pages = MAX(jit->peak_va_pages, jit->va_pages);
+}
+
+/* Index of the pooled region the kernel would pick for info, or -1 */
+static int
+jit_pool_find(const struct panwrap_jit *jit,
+	      const struct mali_jd_jit_alloc_info *info)
+{
+	u64 best_diff = ~0ull;
+	int best = -1;
+
+	for (int i = 0; i < jit->pool_count; i++) {
+		const struct panwrap_jit_region *r = &jit->pool[i];
+		u64 diff;
+
+		if (r->va_pages < info->va_pages)
+			continue;
+
+		diff = MAX(r->commit_pages, info->commit_pages) -
+			MIN(r->commit_pages, info->commit_pages);
+		if (diff < best_diff) {
+			best_diff = diff;
+			best = i;
+		}
+		if (!diff)
+			break;
+	}
+
+	return best;
+}
+
+static void
+jit_alloc(struct panwrap_jit *jit, const struct mali_jd_jit_alloc_info *info)
+{
+	struct panwrap_jit_region *r = &jit->regions[info->id];
+	int p;
+
+	jit->allocs++;
+
+	if (!info->id || jit->live[info->id]) {
+		panwrap_log("JIT allocation #%u is %s\n", info->id,
+			    info->id ? "still live, it needs a JIT_FREE first" :
+			    "invalid, ids start at 1");
+		jit->bad_allocs++;
+		return;
+	}
+
+	p = jit_pool_find(jit, info);
+	if (p >= 0) {
+		*r = jit->pool[p];
+		jit->pool[p] = jit->pool[--jit->pool_count];
+		jit->pool_pages -= r->commit_pages;
+		jit->reused++;
+
+		if (r->commit_pages < info->commit_pages) {
+			jit->grown++;
+			jit->grown_pages += info->commit_pages - r->commit_pages;
+			r->commit_pages = info->commit_pages;
+		}
+	} else {
+		if (jit->pool_count)
+			panwrap_log("Fresh JIT allocation #%u of %" PRIu64 " pages, none of the %d pooled regions have that many\n",
+				    info->id, info->va_pages, jit->pool_count);
+
+		r->va_pages = info->va_pages;
+		r->commit_pages = info->commit_pages;
+		jit->va_pages += r->va_pages;
+		jit->fresh++;
+		jit->fresh_pages += r->commit_pages;
+		jit->frame_fresh++;
+	}
+
+	jit->live[info->id] = true;
+	jit->live_pages += r->commit_pages;
+	jit_update_peaks(jit);
+}
+
+static void
+jit_free(struct panwrap_jit *jit, u8 id)
+{
+	struct panwrap_jit_region *r = &jit->regions[id];
+
+	jit->frees++;
+
+	if (!jit->live[id]) {
+		panwrap_log("JIT_FREE of allocation #%u, which isn't live\n", id);
+		jit->bad_frees++;
+		return;
+	}
+
+	jit->live[id] = false;
+	jit->live_pages -= r->commit_pages;
+
+	/* The kernel's pool isn't bounded, but ours is */
+	if (jit->pool_count == PANWRAP_JIT_POOL_MAX) {
+		jit->va_pages -= r->va_pages;
+		return;
+	}
+
+	jit->pool[jit->pool_count++] = *r;
+	jit->pool_pages += r->commit_pages;
+}
+
+static void
+jit_end_frame(struct panwrap_jit *jit)
+{
+	if (!jit->frame_active)
+		return;
+
+	jit->frames++;
+	if (jit->frame_fresh)
+		jit->frames_with_fresh++;
+	jit->max_frame_fresh = MAX(jit->max_frame_fresh, jit->frame_fresh);
+
+	jit->frame_fresh = 0;
+	jit->frame_active = false;
+}
+
+void
+panwrap_jit_init_zone(struct panwrap_context *ctx, u64 va_pages)
+{
+	if (ctx)
+		ctx->jit.zone_pages = va_pages;
+}
+
+void
+panwrap_jit_submit(struct panwrap_context *ctx,
+		   const struct mali_ioctl_job_submit *args)
+{
+	struct panwrap_jit *jit = &ctx->jit;
+	const struct mali_jd_atom_v2 *atoms = args->addr;
+
+	if (args->stride != sizeof(*atoms))
+		return;
+
+	for (int i = 0; i < args->nr_atoms; i++) {
+		const struct mali_jd_atom_v2 *a = &atoms[i];
+		const struct mali_jd_jit_alloc_info *info;
+
+		switch (a->core_req & MALI_JD_REQ_SOFT_JOB_TYPE) {
+		case MALI_JD_REQ_SOFT_JIT_ALLOC:
+			info = (const void *) (uintptr_t) a->jc;
+			if (info)
+				jit_alloc(jit, info);
+			jit->frame_active = true;
+			break;
+		case MALI_JD_REQ_SOFT_JIT_FREE:
+			jit_free(jit, a->jc & 0xFF);
+			break;
+		default:
+			if (!(a->core_req & MALI_JD_REQ_SOFT_JOB) &&
+			    (a->core_req & MALI_JD_REQ_FS))
+				jit_end_frame(jit);
+			break;
+		}
+	}
+}
+
+void
+panwrap_jit_log_stats(const struct panwrap_context *ctx)
+{
+	const struct panwrap_jit *jit = &ctx->jit;
+
+	if (!jit->allocs)
+		return;
+
+	panwrap_log("JIT memory on context %u: %" PRIu64 " allocations, %" PRIu64 " likely reused from the pool (%" PRIu64 " grown by %" PRIu64 " pages), %" PRIu64 " fresh (%" PRIu64 " pages), %" PRIu64 " frees\n",
+		    ctx->id, jit->allocs, jit->reused, jit->grown,
+		    jit->grown_pages, jit->fresh, jit->fresh_pages, jit->frees);
+	panwrap_indent++;
+
+	panwrap_log("Peak %" PRIu64 " pages live, %" PRIu64 " pages including the pool, %" PRIu64 " pages of address space",
+		    jit->peak_live_pages, jit->peak_pages, jit->peak_va_pages);
+	if (jit->zone_pages)
+		panwrap_log_cont(" (%.1f%% of the %" PRIu64 " page JIT zone)",
+				 100.0 * jit->peak_va_pages / jit->zone_pages,
+				 jit->zone_pages);
+	panwrap_log_cont("\n");
+
+	if (jit->frames)
+		panwrap_log("Fresh allocations in %" PRIu64 " of the %" PRIu64 " frames using JIT memory, at most %u in one frame\n",
+			    jit->frames_with_fresh, jit->frames,
+			    jit->max_frame_fresh);
+
+	if (jit->bad_allocs || jit->bad_frees)
+		panwrap_log("%" PRIu64 " allocations of ids already in use, %" PRIu64 " frees of ids that weren't\n",
+			    jit->bad_allocs, jit->bad_frees);
+
+	panwrap_indent--;
+}
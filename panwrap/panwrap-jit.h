@@ -0,0 +1,70 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_JIT_H__
+#define __PANWRAP_JIT_H__
+
+#include <stdbool.h>
+#include <mali-ioctl.h>
+
+struct panwrap_context;
+
+/* JIT ids are a u8, with 0 meaning none */
+#define PANWRAP_JIT_IDS 256
+#define PANWRAP_JIT_POOL_MAX 256
+
+struct panwrap_jit_region {
+	u64 va_pages;
+	u64 commit_pages;
+};
+
+/* Our model of a context's JIT memory, see panwrap-jit.c */
+struct panwrap_jit {
+	u64 zone_pages;
+
+	bool live[PANWRAP_JIT_IDS];
+	struct panwrap_jit_region regions[PANWRAP_JIT_IDS];
+	struct panwrap_jit_region pool[PANWRAP_JIT_POOL_MAX];
+	int pool_count;
+
+	u64 live_pages;
+	u64 pool_pages;
+	u64 va_pages;
+	u64 peak_live_pages;
+	u64 peak_pages;
+	u64 peak_va_pages;
+
+	u64 allocs;
+	u64 reused;
+	u64 grown;
+	u64 grown_pages;
+	u64 fresh;
+	u64 fresh_pages;
+	u64 frees;
+	u64 bad_allocs;
+	u64 bad_frees;
+
+	unsigned int frame_fresh;
+	bool frame_active;
+	u64 frames;
+	u64 frames_with_fresh;
+	unsigned int max_frame_fresh;
+};
+
+void panwrap_jit_init_zone(struct panwrap_context *ctx, u64 va_pages);
+void panwrap_jit_submit(struct panwrap_context *ctx,
+			const struct mali_ioctl_job_submit *args);
+void panwrap_jit_log_stats(const struct panwrap_context *ctx);
+
+#endif /* __PANWRAP_JIT_H__ */
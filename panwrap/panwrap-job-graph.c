@@ -0,0 +1,347 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Job chain dependency graphs
+ *
+ * Within a chain, a job can wait on up to two other jobs by their job_index,
+ * and a job with job_barrier set waits for every job before it in the chain.
+ * Everything else is free to run in parallel. After a chain's been decoded,
+ * we build its dependency graph and log:
+ *
+ *  - The critical path, the longest sequence of jobs that have to run one
+ *    after another, and the parallelism that leaves (jobs / critical path).
+ *  - Barriers that don't do anything, because the job's own dependencies
+ *    already wait on every earlier job.
+ *  - Runs of three or more jobs that each wait on the one right before them.
+ *  - Dependencies on jobs that aren't in the chain, or come later in it.
+ *
+ * With PANWRAP_JOB_GRAPH=path, every graph also gets written to that file, in
+ * Graphviz DOT by default, or one JSON object per line with
+ * PANWRAP_JOB_GRAPH_FORMAT=json.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "panwrap.h"
+
+struct job_graph {
+	mali_ptr jc;
+	const struct panwrap_job_node *jobs;
+	int count;
+
+	/* Positions in the chain of each job's dependencies, or -1 */
+	int (*preds)[2];
+
+	/* Bitsets of everything each job waits on, directly or not */
+	u64 *ancestors;
+	int words;
+
+	int *depth;
+	int *parent;
+	bool *critical;
+	bool *unneeded_barrier;
+
+	int critical_length;
+	int dependencies;
+	int barriers;
+};
+
+static FILE *graph_file;
+static bool graph_json;
+static unsigned int graph_count;
+static pthread_mutex_t graph_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define ANCESTORS(g, i) (&(g)->ancestors[(i) * (g)->words])
+
+static void
+bit_set(u64 *set, int bit)
+{
+	set[bit / 64] |= 1ull << (bit % 64);
+}
+
+static void
+bits_set_below(u64 *set, int count)
+{
+	for (int i = 0; i < count / 64; i++)
+		set[i] = ~0ull;
+	if (count % 64)
+		set[count / 64] |= (1ull << (count % 64)) - 1;
+}
+
+static bool
+bits_all_below(const u64 *set, int count)
+{
+	for (int i = 0; i < count / 64; i++) {
+		if (set[i] != ~0ull)
+			return false;
+	}
+
+	return !(count % 64) ||
+		(set[count / 64] & ((1ull << (count % 64)) - 1)) ==
+		(1ull << (count % 64)) - 1;
+}
+
+static void
+job_graph_resolve(struct job_graph *g)
+{
+	for (int i = 0; i < g->count; i++) {
+		const struct panwrap_job_node *job = &g->jobs[i];
+
+		for (int d = 0; d < ARRAY_SIZE(job->deps); d++) {
+			int p;
+
+			g->preds[i][d] = -1;
+			if (!job->deps[d])
+				continue;
+
+			for (p = 0; p < g->count && g->jobs[p].index != job->deps[d]; p++);
+
+			if (p == g->count) {
+				panwrap_log("Job %d depends on job index %hX, which isn't in the chain\n",
+					    i, job->deps[d]);
+			} else if (p >= i) {
+				panwrap_log("Job %d depends on job %d, which doesn't come before it in the chain\n",
+					    i, p);
+			} else {
+				g->preds[i][d] = p;
+				g->dependencies++;
+			}
+		}
+	}
+}
+
+/*
+ * Since every dependency we accept points backwards in the chain, the chain
+ * order is already a topological order of the graph.
+ */
+static void
+job_graph_walk(struct job_graph *g)
+{
+	int deepest = -1;
+
+	for (int i = 0; i < g->count; i++) {
+		u64 *anc = ANCESTORS(g, i);
+
+		g->depth[i] = 1;
+		g->parent[i] = -1;
+
+		for (int d = 0; d < 2; d++) {
+			int p = g->preds[i][d];
+
+			if (p < 0)
+				continue;
+
+			for (int w = 0; w < g->words; w++)
+				anc[w] |= ANCESTORS(g, p)[w];
+			bit_set(anc, p);
+
+			if (g->depth[p] + 1 > g->depth[i]) {
+				g->depth[i] = g->depth[p] + 1;
+				g->parent[i] = p;
+			}
+		}
+
+		if (g->jobs[i].barrier) {
+			g->barriers++;
+
+			/* Waiting on everything before us is a given already */
+			if (bits_all_below(anc, i))
+				g->unneeded_barrier[i] = true;
+
+			bits_set_below(anc, i);
+			if (deepest >= 0 && g->depth[deepest] + 1 > g->depth[i]) {
+				g->depth[i] = g->depth[deepest] + 1;
+				g->parent[i] = deepest;
+			}
+		}
+
+		if (deepest < 0 || g->depth[i] > g->depth[deepest])
+			deepest = i;
+	}
+
+	g->critical_length = g->depth[deepest];
+	for (int i = deepest; i >= 0; i = g->parent[i])
+		g->critical[i] = true;
+}
+
+static bool
+job_waits_on_previous(const struct job_graph *g, int i)
+{
+	return g->jobs[i].barrier || g->preds[i][0] == i - 1 ||
+		g->preds[i][1] == i - 1;
+}
+
+static void
+job_graph_log(const struct job_graph *g)
+{
+	panwrap_log("Dependency graph: %d dependencies, %d barriers, critical path %d job%s, parallelism %.2f\n",
+		    g->dependencies, g->barriers, g->critical_length,
+		    g->critical_length == 1 ? "" : "s",
+		    (double) g->count / g->critical_length);
+
+	panwrap_indent++;
+
+	panwrap_log("Critical path:");
+	for (int i = 0; i < g->count; i++) {
+		if (g->critical[i])
+			panwrap_log_cont(" %d (%s)", i,
+					 panwrap_job_type_name(g->jobs[i].type));
+	}
+	panwrap_log_cont("\n");
+
+	for (int i = 0; i < g->count; i++) {
+		if (g->unneeded_barrier[i])
+			panwrap_log("Job %d has a barrier it doesn't need, it already waits on every earlier job\n",
+				    i);
+	}
+
+	for (int i = 1, start = 0; i <= g->count; i++) {
+		if (i < g->count && job_waits_on_previous(g, i))
+			continue;
+
+		if (i - start >= 3) {
+			panwrap_log("Jobs %d-%d each wait on the one before:",
+				    start, i - 1);
+			for (int j = start; j < i; j++)
+				panwrap_log_cont(" %s",
+						 panwrap_job_type_name(g->jobs[j].type));
+			panwrap_log_cont("\n");
+		}
+		start = i;
+	}
+
+	panwrap_indent--;
+}
+
+static void
+job_graph_write_dot(const struct job_graph *g, unsigned int id)
+{
+	FILE *f = graph_file;
+
+	fprintf(f, "digraph chain%u {\n", id);
+	fprintf(f, "\tlabel=\"Job chain " MALI_PTR_FORMAT "\";\n", g->jc);
+
+	for (int i = 0; i < g->count; i++) {
+		fprintf(f, "\tjob%d [label=\"%d: %s\\nindex %hX\"%s%s];\n",
+			i, i, panwrap_job_type_name(g->jobs[i].type),
+			g->jobs[i].index,
+			g->critical[i] ? ", color=red" : "",
+			g->unneeded_barrier[i] ? ", style=dashed" : "");
+
+		for (int d = 0; d < 2; d++) {
+			if (g->preds[i][d] >= 0)
+				fprintf(f, "\tjob%d -> job%d;\n",
+					g->preds[i][d], i);
+		}
+
+		if (g->jobs[i].barrier && i)
+			fprintf(f, "\tjob%d -> job%d [style=dashed, label=\"barrier\"];\n",
+				i - 1, i);
+	}
+
+	fprintf(f, "}\n");
+}
+
+static void
+job_graph_write_json(const struct job_graph *g, unsigned int id)
+{
+	FILE *f = graph_file;
+
+	fprintf(f, "{\"chain\": %u, \"jc\": \"" MALI_PTR_FORMAT "\", \"jobs\": [",
+		id, g->jc);
+	for (int i = 0; i < g->count; i++) {
+		const struct panwrap_job_node *job = &g->jobs[i];
+
+		fprintf(f, "%s{\"type\": \"%s\", \"index\": %u, \"deps\": [",
+			i ? ", " : "", panwrap_job_type_name(job->type),
+			job->index);
+		for (int d = 0, first = 1; d < 2; d++) {
+			if (g->preds[i][d] < 0)
+				continue;
+			fprintf(f, "%s%d", first ? "" : ", ", g->preds[i][d]);
+			first = 0;
+		}
+		fprintf(f, "], \"barrier\": %s, \"unneeded_barrier\": %s, \"critical\": %s}",
+			job->barrier ? "true" : "false",
+			g->unneeded_barrier[i] ? "true" : "false",
+			g->critical[i] ? "true" : "false");
+	}
+	fprintf(f, "], \"critical_path_length\": %d, \"parallelism\": %.3f}\n",
+		g->critical_length, (double) g->count / g->critical_length);
+}
+
+void
+panwrap_job_graph_analyze(mali_ptr jc, const struct panwrap_job_node *jobs,
+			  int count)
+{
+	struct job_graph g = {
+		.jc = jc,
+		.jobs = jobs,
+		.count = count,
+		.words = (count + 63) / 64,
+	};
+
+	if (!count)
+		return;
+
+	g.preds = calloc(count, sizeof(*g.preds));
+	g.ancestors = calloc(count * g.words, sizeof(*g.ancestors));
+	g.depth = calloc(count, sizeof(*g.depth));
+	g.parent = calloc(count, sizeof(*g.parent));
+	g.critical = calloc(count, sizeof(*g.critical));
+	g.unneeded_barrier = calloc(count, sizeof(*g.unneeded_barrier));
+
+	job_graph_resolve(&g);
+	job_graph_walk(&g);
+	job_graph_log(&g);
+
+	if (graph_file) {
+		pthread_mutex_lock(&graph_lock);
+		if (graph_json)
+			job_graph_write_json(&g, graph_count++);
+		else
+			job_graph_write_dot(&g, graph_count++);
+		fflush(graph_file);
+		pthread_mutex_unlock(&graph_lock);
+	}
+
+	free(g.preds);
+	free(g.ancestors);
+	free(g.depth);
+	free(g.parent);
+	free(g.critical);
+	free(g.unneeded_barrier);
+}
+
+static void __attribute__((constructor))
+panwrap_job_graph_init()
+{
+	const char *path = getenv("PANWRAP_JOB_GRAPH");
+	const char *format = getenv("PANWRAP_JOB_GRAPH_FORMAT");
+
+	if (!path)
+		return;
+
+	graph_json = format && strcmp(format, "json") == 0;
+
+	graph_file = fopen(path, "w");
+	if (!graph_file)
+		panwrap_log("Failed to open %s for writing job graphs: %s\n",
+			    path, strerror(errno));
+}
@@ -0,0 +1,34 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_JOB_GRAPH_H__
+#define __PANWRAP_JOB_GRAPH_H__
+
+#include <stdbool.h>
+#include <mali-ioctl.h>
+#include <mali-job.h>
+
+/* One job in a chain, as far as scheduling it is concerned */
+struct panwrap_job_node {
+	mali_ptr gpu_va;
+	enum mali_job_type type;
+	u16 index;
+	u16 deps[2];
+	bool barrier;
+};
+
+void panwrap_job_graph_analyze(mali_ptr jc,
+			       const struct panwrap_job_node *jobs, int count);
+
+#endif /* __PANWRAP_JOB_GRAPH_H__ */
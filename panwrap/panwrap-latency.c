@@ -0,0 +1,359 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Kernel latency histograms
+ *
+ * With PANWRAP_LATENCY_HISTOGRAMS=1, we keep a histogram of how long the kernel
+ * takes to handle each type of ioctl. SYNC is further split up by the size of
+ * the sync, and JOB_SUBMIT by the number of atoms, both rounded up to a power
+ * of two. The histograms get logged as a table at exit, or whenever we get
+ * PANWRAP_LATENCY_SIGNAL (SIGUSR1 by default). If PANWRAP_LATENCY_JSON is set
+ * to a path, they also get written there in JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <mali-ioctl.h>
+#include "panwrap.h"
+
+#define SUB_BITS PANWRAP_HISTOGRAM_SUB_BITS
+#define SUB_MASK ((1 << SUB_BITS) - 1)
+
+#define SIZE_CLASSES 33
+#define ATOM_CLASSES 17
+
+struct latency_series {
+	const char *name;
+	char split[32];
+	struct panwrap_histogram hist;
+};
+
+struct json_output {
+	FILE *f;
+	unsigned int count;
+};
+
+static bool enabled;
+static const char *json_path;
+static int dump_signal;
+static struct sigaction old_action;
+static volatile sig_atomic_t dump_requested;
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct latency_series *by_ioctl[MALI_IOCTL_TYPE_COUNT][256];
+static struct latency_series *sync_by_size[SIZE_CLASSES];
+static struct latency_series *submit_by_atoms[ATOM_CLASSES];
+
+static inline unsigned int
+histogram_bucket(u64 value)
+{
+	unsigned int msb;
+
+	if (value <= SUB_MASK)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+
+	return ((msb - SUB_BITS + 1) << SUB_BITS) |
+	       ((value >> (msb - SUB_BITS)) & SUB_MASK);
+}
+
+u64
+panwrap_histogram_bucket_start(unsigned int bucket)
+{
+	unsigned int msb;
+
+	if (bucket <= SUB_MASK)
+		return bucket;
+
+	msb = (bucket >> SUB_BITS) + SUB_BITS - 1;
+
+	return (1ULL << msb) | ((u64)(bucket & SUB_MASK) << (msb - SUB_BITS));
+}
+
+void
+panwrap_histogram_record(struct panwrap_histogram *h, u64 value)
+{
+	if (!h->count || value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+
+	h->count++;
+	h->sum += value;
+	h->buckets[histogram_bucket(value)]++;
+}
+
+/**
+ * Returns the start of the bucket containing the given percentile, clamped to
+ * the actual min and max that were recorded
+ */
+u64
+panwrap_histogram_percentile(const struct panwrap_histogram *h,
+			     double percentile)
+{
+	u64 target = h->count * percentile / 100.0, seen = 0;
+
+	for (unsigned int i = 0; i < PANWRAP_HISTOGRAM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > target) {
+			return MIN(MAX(panwrap_histogram_bucket_start(i),
+				       h->min), h->max);
+		}
+	}
+
+	return h->max;
+}
+
+/* Rounds up to the next power of two, and returns its log2 */
+static inline unsigned int
+log2_class(u64 value)
+{
+	return value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+}
+
+/* Label a class out of classes, the last of which takes everything larger */
+static void
+class_split(char *split, size_t size, const char *what, unsigned int class,
+	    unsigned int classes)
+{
+	if (class == classes - 1)
+		snprintf(split, size, "%s > %llu", what, 1ULL << (class - 1));
+	else
+		snprintf(split, size, "%s <= %llu", what, 1ULL << class);
+}
+
+static struct latency_series *
+series_get(struct latency_series **slot, const char *name, const char *split)
+{
+	if (!*slot) {
+		*slot = calloc(1, sizeof(**slot));
+		(*slot)->name = name;
+		snprintf((*slot)->split, sizeof((*slot)->split), "%s", split);
+	}
+
+	return *slot;
+}
+
+void
+panwrap_latency_record(unsigned long int request, const char *name,
+		       const void *ptr, u64 ns)
+{
+	unsigned int type = _IOC_TYPE(request) - MALI_IOCTL_TYPE_BASE;
+	struct latency_series *series;
+	char split[32];
+
+	if (!enabled || type >= MALI_IOCTL_TYPE_COUNT)
+		return;
+
+	pthread_mutex_lock(&latency_lock);
+
+	series = series_get(&by_ioctl[type][_IOC_NR(request)], name, "");
+	panwrap_histogram_record(&series->hist, ns);
+
+	if (!ptr) {
+		/* Nothing to split up by */
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_SYNC)) {
+		const struct mali_ioctl_sync *args = ptr;
+		unsigned int class = MIN(log2_class(args->size),
+					 SIZE_CLASSES - 1);
+
+		class_split(split, sizeof(split), "size", class, SIZE_CLASSES);
+		series = series_get(&sync_by_size[class], name, split);
+		panwrap_histogram_record(&series->hist, ns);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		const struct mali_ioctl_job_submit *args = ptr;
+		unsigned int class = MIN(log2_class(args->nr_atoms),
+					 ATOM_CLASSES - 1);
+
+		class_split(split, sizeof(split), "atoms", class,
+			    ATOM_CLASSES);
+		series = series_get(&submit_by_atoms[class], name, split);
+		panwrap_histogram_record(&series->hist, ns);
+	}
+
+	pthread_mutex_unlock(&latency_lock);
+}
+
+static void
+latency_for_each_series(void (*func)(const struct latency_series *, void *),
+			void *data)
+{
+	for (int i = 0; i < MALI_IOCTL_TYPE_COUNT; i++) {
+		for (int j = 0; j < ARRAY_SIZE(by_ioctl[i]); j++) {
+			if (by_ioctl[i][j])
+				func(by_ioctl[i][j], data);
+		}
+	}
+
+	for (int i = 0; i < SIZE_CLASSES; i++) {
+		if (sync_by_size[i])
+			func(sync_by_size[i], data);
+	}
+
+	for (int i = 0; i < ATOM_CLASSES; i++) {
+		if (submit_by_atoms[i])
+			func(submit_by_atoms[i], data);
+	}
+}
+
+static void
+latency_log_series(const struct latency_series *s, void *data)
+{
+	const struct panwrap_histogram *h = &s->hist;
+
+	panwrap_log("%-20s %-16s %8" PRIu64 " %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		    s->name, s->split, h->count,
+		    h->min / 1000.0,
+		    panwrap_histogram_percentile(h, 50) / 1000.0,
+		    panwrap_histogram_percentile(h, 90) / 1000.0,
+		    panwrap_histogram_percentile(h, 99) / 1000.0,
+		    panwrap_histogram_percentile(h, 99.9) / 1000.0,
+		    h->max / 1000.0);
+}
+
+static void
+latency_write_json_series(const struct latency_series *s, void *data)
+{
+	const struct panwrap_histogram *h = &s->hist;
+	struct json_output *out = data;
+	FILE *f = out->f;
+	bool first = true;
+
+	fprintf(f, "%s\n    {\"ioctl\": \"%s\", \"split\": \"%s\", "
+		"\"count\": %" PRIu64 ", \"sum_ns\": %" PRIu64 ", "
+		"\"min_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 ", "
+		"\"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", "
+		"\"p99_ns\": %" PRIu64 ", \"p999_ns\": %" PRIu64 ",\n"
+		"     \"buckets\": [",
+		out->count++ ? "," : "",
+		s->name, s->split, h->count, h->sum, h->min, h->max,
+		panwrap_histogram_percentile(h, 50),
+		panwrap_histogram_percentile(h, 90),
+		panwrap_histogram_percentile(h, 99),
+		panwrap_histogram_percentile(h, 99.9));
+
+	for (unsigned int i = 0; i < PANWRAP_HISTOGRAM_BUCKETS; i++) {
+		if (!h->buckets[i])
+			continue;
+
+		fprintf(f, "%s[%" PRIu64 ", %u]", first ? "" : ", ",
+			panwrap_histogram_bucket_start(i), h->buckets[i]);
+		first = false;
+	}
+
+	fprintf(f, "]}");
+}
+
+static void
+latency_dump()
+{
+	struct json_output out = {};
+
+	panwrap_log("Kernel latency per ioctl (us):\n");
+	panwrap_indent++;
+	panwrap_log("%-20s %-16s %8s %10s %10s %10s %10s %10s %10s\n",
+		    "ioctl", "split", "count",
+		    "min", "p50", "p90", "p99", "p99.9", "max");
+	latency_for_each_series(latency_log_series, NULL);
+	panwrap_indent--;
+	panwrap_log_flush();
+
+	if (!json_path)
+		return;
+
+	out.f = fopen(json_path, "w");
+	if (!out.f) {
+		panwrap_log("Failed to open %s: %s\n",
+			    json_path, strerror(errno));
+		return;
+	}
+
+	fprintf(out.f, "[");
+	latency_for_each_series(latency_write_json_series, &out);
+	fprintf(out.f, "\n]\n");
+	fclose(out.f);
+}
+
+/**
+ * Dump the histograms if we've been asked to by a signal. We can't do this
+ * from the signal handler itself, so this gets called from each ioctl()
+ * instead.
+ */
+void
+panwrap_latency_check_dump()
+{
+	if (!dump_requested)
+		return;
+
+	pthread_mutex_lock(&latency_lock);
+	if (dump_requested) {
+		dump_requested = 0;
+		latency_dump();
+	}
+	pthread_mutex_unlock(&latency_lock);
+}
+
+static void
+latency_signal_handler(int sig, siginfo_t *info, void *ucontext)
+{
+	dump_requested = 1;
+
+	/* Don't break any handler the application installed before us */
+	if (old_action.sa_flags & SA_SIGINFO) {
+		if (old_action.sa_sigaction)
+			old_action.sa_sigaction(sig, info, ucontext);
+	} else if (old_action.sa_handler != SIG_DFL &&
+		   old_action.sa_handler != SIG_IGN) {
+		old_action.sa_handler(sig);
+	}
+}
+
+static void __attribute__((constructor))
+panwrap_latency_init()
+{
+	struct sigaction action = {
+		.sa_sigaction = latency_signal_handler,
+		.sa_flags = SA_SIGINFO | SA_RESTART,
+	};
+
+	enabled = panwrap_parse_env_bool("PANWRAP_LATENCY_HISTOGRAMS", false);
+	if (!enabled)
+		return;
+
+	json_path = getenv("PANWRAP_LATENCY_JSON");
+	dump_signal = panwrap_parse_env_long("PANWRAP_LATENCY_SIGNAL", SIGUSR1);
+
+	if (dump_signal) {
+		sigemptyset(&action.sa_mask);
+		if (sigaction(dump_signal, &action, &old_action)) {
+			fprintf(stderr, "Failed to install handler for signal %d: %s\n",
+				dump_signal, strerror(errno));
+			exit(1);
+		}
+	}
+}
+
+static void __attribute__((destructor))
+panwrap_latency_fini()
+{
+	if (enabled)
+		latency_dump();
+}
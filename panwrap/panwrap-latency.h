@@ -0,0 +1,44 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_LATENCY_H__
+#define __PANWRAP_LATENCY_H__
+
+#include <panloader-util.h>
+
+/* Log-bucketed histogram, with 2^PANWRAP_HISTOGRAM_SUB_BITS buckets for each
+ * power of two. This keeps every bucket within 12.5% of the values it holds,
+ * no matter how large they get. */
+#define PANWRAP_HISTOGRAM_SUB_BITS 3
+#define PANWRAP_HISTOGRAM_BUCKETS \
+	((64 - PANWRAP_HISTOGRAM_SUB_BITS + 1) << PANWRAP_HISTOGRAM_SUB_BITS)
+
+struct panwrap_histogram {
+	u64 count;
+	u64 sum;
+	u64 min;
+	u64 max;
+	u32 buckets[PANWRAP_HISTOGRAM_BUCKETS];
+};
+
+void panwrap_histogram_record(struct panwrap_histogram *h, u64 value);
+u64 panwrap_histogram_percentile(const struct panwrap_histogram *h,
+				 double percentile);
+u64 panwrap_histogram_bucket_start(unsigned int bucket);
+
+void panwrap_latency_record(unsigned long int request, const char *name,
+			    const void *ptr, u64 ns);
+void panwrap_latency_check_dump();
+
+#endif /* __PANWRAP_LATENCY_H__ */
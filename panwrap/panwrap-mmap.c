@@ -16,6 +16,7 @@
 #include <sys/mman.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <string.h>
 #include <list.h>
 
 #include <mali-ioctl.h>
@@ -23,8 +24,22 @@
 #include "panwrap.h"
 #include "panwrap-mmap.h"
 
-static LIST_HEAD(allocations);
-static LIST_HEAD(mmaps);
+static LIST_HEAD(no_mmaps);
+
+static __thread const struct panwrap_snapshot *snapshot;
+
+/* Where memory gets looked up: the snapshot in use, or the current context */
+static inline const struct list *
+current_mmaps()
+{
+	struct panwrap_context *ctx;
+
+	if (snapshot)
+		return &snapshot->mmaps;
+
+	ctx = panwrap_context_current();
+	return ctx ? &ctx->mmaps : &no_mmaps;
+}
 
 #define FLAG_INFO(flag) { flag, #flag }
 static const struct panwrap_flag_info mmap_flags_flag_info[] = {
@@ -62,17 +77,18 @@ void panwrap_track_allocation(mali_ptr addr, int flags)
 	mem->gpu_va = addr;
 	mem->flags = flags;
 
-	list_add(&mem->node, &allocations);
+	list_add(&mem->node, &panwrap_context_current()->allocations);
 }
 
 void panwrap_track_mmap(mali_ptr gpu_va, void *addr, size_t length,
 			int prot, int flags)
 {
+	struct panwrap_context *ctx = panwrap_context_current();
 	struct panwrap_mapped_memory *mapped_mem = NULL;
 	struct panwrap_allocated_memory *pos, *mem = NULL;
 
 	/* Find the pending unmapped allocation for the memory */
-	list_for_each_entry(pos, &allocations, node) {
+	list_for_each_entry(pos, &ctx->allocations, node) {
 		if (pos->gpu_va == gpu_va) {
 			mem = pos;
 			break;
@@ -91,7 +107,7 @@ void panwrap_track_mmap(mali_ptr gpu_va, void *addr, size_t length,
 		return;
 	}
 
-	mapped_mem = malloc(sizeof(*mapped_mem));
+	mapped_mem = calloc(1, sizeof(*mapped_mem));
 	list_init(&mapped_mem->node);
 	mapped_mem->gpu_va =
 		mem->flags & MALI_MEM_SAME_VA ? (mali_ptr)addr : gpu_va;
@@ -100,7 +116,10 @@ void panwrap_track_mmap(mali_ptr gpu_va, void *addr, size_t length,
 	mapped_mem->prot = prot;
 	mapped_mem->flags = mem->flags;
 
-	list_add(&mapped_mem->node, &mmaps);
+	list_add(&mapped_mem->node, &ctx->mmaps);
+	panwrap_context_add_mapping(ctx, addr);
+	if (mem->flags & MALI_MEM_SAME_VA)
+		panwrap_tiler_heap_mmap(ctx, gpu_va, mapped_mem->gpu_va);
 
 	list_del(&mem->node);
 	free(mem);
@@ -119,6 +138,7 @@ void panwrap_track_munmap(void *addr)
 		return;
 	}
 
+	panwrap_context_remove_mapping(panwrap_context_current(), addr);
 	list_del(&mapped_mem->node);
 	panwrap_log("Unmapped GPU memory at %p\n",
 		    addr);
@@ -129,7 +149,7 @@ struct panwrap_mapped_memory *panwrap_find_mapped_mem(void *addr)
 {
 	struct panwrap_mapped_memory *pos;
 
-	list_for_each_entry(pos, &mmaps, node) {
+	list_for_each_entry(pos, current_mmaps(), node) {
 		if (pos->addr == addr)
 			return pos;
 	}
@@ -141,7 +161,7 @@ struct panwrap_mapped_memory *panwrap_find_mapped_mem_containing(void *addr)
 {
 	struct panwrap_mapped_memory *pos;
 
-	list_for_each_entry(pos, &mmaps, node) {
+	list_for_each_entry(pos, current_mmaps(), node) {
 		if (addr >= pos->addr && addr <= pos->addr + pos->length)
 			return pos;
 	}
@@ -153,7 +173,7 @@ struct panwrap_mapped_memory *panwrap_find_mapped_gpu_mem(mali_ptr addr)
 {
 	struct panwrap_mapped_memory *pos;
 
-	list_for_each_entry(pos, &mmaps, node) {
+	list_for_each_entry(pos, current_mmaps(), node) {
 		if (pos->gpu_va == addr)
 			return pos;
 	}
@@ -165,7 +185,7 @@ struct panwrap_mapped_memory *panwrap_find_mapped_gpu_mem_containing(mali_ptr ad
 {
 	struct panwrap_mapped_memory *pos;
 
-	list_for_each_entry(pos, &mmaps, node) {
+	list_for_each_entry(pos, current_mmaps(), node) {
 		if (addr >= pos->gpu_va && addr <= pos->gpu_va + pos->length)
 			return pos;
 	}
@@ -173,6 +193,135 @@ struct panwrap_mapped_memory *panwrap_find_mapped_gpu_mem_containing(mali_ptr ad
 	return NULL;
 }
 
+struct panwrap_snapshot *
+panwrap_snapshot_create()
+{
+	struct panwrap_snapshot *snapshot = calloc(1, sizeof(*snapshot));
+
+	list_init(&snapshot->mmaps);
+	snapshot->size = sizeof(*snapshot);
+
+	return snapshot;
+}
+
+/**
+ * Add a copy of a mapping to the snapshot. If copy_data is false, only the
+ * information about the mapping is copied and not its contents.
+ */
+void
+panwrap_snapshot_add_mapping(struct panwrap_snapshot *snapshot,
+			     const struct panwrap_mapped_memory *mem,
+			     bool copy_data)
+{
+	struct panwrap_mapped_memory *copy = malloc(sizeof(*copy));
+
+	*copy = *mem;
+	copy->data = NULL;
+	list_init(&copy->node);
+
+	if (copy_data) {
+		copy->data = malloc(mem->length);
+		memcpy(copy->data, mem->data ?: mem->addr, mem->length);
+		snapshot->size += mem->length;
+	}
+
+	list_add(&copy->node, snapshot->mmaps.prev);
+	snapshot->size += sizeof(*copy);
+}
+
+/**
+ * Add a copy of some CPU memory that isn't necessarily tracked by us, such as
+ * the atom array passed to JOB_SUBMIT
+ */
+void
+panwrap_snapshot_add_cpu_mem(struct panwrap_snapshot *snapshot,
+			     const void *addr, size_t size)
+{
+	struct panwrap_mapped_memory mem = {
+		.length = size,
+		.addr = (void *)addr,
+	};
+
+	panwrap_snapshot_add_mapping(snapshot, &mem, true);
+}
+
+/**
+ * Add a copy of the tracked mapping that contains gpu_va to the snapshot,
+ * unless the snapshot already has it or the CPU can't read it
+ */
+void
+panwrap_snapshot_add_gpu_mem(struct panwrap_snapshot *snapshot,
+			     mali_ptr gpu_va)
+{
+	struct panwrap_mapped_memory *mem =
+		panwrap_find_mapped_gpu_mem_containing(gpu_va);
+	struct panwrap_mapped_memory *pos;
+
+	if (!mem || !(mem->prot & PROT_READ))
+		return;
+
+	list_for_each_entry(pos, &snapshot->mmaps, node) {
+		if (pos->data && pos->addr == mem->addr &&
+		    pos->gpu_va == mem->gpu_va)
+			return;
+	}
+
+	panwrap_snapshot_add_mapping(snapshot, mem, true);
+}
+
+void
+panwrap_snapshot_free(struct panwrap_snapshot *snapshot)
+{
+	struct panwrap_mapped_memory *pos, *tmp;
+
+	if (!snapshot)
+		return;
+
+	list_for_each_entry_safe(pos, tmp, &snapshot->mmaps, node) {
+		free(pos->data);
+		free(pos);
+	}
+	free(snapshot);
+}
+
+/**
+ * Make all memory lookups from the current thread use the given snapshot, or
+ * go back to the live mappings if snapshot is NULL
+ */
+void
+panwrap_snapshot_use(const struct panwrap_snapshot *s)
+{
+	snapshot = s;
+}
+
+const struct panwrap_snapshot *
+panwrap_snapshot_current()
+{
+	return snapshot;
+}
+
+/**
+ * Get a pointer to CPU memory that's safe to read from. Normally this is just
+ * addr, but when a snapshot is in use this returns the snapshot's copy of the
+ * memory, or NULL if it wasn't captured.
+ */
+const void *
+panwrap_cpu_mem(const void *addr, size_t size)
+{
+	struct panwrap_mapped_memory *pos;
+
+	if (!snapshot)
+		return addr;
+
+	list_for_each_entry(pos, &snapshot->mmaps, node) {
+		if (pos->data && addr >= pos->addr &&
+		    addr + size <= pos->addr + pos->length)
+			return pos->data + (addr - pos->addr);
+	}
+
+	return NULL;
+}
+
 void
 panwrap_assert_gpu_same(const struct panwrap_mapped_memory *mem,
 			mali_ptr gpu_va, size_t size,
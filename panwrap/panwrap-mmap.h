@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <assert.h>
+#include <stdbool.h>
 #include "panwrap.h"
 
 struct panwrap_allocated_memory {
@@ -37,9 +38,23 @@ struct panwrap_mapped_memory {
 	int prot;
         int flags;
 
+	/* A copy of the memory's contents, if this is part of a snapshot */
+	void *data;
+
 	struct list node;
 };
 
+/*
+ * A copy of tracked memory taken at a specific point in time, so that it can
+ * be decoded later on (see panwrap-deferred.c). While a snapshot is in use by
+ * a thread, all of the memory lookup functions below search the snapshot
+ * instead of the live mappings.
+ */
+struct panwrap_snapshot {
+	struct list mmaps;
+	size_t size;
+};
+
 void panwrap_track_allocation(mali_ptr gpu_va, int flags);
 void panwrap_track_mmap(mali_ptr gpu_va, void *addr, size_t length,
                         int prot, int flags);
@@ -50,6 +65,20 @@ struct panwrap_mapped_memory *panwrap_find_mapped_mem_containing(void *addr);
 struct panwrap_mapped_memory *panwrap_find_mapped_gpu_mem(mali_ptr addr);
 struct panwrap_mapped_memory *panwrap_find_mapped_gpu_mem_containing(mali_ptr addr);
 
+struct panwrap_snapshot *panwrap_snapshot_create();
+void panwrap_snapshot_add_mapping(struct panwrap_snapshot *snapshot,
+				  const struct panwrap_mapped_memory *mem,
+				  bool copy_data);
+void panwrap_snapshot_add_cpu_mem(struct panwrap_snapshot *snapshot,
+				  const void *addr, size_t size);
+void panwrap_snapshot_add_gpu_mem(struct panwrap_snapshot *snapshot,
+				  mali_ptr gpu_va);
+void panwrap_snapshot_free(struct panwrap_snapshot *snapshot);
+void panwrap_snapshot_use(const struct panwrap_snapshot *snapshot);
+const struct panwrap_snapshot *panwrap_snapshot_current();
+
+const void *panwrap_cpu_mem(const void *addr, size_t size);
+
 void panwrap_assert_gpu_same(const struct panwrap_mapped_memory *mem,
 			     mali_ptr gpu_va, size_t size,
 			     const unsigned char *data);
@@ -72,7 +101,20 @@ __panwrap_deref_gpu_mem(const struct panwrap_mapped_memory *mem,
 	if (!mem || size + (gpu_va - mem->gpu_va) > mem->length)
 		__panwrap_deref_mem_err(mem, gpu_va, size, line, filename);
 
-	return (void*)gpu_va + (ptrdiff_t)((void*)mem->gpu_va - mem->addr);
+	return (mem->data ?: mem->addr) + (gpu_va - mem->gpu_va);
+}
+
+/* Like panwrap_deref_gpu_mem(), but returns NULL for unmapped memory */
+static inline const void *
+panwrap_try_deref_gpu_mem(mali_ptr gpu_va, size_t size)
+{
+	struct panwrap_mapped_memory *mem =
+		panwrap_find_mapped_gpu_mem_containing(gpu_va);
+
+	if (!mem || size + (gpu_va - mem->gpu_va) > mem->length)
+		return NULL;
+
+	return (mem->data ?: mem->addr) + (gpu_va - mem->gpu_va);
 }
 
 #define panwrap_deref_gpu_mem(mem, gpu_va, size) \
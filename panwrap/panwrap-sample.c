@@ -0,0 +1,195 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Sampled decoding
+ *
+ * Fully decoding every single job submission in a long running application
+ * produces far more output than anyone could ever read. So instead, we can
+ * fully decode only every Nth submission (PANWRAP_SAMPLE_EVERY=N), or the
+ * first submission after every T milliseconds (PANWRAP_SAMPLE_INTERVAL_MS=T).
+ * Every other submission is only counted. The counts are logged in a summary
+ * line right before each sampled submission.
+ *
+ * SYNCs follow the submission their memory belongs to: syncs to the device
+ * upload what the next submission is going to use, so they get logged if that
+ * one is going to be sampled, and syncs to the CPU read back what the last
+ * submission wrote, so they get logged if that one was. Either way, they're
+ * counted too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mali-ioctl.h>
+#include "panwrap.h"
+
+struct sample_counters {
+	u64 submits;
+	u64 atoms;
+	u64 fragment_atoms;
+	u64 vertex_atoms;
+	u64 tiler_atoms;
+	u64 compute_atoms;
+	u64 soft_atoms;
+	u64 dep_atoms;
+	u64 syncs;
+	u64 bytes_to_device;
+	u64 bytes_to_cpu;
+};
+
+static long sample_every;
+static u64 sample_interval_ns;
+
+static u64 total_submits, last_sample_ns;
+static bool last_submit_sampled;
+static struct sample_counters counters;
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+sample_count_atoms(const struct mali_ioctl_job_submit *args)
+{
+	if (args->stride != sizeof(*args->addr))
+		return;
+
+	for (int i = 0; i < args->nr_atoms; i++) {
+		mali_jd_core_req req = args->addr[i].core_req;
+
+		counters.atoms++;
+
+		if (req & MALI_JD_REQ_SOFT_JOB) {
+			counters.soft_atoms++;
+			continue;
+		}
+		if (req & MALI_JD_REQ_ONLY_COMPUTE) {
+			counters.compute_atoms++;
+			continue;
+		}
+		if (!(req & (MALI_JD_REQ_FS | MALI_JD_REQ_CS | MALI_JD_REQ_T)))
+			counters.dep_atoms++;
+
+		counters.fragment_atoms += !!(req & MALI_JD_REQ_FS);
+		counters.vertex_atoms += !!(req & MALI_JD_REQ_CS);
+		counters.tiler_atoms += !!(req & MALI_JD_REQ_T);
+	}
+}
+
+static void
+sample_log_summary()
+{
+	panwrap_log("Since last sample: %" PRIu64 " submits, %" PRIu64 " atoms "
+		    "(FS %" PRIu64 ", CS %" PRIu64 ", T %" PRIu64 ", compute %" PRIu64 ", soft %" PRIu64 ", dep %" PRIu64 "), "
+		    "%" PRIu64 " syncs (%" PRIu64 " bytes to device, %" PRIu64 " bytes to CPU)\n",
+		    counters.submits, counters.atoms,
+		    counters.fragment_atoms, counters.vertex_atoms,
+		    counters.tiler_atoms, counters.compute_atoms,
+		    counters.soft_atoms, counters.dep_atoms,
+		    counters.syncs,
+		    counters.bytes_to_device, counters.bytes_to_cpu);
+
+	memset(&counters, 0, sizeof(counters));
+}
+
+/* Whether the next submit is going to be sampled, if it were made right now */
+static bool
+sample_next_submit(u64 now)
+{
+	if (sample_every)
+		return total_submits % sample_every == 0;
+
+	return now - last_sample_ns >= sample_interval_ns;
+}
+
+static bool
+sample_ioctl_locked(unsigned long int request, const void *ptr)
+{
+	if (IOCTL_MATCHES(request, MALI_IOCTL_SYNC)) {
+		const struct mali_ioctl_sync *args = ptr;
+
+		counters.syncs++;
+		if (args->type == MALI_SYNC_TO_DEVICE) {
+			counters.bytes_to_device += args->size;
+			return sample_next_submit(panwrap_monotonic_ns());
+		}
+
+		counters.bytes_to_cpu += args->size;
+		return last_submit_sampled;
+	}
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		u64 now = panwrap_monotonic_ns();
+		bool sample = sample_next_submit(now);
+
+		if (sample)
+			last_sample_ns = now;
+		last_submit_sampled = sample;
+
+		/* The summary shouldn't include the sampled submit itself */
+		if (sample && (counters.submits || counters.syncs))
+			sample_log_summary();
+
+		total_submits++;
+		counters.submits++;
+		sample_count_atoms(ptr);
+
+		return sample;
+	}
+
+	return true;
+}
+
+/**
+ * Decide whether or not an ioctl should be logged, and count it if it isn't.
+ * Must be called before the ioctl is made. The counts are shared between all
+ * contexts.
+ */
+bool
+panwrap_sample_ioctl(unsigned long int request, const void *ptr)
+{
+	bool ret;
+
+	if ((!sample_every && !sample_interval_ns) || !ptr)
+		return true;
+
+	pthread_mutex_lock(&sample_lock);
+	ret = sample_ioctl_locked(request, ptr);
+	pthread_mutex_unlock(&sample_lock);
+
+	return ret;
+}
+
+static void __attribute__((constructor))
+panwrap_sample_init()
+{
+	sample_every = panwrap_parse_env_long("PANWRAP_SAMPLE_EVERY", 0);
+	sample_interval_ns =
+		panwrap_parse_env_long("PANWRAP_SAMPLE_INTERVAL_MS", 0) *
+		1000000ULL;
+
+	if (sample_every < 0) {
+		fprintf(stderr, "PANWRAP_SAMPLE_EVERY must be positive\n");
+		exit(1);
+	}
+}
+
+static void __attribute__((destructor))
+panwrap_sample_fini()
+{
+	if (!counters.submits && !counters.syncs)
+		return;
+
+	sample_log_summary();
+	panwrap_log_flush();
+}
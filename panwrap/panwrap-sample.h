@@ -0,0 +1,22 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_SAMPLE_H__
+#define __PANWRAP_SAMPLE_H__
+
+#include <stdbool.h>
+
+bool panwrap_sample_ioctl(unsigned long int request, const void *ptr);
+
+#endif /* __PANWRAP_SAMPLE_H__ */
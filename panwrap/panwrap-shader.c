@@ -0,0 +1,261 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Shader store
+ *
+ * Most draws reuse a handful of shaders, so instead of dumping the shader for
+ * every job, we identify each shader binary by a hash of its contents and
+ * only dump it the first time it shows up. Jobs then just reference the
+ * hash. With PANWRAP_SHADER_DIR=dir, new shaders get written to dir/<hash>.bin
+ * instead of being hexdumped into the log.
+ *
+ * To find where a shader ends, we follow the Midgard instruction bundles: the
+ * low 4 bits of each bundle are its tag, which gives its size, and the next 4
+ * are the tag of the bundle after it. A next tag of TAG_BREAK ends the shader.
+ * If that doesn't work out, we fall back to the old fixed size with trailing
+ * zeroes trimmed off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "panwrap.h"
+
+#define SHADER_MAX_SIZE (64 * 1024)
+#define SHADER_FALLBACK_SIZE 832
+
+#define MIDGARD_TAG_BREAK 0x1
+
+/* Size of each type of Midgard bundle in quadwords, by tag */
+static const unsigned int midgard_tag_quadwords[16] = {
+	[0x2] = 1, [0x3] = 1, [0x4] = 1, /* Texture */
+	[0x5] = 1,                       /* Load/store */
+	[0x8] = 1, [0x9] = 2, [0xA] = 3, [0xB] = 4, /* ALU */
+	[0xC] = 1, [0xD] = 2, [0xE] = 3, [0xF] = 4, /* ALU + writeout */
+};
+
+static const char *shader_dir;
+
+struct shader_store_entry {
+	u64 hash;
+
+	/* The parallel decoding batch that added it, if any */
+	unsigned int batch;
+};
+
+static struct {
+	struct shader_store_entry *entries;
+	size_t size;
+	size_t count;
+
+	u64 references;
+	u64 bytes;
+} store;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t
+shader_midgard_size(const u32 *words, size_t max)
+{
+	size_t offset = 0;
+
+	while (offset + 16 <= max) {
+		u32 word = words[offset / 4];
+		unsigned int quadwords = midgard_tag_quadwords[word & 0xF];
+
+		if (!quadwords)
+			return 0;
+
+		offset += quadwords * 16;
+		if (((word >> 4) & 0xF) == MIDGARD_TAG_BREAK)
+			return offset <= max ? offset : 0;
+	}
+
+	return 0;
+}
+
+static size_t
+shader_fallback_size(const unsigned char *data, size_t max)
+{
+	size_t size = MIN(max, SHADER_FALLBACK_SIZE);
+
+	while (size && !data[size - 1])
+		size--;
+
+	return size;
+}
+
+/*
+ * Returns true if the hash wasn't in the store yet. While decoding in
+ * parallel, a shader that another atom of the same submit added counts as
+ * new too, so it gets dumped by every atom using it rather than by whichever
+ * got decoded first.
+ */
+static bool
+shader_store_add(u64 hash, size_t size)
+{
+	unsigned int batch = panwrap_workers_batch();
+	size_t i;
+
+	if (store.count * 2 >= store.size) {
+		struct shader_store_entry *old = store.entries;
+		size_t old_size = store.size;
+
+		store.size = MAX(store.size * 2, 64);
+		store.entries = calloc(store.size, sizeof(*store.entries));
+
+		for (size_t j = 0; j < old_size; j++) {
+			if (!old[j].hash)
+				continue;
+
+			for (i = old[j].hash % store.size;
+			     store.entries[i].hash; i = (i + 1) % store.size);
+			store.entries[i] = old[j];
+		}
+		free(old);
+	}
+
+	store.references++;
+
+	for (i = hash % store.size; store.entries[i].hash;
+	     i = (i + 1) % store.size) {
+		if (store.entries[i].hash == hash)
+			return batch && store.entries[i].batch == batch;
+	}
+
+	store.entries[i].hash = hash;
+	store.entries[i].batch = batch;
+	store.count++;
+	store.bytes += size;
+
+	return true;
+}
+
+static void
+shader_write(u64 hash, const void *data, size_t size)
+{
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%016" PRIx64 ".bin", shader_dir, hash);
+
+	f = fopen(path, "wb");
+	if (!f || fwrite(data, 1, size, f) != size) {
+		panwrap_log("Failed to write shader to %s: %s\n",
+			    path, strerror(errno));
+	} else {
+		panwrap_log("Written to %s\n", path);
+	}
+
+	if (f)
+		fclose(f);
+}
+
+/*
+ * Find the shader at gpu_va and hash it. The low 4 bits of a shader pointer
+ * are the tag of its first bundle. Returns 0 if the shader isn't in mapped
+ * memory.
+ */
+static u64
+shader_find(mali_ptr gpu_va, const unsigned char **data, size_t *size)
+{
+	mali_ptr addr = gpu_va & ~(mali_ptr) 0xF;
+	struct panwrap_mapped_memory *mem =
+		panwrap_find_mapped_gpu_mem_containing(addr);
+	size_t max;
+
+	if (!mem || addr >= mem->gpu_va + mem->length)
+		return 0;
+
+	max = MIN(mem->gpu_va + mem->length - addr, SHADER_MAX_SIZE);
+	*data = panwrap_deref_gpu_mem(mem, addr, max);
+
+	*size = shader_midgard_size((const u32 *) *data, max);
+	if (!*size)
+		*size = shader_fallback_size(*data, max);
+
+	/* Zero marks empty slots in the store */
+	return panwrap_hash(*data, *size, PANWRAP_HASH_INIT) ?: 1;
+}
+
+/**
+ * The hash a shader is identified by in the shader store, or 0 if it isn't
+ * in mapped memory
+ */
+u64
+panwrap_shader_hash(mali_ptr gpu_va)
+{
+	const unsigned char *data;
+	size_t size;
+
+	return shader_find(gpu_va, &data, &size);
+}
+
+/**
+ * Log a reference to the shader at gpu_va, along with the shader itself if
+ * this is the first time we've seen it.
+ */
+void
+panwrap_shader_log(mali_ptr gpu_va)
+{
+	const unsigned char *data;
+	size_t size;
+	u64 hash;
+	bool new;
+
+	hash = shader_find(gpu_va, &data, &size);
+	if (!hash) {
+		panwrap_log("Shader @ " MALI_PTR_FORMAT " isn't in mapped GPU memory\n",
+			    gpu_va);
+		return;
+	}
+
+	pthread_mutex_lock(&store_lock);
+	new = shader_store_add(hash, size);
+	pthread_mutex_unlock(&store_lock);
+
+	panwrap_log("Shader %016" PRIx64 " @ " MALI_PTR_FORMAT " (%zu bytes)%s\n",
+		    hash, gpu_va, size, new ? ", new:" : "");
+
+	if (!new)
+		return;
+
+	panwrap_indent++;
+	if (shader_dir)
+		shader_write(hash, data, size);
+	else
+		panwrap_log_hexdump(data, size);
+	panwrap_indent--;
+}
+
+static void __attribute__((constructor))
+panwrap_shader_init()
+{
+	shader_dir = getenv("PANWRAP_SHADER_DIR");
+}
+
+static void __attribute__((destructor))
+panwrap_shader_fini()
+{
+	if (!store.references)
+		return;
+
+	panwrap_log("Shader store: %zu unique shaders (%" PRIu64 " bytes), referenced %" PRIu64 " times\n",
+		    store.count, store.bytes, store.references);
+	panwrap_log_flush();
+}
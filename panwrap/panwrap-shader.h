@@ -0,0 +1,23 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_SHADER_H__
+#define __PANWRAP_SHADER_H__
+
+#include <mali-ioctl.h>
+
+u64 panwrap_shader_hash(mali_ptr gpu_va);
+void panwrap_shader_log(mali_ptr gpu_va);
+
+#endif /* __PANWRAP_SHADER_H__ */
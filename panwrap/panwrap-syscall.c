@@ -12,31 +12,82 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <linux/ioctl.h>
 #include <math.h>
 #include <sys/mman.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
 
 #include <mali-ioctl.h>
 #include <list.h>
 #include "panwrap.h"
 
-static pthread_mutex_t l = PTHREAD_MUTEX_INITIALIZER;
+enum ioctl_field_dir {
+	IOCTL_FIELD_IN    = (1 << 0),
+	IOCTL_FIELD_OUT   = (1 << 1),
+	IOCTL_FIELD_INOUT = IOCTL_FIELD_IN | IOCTL_FIELD_OUT,
+};
+
+enum ioctl_field_format {
+	IOCTL_FIELD_DEC,
+	IOCTL_FIELD_SDEC,
+	IOCTL_FIELD_HEX,
+	IOCTL_FIELD_PTR,
+	IOCTL_FIELD_FLAGS,
+	IOCTL_FIELD_ENUM,
+	IOCTL_FIELD_STR,
+	IOCTL_FIELD_HEXDUMP,
+	IOCTL_FIELD_FORMAT_COUNT
+};
 
-#define LOCK()   pthread_mutex_lock(&l)
-#define UNLOCK() pthread_mutex_unlock(&l)
+/* Describes a single member of an ioctl struct, see mali-ioctl.h */
+struct ioctl_field {
+	const char *name;
+	size_t offset;
+	size_t size;
+	enum ioctl_field_dir dir;
+	enum ioctl_field_format format;
+	const void *aux;
+};
 
-#define IOCTL_CASE(request) (_IOWR(_IOC_TYPE(request), _IOC_NR(request), \
-				   _IOC_SIZE(request)))
+typedef void (ioctl_decode_func)(unsigned long int request, void *ptr);
 
 struct ioctl_info {
 	const char *name;
+	const struct ioctl_field *fields;
+	ioctl_decode_func *pre;
+	ioctl_decode_func *post;
+
+	/* Updates our own state after the ioctl. Unlike the decoding hooks,
+	 * this always runs right away even when decoding is deferred. */
+	ioctl_decode_func *track;
+};
+
+/* An ioctl call waiting to be decoded by the deferred decoding thread */
+struct deferred_ioctl {
+	struct panwrap_deferred_item item;
+
+	unsigned long int request;
+	int ret;
+	struct panwrap_context *ctx;
+	unsigned int ctx_label;
+	struct timespec pre_time, post_time;
+	struct panwrap_snapshot *pre_snapshot, *post_snapshot;
+
+	/* The args before the ioctl, followed by the args after it */
+	size_t size;
+	unsigned char args[];
 };
 
 struct device_info {
@@ -47,69 +98,6 @@ struct device_info {
 typedef void* (mmap_func)(void *, size_t, int, int, int, off_t);
 typedef int (open_func)(const char *, int flags, ...);
 
-#define IOCTL_TYPE(type) [type - MALI_IOCTL_TYPE_BASE] =
-#define IOCTL_INFO(n) [_IOC_NR(MALI_IOCTL_##n)] = { .name = #n }
-static struct device_info mali_info = {
-	.name = "mali",
-	.info = {
-		IOCTL_TYPE(0x80) {
-			IOCTL_INFO(GET_VERSION),
-		},
-		IOCTL_TYPE(0x82) {
-			IOCTL_INFO(MEM_ALLOC),
-			IOCTL_INFO(MEM_IMPORT),
-			IOCTL_INFO(MEM_COMMIT),
-			IOCTL_INFO(MEM_QUERY),
-			IOCTL_INFO(MEM_FREE),
-			IOCTL_INFO(MEM_FLAGS_CHANGE),
-			IOCTL_INFO(MEM_ALIAS),
-			IOCTL_INFO(SYNC),
-			IOCTL_INFO(POST_TERM),
-			IOCTL_INFO(HWCNT_SETUP),
-			IOCTL_INFO(HWCNT_DUMP),
-			IOCTL_INFO(HWCNT_CLEAR),
-			IOCTL_INFO(GPU_PROPS_REG_DUMP),
-			IOCTL_INFO(FIND_CPU_OFFSET),
-			IOCTL_INFO(GET_VERSION_NEW),
-			IOCTL_INFO(SET_FLAGS),
-			IOCTL_INFO(SET_TEST_DATA),
-			IOCTL_INFO(INJECT_ERROR),
-			IOCTL_INFO(MODEL_CONTROL),
-			IOCTL_INFO(KEEP_GPU_POWERED),
-			IOCTL_INFO(FENCE_VALIDATE),
-			IOCTL_INFO(STREAM_CREATE),
-			IOCTL_INFO(GET_PROFILING_CONTROLS),
-			IOCTL_INFO(SET_PROFILING_CONTROLS),
-			IOCTL_INFO(DEBUGFS_MEM_PROFILE_ADD),
-			IOCTL_INFO(JOB_SUBMIT),
-			IOCTL_INFO(DISJOINT_QUERY),
-			IOCTL_INFO(GET_CONTEXT_ID),
-			IOCTL_INFO(TLSTREAM_ACQUIRE_V10_4),
-			IOCTL_INFO(TLSTREAM_TEST),
-			IOCTL_INFO(TLSTREAM_STATS),
-			IOCTL_INFO(TLSTREAM_FLUSH),
-			IOCTL_INFO(HWCNT_READER_SETUP),
-			IOCTL_INFO(SET_PRFCNT_VALUES),
-			IOCTL_INFO(SOFT_EVENT_UPDATE),
-			IOCTL_INFO(MEM_JIT_INIT),
-			IOCTL_INFO(TLSTREAM_ACQUIRE),
-		},
-	},
-};
-#undef IOCTL_INFO
-#undef IOCTL_TYPE
-
-static inline const struct ioctl_info *
-ioctl_get_info(unsigned long int request)
-{
-	return &mali_info.info[_IOC_TYPE(request) - MALI_IOCTL_TYPE_BASE]
-	                      [_IOC_NR(request)];
-}
-
-static int mali_fd = 0;
-static LIST_HEAD(allocations);
-static LIST_HEAD(mmaps);
-
 #define FLAG_INFO(flag) { MALI_MEM_##flag, #flag }
 static const struct panwrap_flag_info mem_flag_info[] = {
 	FLAG_INFO(PROT_CPU_RD),
@@ -153,6 +141,22 @@ static const struct panwrap_flag_info jd_req_flag_info[] = {
 };
 #undef FLAG_INFO
 
+#define ENUM_INFO(value, name) { value, name }
+static const struct panwrap_enum_info mem_import_type_enum_info[] = {
+	ENUM_INFO(MALI_MEM_IMPORT_TYPE_UMP,         "UMP"),
+	ENUM_INFO(MALI_MEM_IMPORT_TYPE_UMM,         "UMM"),
+	ENUM_INFO(MALI_MEM_IMPORT_TYPE_USER_BUFFER, "User buffer"),
+	{}
+};
+
+static const struct panwrap_enum_info mem_query_type_enum_info[] = {
+	ENUM_INFO(MALI_MEM_QUERY_COMMIT_SIZE, "Commit size"),
+	ENUM_INFO(MALI_MEM_QUERY_VA_SIZE,     "VA size"),
+	ENUM_INFO(MALI_MEM_QUERY_FLAGS,       "Flags"),
+	{}
+};
+#undef ENUM_INFO
+
 #define FLAG_INFO(flag) { flag, #flag }
 static const struct panwrap_flag_info external_resources_access_flag_info[] = {
 	FLAG_INFO(MALI_EXT_RES_ACCESS_SHARED),
@@ -255,100 +259,6 @@ ioctl_log_decoded_jd_core_req(mali_jd_core_req req)
 }
 #undef SOFT_FLAG
 
-static void
-ioctl_decode_pre_mem_alloc(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_alloc *args = ptr;
-
-	panwrap_log("va_pages = %" PRId64 "\n", args->va_pages);
-	panwrap_log("commit_pages = %" PRId64 "\n", args->commit_pages);
-	panwrap_log("extent = 0x%" PRIx64 "\n", args->extent);
-
-	panwrap_log("flags = ");
-	panwrap_log_decoded_flags(mem_flag_info, args->flags);
-	panwrap_log_cont("\n");
-}
-
-static void
-ioctl_decode_pre_mem_import(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_import *args = ptr;
-	const char *type;
-
-	switch (args->type) {
-	case MALI_MEM_IMPORT_TYPE_UMP:         type = "UMP"; break;
-	case MALI_MEM_IMPORT_TYPE_UMM:         type = "UMM"; break;
-	case MALI_MEM_IMPORT_TYPE_USER_BUFFER: type = "User buffer"; break;
-	default:                               type = "Invalid"; break;
-	}
-
-	panwrap_log("phandle = 0x%" PRIx64 "\n", args->phandle);
-	panwrap_log("type = %d (%s)\n", args->type, type);
-
-	panwrap_log("flags = ");
-	panwrap_log_decoded_flags(mem_flag_info, args->flags);
-	panwrap_log_cont("\n");
-}
-
-static void
-ioctl_decode_pre_mem_commit(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_commit *args = ptr;
-
-	panwrap_log("gpu_addr = " MALI_PTR_FORMAT "\n", args->gpu_addr);
-	panwrap_log("pages = %" PRId64 "\n", args->pages);
-}
-
-static void
-ioctl_decode_pre_mem_query(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_query *args = ptr;
-	char *query_name;
-
-	switch (args->query) {
-	case MALI_MEM_QUERY_COMMIT_SIZE: query_name = "Commit size"; break;
-	case MALI_MEM_QUERY_VA_SIZE:     query_name = "VA size"; break;
-	case MALI_MEM_QUERY_FLAGS:       query_name = "Flags"; break;
-	default:                         query_name = "???"; break;
-	}
-
-	panwrap_log("gpu_addr = " MALI_PTR_FORMAT "\n", args->gpu_addr);
-	panwrap_log("query = %d (%s)\n", args->query, query_name);
-}
-
-static void
-ioctl_decode_pre_mem_free(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_free *args = ptr;
-
-	panwrap_log("gpu_addr = " MALI_PTR_FORMAT "\n", args->gpu_addr);
-}
-
-static void
-ioctl_decode_pre_mem_flags_change(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_flags_change *args = ptr;
-
-	panwrap_log("gpu_va = " MALI_PTR_FORMAT "\n", args->gpu_va);
-	panwrap_log("flags = ");
-	panwrap_log_decoded_flags(mem_flag_info, args->flags);
-	panwrap_log_cont("\n");
-	panwrap_log("mask = 0x%" PRIx64 "\n", args->mask);
-}
-
-static void
-ioctl_decode_pre_mem_alias(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_alias *args = ptr;
-
-	panwrap_log("flags = ");
-	panwrap_log_decoded_flags(mem_flag_info, args->flags);
-	panwrap_log_cont("\n");
-	panwrap_log("stride = %" PRId64 "\n", args->stride);
-	panwrap_log("nents = %" PRId64 "\n", args->nents);
-	panwrap_log("ai = 0x%" PRIx64 "\n", args->ai);
-}
-
 static inline void
 ioctl_decode_pre_sync(unsigned long int request, void *ptr)
 {
@@ -381,226 +291,172 @@ ioctl_decode_pre_sync(unsigned long int request, void *ptr)
 	panwrap_log("type = %d (%s)\n", args->type, type);
 
 	if (args->type == MALI_SYNC_TO_DEVICE) {
+		const void *data = panwrap_cpu_mem(args->user_addr,
+						   args->size);
+
 		panwrap_log("Dumping memory being synced to device:\n");
 		panwrap_indent++;
-		panwrap_log_hexdump(args->user_addr, args->size);
+		if (data)
+			panwrap_log_hexdump(data, args->size);
+		else
+			panwrap_log("<not captured>\n");
 		panwrap_indent--;
 	}
 }
 
+/* Log one atom of a JOB_SUBMIT, called for each atom by the decode workers */
 static void
-ioctl_decode_pre_set_flags(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_set_flags *args = ptr;
-
-	panwrap_log("create_flags = %08x\n", args->create_flags);
-}
-
-static inline void
-ioctl_decode_pre_stream_create(unsigned long int request, void *ptr)
+ioctl_log_atom(void *data, int i)
 {
-	const struct mali_ioctl_stream_create *args = ptr;
-
-	panwrap_log("name = %s\n", args->name);
-}
-
-static inline void
-ioctl_decode_pre_job_submit(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_job_submit *args = ptr;
-	const struct mali_jd_atom_v2 *atoms = args->addr;
-
-	panwrap_log("addr = %p\n", args->addr);
-	panwrap_log("nr_atoms = %d\n", args->nr_atoms);
-	panwrap_log("stride = %d\n", args->stride);
-
-	/* The stride should be equivalent to the length of the structure,
-	 * if it isn't then it's possible we're somehow tracing one of the
-	 * legacy job formats
-	 */
-	if (args->stride != sizeof(*atoms)) {
-		panwrap_log("SIZE MISMATCH (stride should be %zd, was %d)\n",
-			    sizeof(*atoms), args->stride);
-		panwrap_log("Cannot dump atoms :(, maybe it's a legacy job format?\n");
-		return;
-	}
+	const struct mali_jd_atom_v2 *atoms = data;
+	const struct mali_jd_atom_v2 *a = &atoms[i];
+	const struct mali_external_resource *ext_res_list = NULL;
 
-	panwrap_log("Atoms:\n");
+	panwrap_log("jc = " MALI_PTR_FORMAT "\n", a->jc);
 	panwrap_indent++;
-	for (int i = 0; i < args->nr_atoms; i++) {
-		const struct mali_jd_atom_v2 *a = &atoms[i];
 
-		panwrap_log("jc = " MALI_PTR_FORMAT "\n", a->jc);
+	if (a->core_req & MALI_JD_REQ_SOFT_JOB) {
+		panwrap_log("Decoding soft job:\n");
 		panwrap_indent++;
-
+		panwrap_trace_soft_job(a);
+		panwrap_indent--;
+	} else {
 		panwrap_log("Decoding job chain:\n");
 		panwrap_indent++;
 		panwrap_trace_hw_chain(a->jc);
 		panwrap_indent--;
+	}
 
-		panwrap_log("udata = [0x%" PRIx64 ", 0x%" PRIx64 "]\n",
-			    a->udata.blob[0], a->udata.blob[1]);
-		panwrap_log("nr_ext_res = %d\n", a->nr_ext_res);
-
-		if (a->ext_res_list) {
-			panwrap_log("text_res_list.count = %" PRId64 "\n",
-				    a->ext_res_list->count);
-			panwrap_log("External resources:\n");
+	panwrap_log("udata = [0x%" PRIx64 ", 0x%" PRIx64 "]\n",
+		    a->udata.blob[0], a->udata.blob[1]);
+	panwrap_log("nr_ext_res = %d\n", a->nr_ext_res);
 
-			panwrap_indent++;
-			for (int j = 0; j < a->nr_ext_res; j++)
-			{
-				panwrap_log("");
-				panwrap_log_decoded_flags(
-					external_resources_access_flag_info,
-					a->ext_res_list[j].ext_resource[0]);
-				panwrap_log_cont("\n");
-			}
-			panwrap_indent--;
-		} else {
-			panwrap_log("<no external resources>\n");
-		}
+	if (a->ext_res_list) {
+		ext_res_list = panwrap_cpu_mem(
+		    a->ext_res_list,
+		    sizeof(*ext_res_list) * MAX(a->nr_ext_res, 1));
+	}
 
-		panwrap_log("compat_core_req = 0x%x\n", a->compat_core_req);
+	if (ext_res_list) {
+		panwrap_log("text_res_list.count = %" PRId64 "\n",
+			    ext_res_list->count);
+		panwrap_log("External resources:\n");
 
-		panwrap_log("Pre-dependencies:\n");
 		panwrap_indent++;
-		for (int j = 0; j < ARRAY_SIZE(a->pre_dep); j++) {
-			panwrap_log("atom_id = %d flags == ",
-				    a->pre_dep[i].atom_id);
+		for (int j = 0; j < a->nr_ext_res; j++)
+		{
+			panwrap_log("");
 			panwrap_log_decoded_flags(
-			    mali_jd_dep_type_flag_info,
-			    a->pre_dep[i].dependency_type);
+				external_resources_access_flag_info,
+				ext_res_list[j].ext_resource[0]);
 			panwrap_log_cont("\n");
 		}
 		panwrap_indent--;
+	} else {
+		panwrap_log("<no external resources>\n");
+	}
 
-		panwrap_log("atom_number = %d\n", a->atom_number);
-		panwrap_log("prio = %d (%s)\n",
-			    a->prio, ioctl_decode_jd_prio(a->prio));
-		panwrap_log("device_nr = %d\n", a->device_nr);
+	panwrap_log("compat_core_req = 0x%x\n", a->compat_core_req);
 
-		panwrap_log("Job type = %s\n",
-			    ioctl_get_job_type_from_jd_core_req(a->core_req));
-		panwrap_log("core_req = ");
-		ioctl_log_decoded_jd_core_req(a->core_req);
+	panwrap_log("Pre-dependencies:\n");
+	panwrap_indent++;
+	for (int j = 0; j < ARRAY_SIZE(a->pre_dep); j++) {
+		panwrap_log("atom_id = %d flags == ",
+			    a->pre_dep[j].atom_id);
+		panwrap_log_decoded_flags(
+		    mali_jd_dep_type_flag_info,
+		    a->pre_dep[j].dependency_type);
 		panwrap_log_cont("\n");
-
-		panwrap_indent--;
 	}
 	panwrap_indent--;
-}
 
-static void
-ioctl_decode_pre(unsigned long int request, void *ptr)
-{
-	switch (IOCTL_CASE(request)) {
-	case IOCTL_CASE(MALI_IOCTL_MEM_ALLOC):
-		ioctl_decode_pre_mem_alloc(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_IMPORT):
-		ioctl_decode_pre_mem_import(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_COMMIT):
-		ioctl_decode_pre_mem_commit(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_QUERY):
-		ioctl_decode_pre_mem_query(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_FREE):
-		ioctl_decode_pre_mem_free(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_FLAGS_CHANGE):
-		ioctl_decode_pre_mem_flags_change(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_ALIAS):
-		ioctl_decode_pre_mem_alias(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_SYNC):
-		ioctl_decode_pre_sync(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_SET_FLAGS):
-		ioctl_decode_pre_set_flags(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_STREAM_CREATE):
-		ioctl_decode_pre_stream_create(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_JOB_SUBMIT):
-		ioctl_decode_pre_job_submit(request, ptr);
-		break;
-	default:
-		break;
-	}
-}
+	panwrap_log("atom_number = %d\n", a->atom_number);
+	panwrap_log("prio = %d (%s)\n",
+		    a->prio, ioctl_decode_jd_prio(a->prio));
+	panwrap_log("device_nr = %d\n", a->device_nr);
 
-static void
-ioctl_decode_post_get_version(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_get_version *args = ptr;
+	panwrap_log("Job type = %s\n",
+		    ioctl_get_job_type_from_jd_core_req(a->core_req));
+	panwrap_log("core_req = ");
+	ioctl_log_decoded_jd_core_req(a->core_req);
+	panwrap_log_cont("\n");
 
-	panwrap_log("major = %3d\n", args->major);
-	panwrap_log("minor = %3d\n", args->minor);
+	panwrap_indent--;
 }
 
-static void
-ioctl_decode_post_mem_alloc(unsigned long int request, void *ptr)
+static inline void
+ioctl_decode_pre_job_submit(unsigned long int request, void *ptr)
 {
-	const struct mali_ioctl_mem_alloc *args = ptr;
+	const struct mali_ioctl_job_submit *args = ptr;
+	const struct mali_jd_atom_v2 *atoms;
 
-	panwrap_log("gpu_va = " MALI_PTR_FORMAT "\n", args->gpu_va);
-	panwrap_log("va_alignment = %d\n", args->va_alignment);
+	panwrap_log("addr = %p\n", args->addr);
+	panwrap_log("nr_atoms = %d\n", args->nr_atoms);
+	panwrap_log("stride = %d\n", args->stride);
 
-	panwrap_track_allocation(args->gpu_va, args->flags);
-}
+	/* The stride should be equivalent to the length of the structure,
+	 * if it isn't then it's possible we're somehow tracing one of the
+	 * legacy job formats
+	 */
+	if (args->stride != sizeof(*atoms)) {
+		panwrap_log("SIZE MISMATCH (stride should be %zd, was %d)\n",
+			    sizeof(*atoms), args->stride);
+		panwrap_log("Cannot dump atoms :(, maybe it's a legacy job format?\n");
+		return;
+	}
 
-static void
-ioctl_decode_post_mem_import(unsigned long int request, void *ptr)
-{
-	const struct mali_ioctl_mem_import *args = ptr;
+	atoms = panwrap_cpu_mem(args->addr, sizeof(*atoms) * args->nr_atoms);
+	if (!atoms) {
+		panwrap_log("Atoms weren't captured, cannot dump them\n");
+		return;
+	}
 
-	panwrap_log("gpu_va = " MALI_PTR_FORMAT "\n", args->gpu_va);
-	panwrap_log("va_pages = %" PRId64 "\n", args->va_pages);
-	panwrap_log("flags = ");
-	panwrap_log_decoded_flags(mem_flag_info, args->flags);
-	panwrap_log_cont("\n");
+	panwrap_log("Atoms:\n");
+	panwrap_indent++;
+	panwrap_workers_run(args->nr_atoms, ioctl_log_atom, (void *) atoms);
+	panwrap_indent--;
 }
 
 static void
-ioctl_decode_post_mem_commit(unsigned long int request, void *ptr)
+ioctl_track_mem_alloc(unsigned long int request, void *ptr)
 {
-	const struct mali_ioctl_mem_commit *args = ptr;
+	const struct mali_ioctl_mem_alloc *args = ptr;
 
-	panwrap_log("result_subcode = %d\n", args->result_subcode);
+	panwrap_track_allocation(args->gpu_va, args->flags);
 }
 
 static void
-ioctl_decode_post_mem_query(unsigned long int request, void *ptr)
+ioctl_track_mem_jit_init(unsigned long int request, void *ptr)
 {
-	const struct mali_ioctl_mem_query *args = ptr;
+	const struct mali_ioctl_mem_jit_init *args = ptr;
 
-	panwrap_log("value = 0x%" PRIx64 "\n", args->value);
+	panwrap_jit_init_zone(panwrap_context_current(), args->va_pages);
 }
 
 static void
-ioctl_decode_post_mem_alias(unsigned long int request, void *ptr)
+ioctl_track_gpu_props_reg_dump(unsigned long int request, void *ptr)
 {
-	const struct mali_ioctl_mem_alias *args = ptr;
-
-	panwrap_log("gpu_va = " MALI_PTR_FORMAT "\n", args->gpu_va);
-	panwrap_log("va_pages = %" PRId64 "\n", args->va_pages);
+	panwrap_compute_set_gpu_props(ptr);
+	panwrap_tiler_heap_set_gpu_props(ptr);
 }
 
 static void inline
 ioctl_decode_post_sync(unsigned long int request, void *ptr)
 {
 	const struct mali_ioctl_sync *args = ptr;
+	const void *data;
 
 	if (args->type != MALI_SYNC_TO_CPU)
 		return;
 
+	data = panwrap_cpu_mem(args->user_addr, args->size);
+
 	panwrap_log("Dumping memory from device:\n");
 	panwrap_indent++;
-	panwrap_log_hexdump_trimmed(args->user_addr, args->size);
+	if (data)
+		panwrap_log_hexdump_trimmed(data, args->size);
+	else
+		panwrap_log("<not captured>\n");
 	panwrap_indent--;
 }
 
@@ -725,100 +581,749 @@ ioctl_decode_post_gpu_props_reg_dump(unsigned long int request, void *ptr)
 	panwrap_indent--;
 }
 
-static inline void
-ioctl_decode_post_stream_create(unsigned long int request, void *ptr)
+static inline u64
+ioctl_field_value(const struct ioctl_field *field, const void *ptr)
 {
-	const struct mali_ioctl_stream_create *args = ptr;
+	u64 value = 0;
+
+	/* Every integer member we describe is little endian and <= 64 bits */
+	memcpy(&value, ptr + field->offset, field->size);
 
-	panwrap_log("fd = %d\n", args->fd);
+	return value;
 }
 
-static inline void
-ioctl_decode_post_get_context_id(unsigned long int request, void *ptr)
+static void
+ioctl_log_field_dec(const struct ioctl_field *field, const void *ptr)
 {
-	const struct mali_ioctl_get_context_id *args = ptr;
+	panwrap_log_cont("%" PRIu64 "\n", ioctl_field_value(field, ptr));
+}
+
+static void
+ioctl_log_field_sdec(const struct ioctl_field *field, const void *ptr)
+{
+	unsigned int shift = 64 - field->size * 8;
+	s64 value = (s64)(ioctl_field_value(field, ptr) << shift) >> shift;
 
-	panwrap_log("id = 0x%" PRIx64 "\n", args->id);
+	panwrap_log_cont("%" PRId64 "\n", value);
 }
 
 static void
-ioctl_decode_post(unsigned long int request, void *ptr)
+ioctl_log_field_hex(const struct ioctl_field *field, const void *ptr)
 {
-	switch (IOCTL_CASE(request)) {
-	case IOCTL_CASE(MALI_IOCTL_GET_VERSION):
-	case IOCTL_CASE(MALI_IOCTL_GET_VERSION_NEW):
-		ioctl_decode_post_get_version(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_ALLOC):
-		ioctl_decode_post_mem_alloc(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_IMPORT):
-		ioctl_decode_post_mem_import(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_COMMIT):
-		ioctl_decode_post_mem_commit(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_QUERY):
-		ioctl_decode_post_mem_query(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_MEM_ALIAS):
-		ioctl_decode_post_mem_alias(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_SYNC):
-		ioctl_decode_post_sync(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_GPU_PROPS_REG_DUMP):
-		ioctl_decode_post_gpu_props_reg_dump(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_STREAM_CREATE):
-		ioctl_decode_post_stream_create(request, ptr);
-		break;
-	case IOCTL_CASE(MALI_IOCTL_GET_CONTEXT_ID):
-		ioctl_decode_post_get_context_id(request, ptr);
-		break;
-	default:
-		break;
-	}
+	panwrap_log_cont("0x%" PRIx64 "\n", ioctl_field_value(field, ptr));
 }
 
-/**
- * Overriden libc functions start here
- */
-static inline int
-panwrap_open_wrap(open_func *func, const char *path, int flags, va_list args)
+static void
+ioctl_log_field_ptr(const struct ioctl_field *field, const void *ptr)
 {
-	mode_t mode = 0;
-	int ret;
+	panwrap_log_cont(MALI_PTR_FORMAT "\n",
+			 (mali_ptr)ioctl_field_value(field, ptr));
+}
 
-	if (flags & O_CREAT) {
-		mode = (mode_t) va_arg(args, int);
-		ret = func(path, flags, mode);
-	} else {
-		ret = func(path, flags);
-	}
+static void
+ioctl_log_field_flags(const struct ioctl_field *field, const void *ptr)
+{
+	panwrap_log_decoded_flags(field->aux, ioctl_field_value(field, ptr));
+	panwrap_log_cont("\n");
+}
 
-	LOCK();
-	if (ret != -1) {
-		if (strcmp(path, "/dev/mali0") == 0) {
-			panwrap_log("/dev/mali0 fd == %d\n", ret);
-			mali_fd = ret;
-		} else if (strstr(path, "/dev/")) {
-			panwrap_log("Unknown device %s opened at fd %d\n",
-				    path, ret);
-		}
-	}
-	UNLOCK();
+static void
+ioctl_log_field_enum(const struct ioctl_field *field, const void *ptr)
+{
+	u64 value = ioctl_field_value(field, ptr);
 
-	return ret;
+	panwrap_log_cont("%" PRIu64 " (%s)\n",
+			 value, panwrap_enum_name(field->aux, value));
 }
 
-int
-open(const char *path, int flags, ...)
+static void
+ioctl_log_field_str(const struct ioctl_field *field, const void *ptr)
 {
-	PROLOG(open);
-	va_list args;
-	va_start(args, flags);
-	int o = panwrap_open_wrap(orig_open, path, flags, args);
+	panwrap_log_cont("%.*s\n",
+			 (int)field->size, (const char*)ptr + field->offset);
+}
+
+static void
+ioctl_log_field_hexdump(const struct ioctl_field *field, const void *ptr)
+{
+	panwrap_log_cont("\n");
+	panwrap_indent++;
+	panwrap_log_hexdump(ptr + field->offset, field->size);
+	panwrap_indent--;
+}
+
+typedef void (ioctl_log_field_func)(const struct ioctl_field *field,
+				    const void *ptr);
+
+static ioctl_log_field_func *const ioctl_field_loggers[] = {
+	[IOCTL_FIELD_DEC]     = ioctl_log_field_dec,
+	[IOCTL_FIELD_SDEC]    = ioctl_log_field_sdec,
+	[IOCTL_FIELD_HEX]     = ioctl_log_field_hex,
+	[IOCTL_FIELD_PTR]     = ioctl_log_field_ptr,
+	[IOCTL_FIELD_FLAGS]   = ioctl_log_field_flags,
+	[IOCTL_FIELD_ENUM]    = ioctl_log_field_enum,
+	[IOCTL_FIELD_STR]     = ioctl_log_field_str,
+	[IOCTL_FIELD_HEXDUMP] = ioctl_log_field_hexdump,
+};
+_Static_assert(ARRAY_SIZE(ioctl_field_loggers) == IOCTL_FIELD_FORMAT_COUNT,
+	       "Missing a logger for an ioctl field format");
+
+/*
+ * Generic decoder for any ioctl struct that has a field descriptor table, see
+ * the MALI_IOCTL_*_FIELDS() definitions in mali-ioctl.h
+ */
+static void
+ioctl_log_fields(const struct ioctl_field *fields, const void *ptr,
+		 enum ioctl_field_dir dir)
+{
+	for (const struct ioctl_field *f = fields; f->name; f++) {
+		if (!(f->dir & dir))
+			continue;
+
+		panwrap_log("%s = ", f->name);
+		ioctl_field_loggers[f->format](f, ptr);
+	}
+}
+
+/*
+ * Besides the text in the log, the same field descriptors can be dumped to
+ * PANWRAP_IOCTL_DUMP=path, one record per direction of each ioctl that has
+ * them. With PANWRAP_IOCTL_DUMP_FORMAT=json, every record is a JSON object on
+ * its own line. With PANWRAP_IOCTL_DUMP_FORMAT=binary, every record is a
+ * struct ioctl_dump_record followed by the raw bytes of each member it covers,
+ * in the order of the descriptor table.
+ */
+struct ioctl_dump_record {
+	u32 request;
+	u8 dir;
+	u8 fields;
+	u16 size;
+} __attribute__((packed));
+
+typedef void (ioctl_dump_field_func)(FILE *f, const struct ioctl_field *field,
+				     const void *ptr);
+
+struct ioctl_dump_format {
+	void (*begin)(FILE *f, unsigned long int request, const char *name,
+		      const struct ioctl_field *fields, const void *ptr,
+		      enum ioctl_field_dir dir);
+	ioctl_dump_field_func *field[IOCTL_FIELD_FORMAT_COUNT];
+	void (*end)(FILE *f);
+};
+
+static FILE *dump_file;
+static const struct ioctl_dump_format *dump_format;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+ioctl_json_string(FILE *f, const char *str, size_t max)
+{
+	fputc('"', f);
+	for (size_t i = 0; i < max && str[i]; i++) {
+		unsigned char c = str[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20 || c >= 0x7f)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static void
+ioctl_json_begin(FILE *f, unsigned long int request, const char *name,
+		 const struct ioctl_field *fields, const void *ptr,
+		 enum ioctl_field_dir dir)
+{
+	fprintf(f, "{\"ioctl\": \"%s\", \"request\": \"0x%08x\", \"dir\": \"%s\"",
+		name, (unsigned int)request,
+		dir == IOCTL_FIELD_IN ? "in" : "out");
+}
+
+static void
+ioctl_json_end(FILE *f)
+{
+	fprintf(f, "}\n");
+}
+
+static void
+ioctl_json_field_dec(FILE *f, const struct ioctl_field *field, const void *ptr)
+{
+	fprintf(f, ", \"%s\": %" PRIu64, field->name,
+		ioctl_field_value(field, ptr));
+}
+
+static void
+ioctl_json_field_sdec(FILE *f, const struct ioctl_field *field, const void *ptr)
+{
+	unsigned int shift = 64 - field->size * 8;
+	s64 value = (s64)(ioctl_field_value(field, ptr) << shift) >> shift;
+
+	fprintf(f, ", \"%s\": %" PRId64, field->name, value);
+}
+
+/* Addresses and masks don't fit in a double, so they're strings */
+static void
+ioctl_json_field_hex(FILE *f, const struct ioctl_field *field, const void *ptr)
+{
+	fprintf(f, ", \"%s\": \"0x%" PRIx64 "\"", field->name,
+		ioctl_field_value(field, ptr));
+}
+
+static void
+ioctl_json_field_flags(FILE *f, const struct ioctl_field *field,
+		       const void *ptr)
+{
+	const struct panwrap_flag_info *flag_info = field->aux;
+	u64 flags = ioctl_field_value(field, ptr);
+	bool first = true;
+
+	fprintf(f, ", \"%s\": {\"value\": \"0x%" PRIx64 "\", \"flags\": [",
+		field->name, flags);
+	for (int i = 0; flag_info[i].name; i++) {
+		if ((flags & flag_info[i].flag) != flag_info[i].flag)
+			continue;
+
+		fprintf(f, "%s\"%s\"", first ? "" : ", ", flag_info[i].name);
+		flags &= ~flag_info[i].flag;
+		first = false;
+	}
+	fprintf(f, "], \"unknown\": \"0x%" PRIx64 "\"}", flags);
+}
+
+static void
+ioctl_json_field_enum(FILE *f, const struct ioctl_field *field,
+		      const void *ptr)
+{
+	u64 value = ioctl_field_value(field, ptr);
+	const char *name = panwrap_enum_name(field->aux, value);
+
+	fprintf(f, ", \"%s\": {\"value\": %" PRIu64 ", \"name\": ",
+		field->name, value);
+	ioctl_json_string(f, name, strlen(name));
+	fprintf(f, "}");
+}
+
+static void
+ioctl_json_field_str(FILE *f, const struct ioctl_field *field, const void *ptr)
+{
+	fprintf(f, ", \"%s\": ", field->name);
+	ioctl_json_string(f, (const char*)ptr + field->offset, field->size);
+}
+
+static void
+ioctl_json_field_hexdump(FILE *f, const struct ioctl_field *field,
+			 const void *ptr)
+{
+	const unsigned char *data = ptr + field->offset;
+
+	fprintf(f, ", \"%s\": \"", field->name);
+	for (size_t i = 0; i < field->size; i++)
+		fprintf(f, "%02x", data[i]);
+	fputc('"', f);
+}
+
+static void
+ioctl_binary_begin(FILE *f, unsigned long int request, const char *name,
+		   const struct ioctl_field *fields, const void *ptr,
+		   enum ioctl_field_dir dir)
+{
+	struct ioctl_dump_record record = {
+		.request = request,
+		.dir = dir,
+	};
+
+	for (const struct ioctl_field *field = fields; field->name; field++) {
+		if (!(field->dir & dir))
+			continue;
+
+		record.fields++;
+		record.size += field->size;
+	}
+
+	fwrite(&record, sizeof(record), 1, f);
+}
+
+static void
+ioctl_binary_end(FILE *f)
+{
+}
+
+static void
+ioctl_binary_field(FILE *f, const struct ioctl_field *field, const void *ptr)
+{
+	fwrite(ptr + field->offset, field->size, 1, f);
+}
+
+static const struct ioctl_dump_format ioctl_dump_json = {
+	.begin = ioctl_json_begin,
+	.field = {
+		[IOCTL_FIELD_DEC]     = ioctl_json_field_dec,
+		[IOCTL_FIELD_SDEC]    = ioctl_json_field_sdec,
+		[IOCTL_FIELD_HEX]     = ioctl_json_field_hex,
+		[IOCTL_FIELD_PTR]     = ioctl_json_field_hex,
+		[IOCTL_FIELD_FLAGS]   = ioctl_json_field_flags,
+		[IOCTL_FIELD_ENUM]    = ioctl_json_field_enum,
+		[IOCTL_FIELD_STR]     = ioctl_json_field_str,
+		[IOCTL_FIELD_HEXDUMP] = ioctl_json_field_hexdump,
+	},
+	.end = ioctl_json_end,
+};
+
+static const struct ioctl_dump_format ioctl_dump_binary = {
+	.begin = ioctl_binary_begin,
+	.field = {
+		[0 ... IOCTL_FIELD_FORMAT_COUNT - 1] = ioctl_binary_field,
+	},
+	.end = ioctl_binary_end,
+};
+
+static void
+ioctl_dump_fields(unsigned long int request, const char *name,
+		  const struct ioctl_field *fields, const void *ptr,
+		  enum ioctl_field_dir dir)
+{
+	if (!dump_file)
+		return;
+
+	pthread_mutex_lock(&dump_lock);
+	dump_format->begin(dump_file, request, name, fields, ptr, dir);
+	for (const struct ioctl_field *f = fields; f->name; f++) {
+		if (f->dir & dir)
+			dump_format->field[f->format](dump_file, f, ptr);
+	}
+	dump_format->end(dump_file);
+	fflush(dump_file);
+	pthread_mutex_unlock(&dump_lock);
+}
+
+#define IOCTL_FIELD_AUX_FLAGS(aux) aux##_flag_info
+#define IOCTL_FIELD_AUX_ENUM(aux)  aux##_enum_info
+#define IOCTL_FIELD_AUX_DEC(aux)   NULL
+#define IOCTL_FIELD_AUX_SDEC(aux)  NULL
+#define IOCTL_FIELD_AUX_HEX(aux)   NULL
+#define IOCTL_FIELD_AUX_PTR(aux)   NULL
+#define IOCTL_FIELD_AUX_STR(aux)   NULL
+#define IOCTL_FIELD_AUX_HEXDUMP(aux) NULL
+
+#define IOCTL_FIELD(s, dir_, member, format_, aux_) {        \
+	.name   = #member,                                   \
+	.offset = offsetof(s, member),                       \
+	.size   = sizeof(((s *)NULL)->member),               \
+	.dir    = IOCTL_FIELD_##dir_,                        \
+	.format = IOCTL_FIELD_##format_,                     \
+	.aux    = IOCTL_FIELD_AUX_##format_(aux_),           \
+},
+#define IOCTL_FIELDS(name, NAME)                                          \
+	static const struct ioctl_field name##_fields[] = {               \
+		MALI_IOCTL_##NAME##_FIELDS(IOCTL_FIELD, struct mali_ioctl_##name) \
+		{}                                                        \
+	}
+IOCTL_FIELDS(get_version, GET_VERSION);
+IOCTL_FIELDS(mem_alloc, MEM_ALLOC);
+IOCTL_FIELDS(mem_import, MEM_IMPORT);
+IOCTL_FIELDS(mem_commit, MEM_COMMIT);
+IOCTL_FIELDS(mem_query, MEM_QUERY);
+IOCTL_FIELDS(mem_free, MEM_FREE);
+IOCTL_FIELDS(mem_flags_change, MEM_FLAGS_CHANGE);
+IOCTL_FIELDS(mem_alias, MEM_ALIAS);
+IOCTL_FIELDS(mem_jit_init, MEM_JIT_INIT);
+IOCTL_FIELDS(set_flags, SET_FLAGS);
+IOCTL_FIELDS(stream_create, STREAM_CREATE);
+IOCTL_FIELDS(get_context_id, GET_CONTEXT_ID);
+#undef IOCTL_FIELDS
+#undef IOCTL_FIELD
+
+/*
+ * Everything we know about each ioctl. Adding decoding support for an ioctl
+ * that's just a plain struct only requires adding a field descriptor for it in
+ * mali-ioctl.h, and then hooking it up here. Anything more complicated can
+ * provide its own pre/post hooks, which run after the generic field decoding.
+ */
+#define IOCTL_TYPE(type) [type - MALI_IOCTL_TYPE_BASE] =
+#define IOCTL_INFO(n, ...) [_IOC_NR(MALI_IOCTL_##n)] = { .name = #n, __VA_ARGS__ }
+static struct device_info mali_info = {
+	.name = "mali",
+	.info = {
+		IOCTL_TYPE(0x80) {
+			IOCTL_INFO(GET_VERSION, .fields = get_version_fields),
+		},
+		IOCTL_TYPE(0x82) {
+			IOCTL_INFO(MEM_ALLOC, .fields = mem_alloc_fields,
+				   .track = ioctl_track_mem_alloc),
+			IOCTL_INFO(MEM_IMPORT, .fields = mem_import_fields),
+			IOCTL_INFO(MEM_COMMIT, .fields = mem_commit_fields),
+			IOCTL_INFO(MEM_QUERY, .fields = mem_query_fields),
+			IOCTL_INFO(MEM_FREE, .fields = mem_free_fields),
+			IOCTL_INFO(MEM_FLAGS_CHANGE,
+				   .fields = mem_flags_change_fields),
+			IOCTL_INFO(MEM_ALIAS, .fields = mem_alias_fields),
+			IOCTL_INFO(SYNC, .pre = ioctl_decode_pre_sync,
+				   .post = ioctl_decode_post_sync),
+			IOCTL_INFO(POST_TERM),
+			IOCTL_INFO(HWCNT_SETUP),
+			IOCTL_INFO(HWCNT_DUMP),
+			IOCTL_INFO(HWCNT_CLEAR),
+			IOCTL_INFO(GPU_PROPS_REG_DUMP,
+				   .post = ioctl_decode_post_gpu_props_reg_dump,
+				   .track = ioctl_track_gpu_props_reg_dump),
+			IOCTL_INFO(FIND_CPU_OFFSET),
+			IOCTL_INFO(GET_VERSION_NEW, .fields = get_version_fields),
+			IOCTL_INFO(SET_FLAGS, .fields = set_flags_fields),
+			IOCTL_INFO(SET_TEST_DATA),
+			IOCTL_INFO(INJECT_ERROR),
+			IOCTL_INFO(MODEL_CONTROL),
+			IOCTL_INFO(KEEP_GPU_POWERED),
+			IOCTL_INFO(FENCE_VALIDATE),
+			IOCTL_INFO(STREAM_CREATE, .fields = stream_create_fields),
+			IOCTL_INFO(GET_PROFILING_CONTROLS),
+			IOCTL_INFO(SET_PROFILING_CONTROLS),
+			IOCTL_INFO(DEBUGFS_MEM_PROFILE_ADD),
+			IOCTL_INFO(JOB_SUBMIT, .pre = ioctl_decode_pre_job_submit),
+			IOCTL_INFO(DISJOINT_QUERY),
+			IOCTL_INFO(GET_CONTEXT_ID, .fields = get_context_id_fields),
+			IOCTL_INFO(TLSTREAM_ACQUIRE_V10_4),
+			IOCTL_INFO(TLSTREAM_TEST),
+			IOCTL_INFO(TLSTREAM_STATS),
+			IOCTL_INFO(TLSTREAM_FLUSH),
+			IOCTL_INFO(HWCNT_READER_SETUP),
+			IOCTL_INFO(SET_PRFCNT_VALUES),
+			IOCTL_INFO(SOFT_EVENT_UPDATE),
+			IOCTL_INFO(MEM_JIT_INIT, .fields = mem_jit_init_fields,
+				   .track = ioctl_track_mem_jit_init),
+			IOCTL_INFO(TLSTREAM_ACQUIRE),
+		},
+	},
+};
+#undef IOCTL_INFO
+#undef IOCTL_TYPE
+
+static inline const struct ioctl_info *
+ioctl_get_info(unsigned long int request)
+{
+	static const struct ioctl_info unknown = {};
+	unsigned int type = _IOC_TYPE(request) - MALI_IOCTL_TYPE_BASE;
+
+	if (type >= MALI_IOCTL_TYPE_COUNT ||
+	    _IOC_NR(request) >= ARRAY_SIZE(mali_info.info[0]))
+		return &unknown;
+
+	return &mali_info.info[type][_IOC_NR(request)];
+}
+
+static void
+ioctl_decode_pre(unsigned long int request, void *ptr)
+{
+	const struct ioctl_info *info = ioctl_get_info(request);
+
+	if (info->fields) {
+		ioctl_log_fields(info->fields, ptr, IOCTL_FIELD_IN);
+		ioctl_dump_fields(request, info->name, info->fields, ptr,
+				  IOCTL_FIELD_IN);
+	}
+	if (info->pre)
+		info->pre(request, ptr);
+}
+
+static void
+ioctl_decode_post(unsigned long int request, void *ptr)
+{
+	const struct ioctl_info *info = ioctl_get_info(request);
+
+	if (info->fields) {
+		ioctl_log_fields(info->fields, ptr, IOCTL_FIELD_OUT);
+		ioctl_dump_fields(request, info->name, info->fields, ptr,
+				  IOCTL_FIELD_OUT);
+	}
+	if (info->post)
+		info->post(request, ptr);
+}
+
+static void
+ioctl_track(unsigned long int request, void *ptr)
+{
+	const struct ioctl_info *info = ioctl_get_info(request);
+
+	if (info->track)
+		info->track(request, ptr);
+}
+
+/* Copy whatever payload a soft job's jc points to, see
+ * panwrap_trace_soft_job() */
+static void
+ioctl_snapshot_soft_job(struct panwrap_snapshot *snapshot,
+			const struct mali_jd_atom_v2 *a)
+{
+	const void *jc = (const void *) (uintptr_t) a->jc;
+	const struct mali_external_resource *list = jc;
+
+	if (!a->jc)
+		return;
+
+	switch (a->core_req & MALI_JD_REQ_SOFT_JOB_TYPE) {
+	case MALI_JD_REQ_SOFT_JIT_ALLOC:
+		panwrap_snapshot_add_cpu_mem(
+		    snapshot, jc, sizeof(struct mali_jd_jit_alloc_info));
+		break;
+	case MALI_JD_REQ_SOFT_FENCE_TRIGGER:
+	case MALI_JD_REQ_SOFT_FENCE_WAIT:
+		panwrap_snapshot_add_cpu_mem(snapshot, jc,
+					     sizeof(struct mali_jd_fence));
+		break;
+	case MALI_JD_REQ_SOFT_EXT_RES_MAP:
+	case MALI_JD_REQ_SOFT_EXT_RES_UNMAP:
+		panwrap_snapshot_add_cpu_mem(
+		    snapshot, jc, sizeof(list->count) +
+		    sizeof(list->ext_resource[0]) *
+		    MIN(list->count, MALI_EXT_RES_MAX));
+		break;
+	case MALI_JD_REQ_SOFT_EVENT_WAIT:
+	case MALI_JD_REQ_SOFT_EVENT_SET:
+	case MALI_JD_REQ_SOFT_EVENT_RESET:
+		panwrap_snapshot_add_gpu_mem(snapshot, a->jc);
+		break;
+	}
+}
+
+/*
+ * Snapshot whatever memory the ioctl references, so it can still be decoded
+ * after the ioctl has returned
+ */
+static struct panwrap_snapshot *
+ioctl_snapshot_pre(unsigned long int request, void *ptr)
+{
+	struct panwrap_snapshot *snapshot;
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		const struct mali_ioctl_job_submit *args = ptr;
+
+		snapshot = panwrap_snapshot_create();
+		if (args->stride != sizeof(*args->addr))
+			return snapshot;
+
+		panwrap_snapshot_add_cpu_mem(
+		    snapshot, args->addr, sizeof(*args->addr) * args->nr_atoms);
+
+		/* Only what the atoms reference, copying all of GPU memory
+		 * would take about as long as decoding right away */
+		for (int i = 0; i < args->nr_atoms; i++) {
+			const struct mali_jd_atom_v2 *a = &args->addr[i];
+
+			if (a->core_req & MALI_JD_REQ_SOFT_JOB)
+				ioctl_snapshot_soft_job(snapshot, a);
+			else
+				panwrap_snapshot_add_chain(snapshot, a->jc);
+
+			if (!a->ext_res_list)
+				continue;
+
+			panwrap_snapshot_add_cpu_mem(
+			    snapshot, a->ext_res_list,
+			    sizeof(*a->ext_res_list) * MAX(a->nr_ext_res, 1));
+		}
+
+		return snapshot;
+	}
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_SYNC)) {
+		const struct mali_ioctl_sync *args = ptr;
+		struct panwrap_mapped_memory *mem =
+			panwrap_find_mapped_gpu_mem(args->handle);
+
+		snapshot = panwrap_snapshot_create();
+		if (mem)
+			panwrap_snapshot_add_mapping(snapshot, mem, false);
+		if (args->type == MALI_SYNC_TO_DEVICE)
+			panwrap_snapshot_add_cpu_mem(snapshot, args->user_addr,
+						     args->size);
+
+		return snapshot;
+	}
+
+	return NULL;
+}
+
+static struct panwrap_snapshot *
+ioctl_snapshot_post(unsigned long int request, void *ptr)
+{
+	struct panwrap_snapshot *snapshot;
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_SYNC)) {
+		const struct mali_ioctl_sync *args = ptr;
+
+		if (args->type != MALI_SYNC_TO_CPU)
+			return NULL;
+
+		snapshot = panwrap_snapshot_create();
+		panwrap_snapshot_add_cpu_mem(snapshot, args->user_addr,
+					     args->size);
+
+		return snapshot;
+	}
+
+	return NULL;
+}
+
+static void
+ioctl_log_header(unsigned long int request, void *ptr, unsigned int ctx_label)
+{
+	const char *name = ioctl_get_info(request)->name ?: "???";
+	const union mali_ioctl_header *header = ptr;
+
+	if (!ptr) { /* All valid mali ioctl's should have a specified arg */
+		panwrap_log("<%-20s> (%02d) (%08x), has no arguments? Cannot decode :(",
+			    name, (int)_IOC_NR(request), (unsigned int)request);
+	} else {
+		panwrap_log("<%-20s> (%02d) (%08x) (%04d) (%03d)",
+			    name, (int)_IOC_NR(request), (unsigned int)request,
+			    (int)_IOC_SIZE(request), header->id);
+	}
+
+	if (ctx_label)
+		panwrap_log_cont(" [context %u]", ctx_label);
+	panwrap_log_cont("\n");
+}
+
+static void
+ioctl_log_result(unsigned long int request, void *ptr, int ret)
+{
+	const union mali_ioctl_header *header = ptr;
+
+	if (!ptr) {
+		panwrap_indent++;
+		panwrap_log("= %02d\n", ret);
+		panwrap_indent--;
+		return;
+	}
+
+	panwrap_log("= %02d, %02d\n", ret, header->rc);
+}
+
+static void
+ioctl_decode_deferred(struct panwrap_deferred_item *item)
+{
+	struct deferred_ioctl *d = (struct deferred_ioctl *)item;
+	void *pre_args = d->size ? d->args : NULL,
+	     *post_args = d->size ? d->args + d->size : NULL;
+
+	panwrap_context_set_current(d->ctx);
+	panwrap_log_set_timestamp(&d->pre_time);
+	panwrap_snapshot_use(d->pre_snapshot);
+
+	ioctl_log_header(d->request, pre_args, d->ctx_label);
+	if (pre_args) {
+		panwrap_indent++;
+		ioctl_decode_pre(d->request, pre_args);
+	}
+
+	panwrap_log_set_timestamp(&d->post_time);
+	panwrap_snapshot_use(d->post_snapshot);
+
+	ioctl_log_result(d->request, post_args, d->ret);
+	if (post_args) {
+		ioctl_decode_post(d->request, post_args);
+		panwrap_indent--;
+	}
+
+	panwrap_snapshot_use(NULL);
+	panwrap_log_set_timestamp(NULL);
+	panwrap_context_set_current(NULL);
+
+	panwrap_context_put(d->ctx);
+	panwrap_snapshot_free(d->pre_snapshot);
+	panwrap_snapshot_free(d->post_snapshot);
+	free(d);
+}
+
+static struct deferred_ioctl *
+ioctl_defer_pre(struct panwrap_context *ctx, unsigned long int request,
+		void *ptr)
+{
+	size_t size = ptr ? _IOC_SIZE(request) : 0;
+	struct deferred_ioctl *d = malloc(sizeof(*d) + size * 2);
+
+	d->item.run = ioctl_decode_deferred;
+	d->request = request;
+	d->ctx = panwrap_context_get(ctx);
+	d->ctx_label = panwrap_context_label();
+	d->size = size;
+	memcpy(d->args, ptr, size);
+	panwrap_timestamp_get(&d->pre_time);
+
+	/* Even an empty snapshot keeps the decoding thread from looking at
+	 * live mappings, which the app might be changing */
+	d->pre_snapshot = ioctl_snapshot_pre(request, ptr) ?:
+		panwrap_snapshot_create();
+
+	return d;
+}
+
+static void
+ioctl_defer_post(struct deferred_ioctl *d, void *ptr, int ret)
+{
+	d->ret = ret;
+	memcpy(d->args + d->size, ptr, d->size);
+	panwrap_timestamp_get(&d->post_time);
+
+	d->post_snapshot = ioctl_snapshot_post(d->request, ptr) ?:
+		panwrap_snapshot_create();
+
+	d->item.size = sizeof(*d) + d->size * 2 + d->pre_snapshot->size +
+		d->post_snapshot->size;
+
+	panwrap_deferred_queue(&d->item);
+}
+
+/* For each epoll fd watching a /dev/mali0, that fd plus one */
+static int epoll_watches[PANWRAP_MAX_FDS];
+
+/**
+ * Overriden libc functions start here
+ */
+static inline int
+panwrap_open_wrap(open_func *func, const char *path, int flags, va_list args)
+{
+	mode_t mode = 0;
+	int ret;
+
+	if (flags & O_CREAT) {
+		mode = (mode_t) va_arg(args, int);
+		ret = func(path, flags, mode);
+	} else {
+		ret = func(path, flags);
+	}
+
+	if (ret == -1)
+		return ret;
+
+	if (strcmp(path, "/dev/mali0") == 0) {
+		struct panwrap_context *ctx;
+
+		panwrap_freeze_time();
+		ctx = panwrap_context_create(ret);
+		if (ctx) {
+			panwrap_log("/dev/mali0 fd == %d (context %u)\n",
+				    ret, ctx->id);
+			panwrap_capture_open(ret);
+		}
+		panwrap_unfreeze_time();
+	} else if (strstr(path, "/dev/")) {
+		panwrap_log("Unknown device %s opened at fd %d\n",
+			    path, ret);
+	}
+
+	return ret;
+}
+
+int
+open(const char *path, int flags, ...)
+{
+	PROLOG(open);
+	va_list args;
+	va_start(args, flags);
+	int o = panwrap_open_wrap(orig_open, path, flags, args);
 	va_end(args);
 	return o;
 }
@@ -837,19 +1342,19 @@ open64(const char *path, int flags, ...)
 int
 close(int fd)
 {
+	struct panwrap_context *ctx;
 	PROLOG(close);
 
-        /* Intentionally racy: prevents us from trying to hold the global mutex
-         * in calls from system libraries */
-        if (fd <= 0 || !mali_fd || fd != mali_fd)
-                return orig_close(fd);
+	if (fd >= 0 && fd < PANWRAP_MAX_FDS)
+		epoll_watches[fd] = 0;
 
-	LOCK();
-	if (mali_fd && fd == mali_fd) {
-		panwrap_log("/dev/mali0 closed\n");
-		mali_fd = 0;
-	}
-	UNLOCK();
+	ctx = panwrap_context_lock(fd);
+	if (!ctx)
+		return orig_close(fd);
+
+	panwrap_log("/dev/mali0 closed (context %u)\n", ctx->id);
+	panwrap_capture_close(fd);
+	panwrap_context_destroy(ctx);
 
 	return orig_close(fd);
 }
@@ -857,13 +1362,15 @@ close(int fd)
 /* XXX: Android has a messed up ioctl signature */
 int ioctl(int fd, int request, ...)
 {
-	const char *name;
-	union mali_ioctl_header *header;
 	PROLOG(ioctl);
 	int ioc_size = _IOC_SIZE(request);
 	int ret;
-	uint32_t func;
 	void *ptr;
+	struct panwrap_context *ctx;
+	struct deferred_ioctl *deferred = NULL;
+	struct panwrap_capture_ioctl *capture;
+	bool logged;
+	u64 start, kernel_start, kernel_ns;
 
 	if (ioc_size) {
 		va_list args;
@@ -875,49 +1382,81 @@ int ioctl(int fd, int request, ...)
 		ptr = NULL;
 	}
 
-	if (fd && fd != mali_fd)
+	start = panwrap_monotonic_ns();
+
+	ctx = panwrap_context_lock(fd);
+	if (!ctx)
 		return orig_ioctl(fd, request, ptr);
 
-	LOCK();
 	panwrap_freeze_time();
-	name = ioctl_get_info(request)->name ?: "???";
-	header = ptr;
+	ctx->stats.ioctls++;
 
-	if (!ptr) { /* All valid mali ioctl's should have a specified arg */
-		panwrap_log("<%-20s> (%02d) (%08x), has no arguments? Cannot decode :(\n",
-			    name, _IOC_NR(request), request);
+	panwrap_latency_check_dump();
+	logged = panwrap_sample_ioctl(request, ptr);
 
-		panwrap_unfreeze_time();
-		ret = orig_ioctl(fd, request, ptr);
-		panwrap_freeze_time();
-
-		panwrap_indent++;
-		panwrap_log("= %02d\n", ret);
-		panwrap_indent--;
-		goto out;
+	if (!logged) {
+		/* Only counted, see panwrap-sample.c */
+	} else if (panwrap_deferred_enabled()) {
+		deferred = ioctl_defer_pre(ctx, request, ptr);
+	} else {
+		ioctl_log_header(request, ptr, panwrap_context_label());
+		if (ptr) {
+			panwrap_indent++;
+			ioctl_decode_pre(request, ptr);
+		}
 	}
 
-	func = header->id;
-	panwrap_log("<%-20s> (%02d) (%08x) (%04d) (%03d)\n",
-		    name, _IOC_NR(request), request, _IOC_SIZE(request), func);
-
-	panwrap_indent++;
-
-	ioctl_decode_pre(request, ptr);
+	capture = panwrap_capture_ioctl_pre(fd, request, ptr);
 
 	panwrap_unfreeze_time();
+	kernel_start = panwrap_monotonic_ns();
 	ret = orig_ioctl(fd, request, ptr);
+	kernel_ns = panwrap_monotonic_ns() - kernel_start;
 	panwrap_freeze_time();
 
-	panwrap_log("= %02d, %02d\n",
-		    ret, header->rc);
-	ioctl_decode_post(request, ptr);
+	panwrap_capture_ioctl_post(capture, ptr, ret);
+	panwrap_latency_record(request, ioctl_get_info(request)->name ?: "???",
+			       ptr, kernel_ns);
 
-	panwrap_indent--;
+	if (!logged) {
+		/* Nothing to do */
+	} else if (deferred) {
+		ioctl_defer_post(deferred, ptr, ret);
+	} else {
+		ioctl_log_result(request, ptr, ret);
+		if (ptr) {
+			ioctl_decode_post(request, ptr);
+			panwrap_indent--;
+		}
+	}
+
+	if (ptr)
+		ioctl_track(request, ptr);
+
+	if (ret == 0) {
+		panwrap_frame_stats_ioctl(ctx, request, ptr);
+		panwrap_tiler_heap_ioctl(ctx, request, ptr);
+	}
 
-out:
 	panwrap_unfreeze_time();
-	UNLOCK();
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		u64 overhead = panwrap_monotonic_ns() - start - kernel_ns;
+
+		ctx->stats.submit_deferred = deferred != NULL;
+		ctx->stats.submits++;
+		ctx->stats.submit_total_ns += overhead;
+		if (overhead > ctx->stats.submit_max_ns)
+			ctx->stats.submit_max_ns = overhead;
+
+		if (ret == 0) {
+			panwrap_events_submit(ctx, ptr, kernel_start);
+			panwrap_atom_graph_submit(ctx, ptr);
+			panwrap_jit_submit(ctx, ptr);
+		}
+	}
+
+	panwrap_context_unlock(ctx);
 	return ret;
 }
 
@@ -925,20 +1464,22 @@ static void inline *panwrap_mmap_wrap(mmap_func *func,
 				      void *addr, size_t length, int prot,
 				      int flags, int fd, off_t offset)
 {
+	struct panwrap_context *ctx;
 	void *ret;
 
-	if (!mali_fd || fd != mali_fd)
+	ctx = panwrap_context_lock(fd);
+	if (!ctx)
 		return func(addr, length, prot, flags, fd, offset);
 
-	LOCK();
 	ret = func(addr, length, prot, flags, fd, offset);
 
 	panwrap_freeze_time();
 	/* offset == gpu_va */
 	panwrap_track_mmap(offset, ret, length, prot, flags);
+	panwrap_capture_mmap(fd, ret, length, prot, flags, offset);
 	panwrap_unfreeze_time();
 
-	UNLOCK();
+	panwrap_context_unlock(ctx);
 	return ret;
 }
 
@@ -968,17 +1509,24 @@ void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 int munmap(void *addr, size_t length)
 {
 	int ret;
+	struct panwrap_context *ctx;
 	struct panwrap_mapped_memory *mem;
 	PROLOG(munmap);
 
-	LOCK();
+	ctx = panwrap_context_lock_mapping(addr);
 	ret = orig_munmap(addr, length);
+	if (!ctx)
+		return ret;
 
 	panwrap_freeze_time();
 
+	/* Someone else unmapped it first */
 	mem = panwrap_find_mapped_mem(addr);
-	if (!mem)
-		goto out;
+	if (!mem) {
+		panwrap_unfreeze_time();
+		panwrap_context_unlock(ctx);
+		return ret;
+	}
 
 	/* Was it memory mapped from the GPU? */
 	if (mem->gpu_va)
@@ -988,10 +1536,222 @@ int munmap(void *addr, size_t length)
 		panwrap_log("Unmapped unknown memory %p\n",
 			    mem->addr);
 
+	panwrap_capture_munmap(addr, length);
+
+	panwrap_context_remove_mapping(ctx, addr);
 	list_del(&mem->node);
 	free(mem);
-out:
+
+	panwrap_unfreeze_time();
+	panwrap_context_unlock(ctx);
+	return ret;
+}
+
+/*
+ * Reading and waiting for job completion events. None of these hold the
+ * context's lock while they block, since another thread could need it to
+ * submit the very jobs that are being waited on.
+ */
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+	struct panwrap_context *ctx;
+	ssize_t ret;
+	u64 start, end;
+	int err;
+	PROLOG(read);
+
+	if (!panwrap_context_tracked(fd))
+		return orig_read(fd, buf, count);
+
+	start = panwrap_monotonic_ns();
+	ret = orig_read(fd, buf, count);
+	end = panwrap_monotonic_ns();
+	err = errno;
+
+	ctx = panwrap_context_lock(fd);
+	if (!ctx || ret < 0)
+		goto out;
+
+	panwrap_freeze_time();
+	panwrap_events_read(ctx, buf, ret, start, end);
 	panwrap_unfreeze_time();
-	UNLOCK();
+
+out:
+	if (ctx)
+		panwrap_context_unlock(ctx);
+	errno = err;
+	return ret;
+}
+
+static void
+panwrap_poll_post(const char *func, const struct pollfd *fds, nfds_t nfds,
+		  int ret, u64 start, u64 end)
+{
+	struct panwrap_context *ctx;
+	int err = errno;
+
+	for (nfds_t i = 0; i < nfds; i++) {
+		if (!panwrap_context_tracked(fds[i].fd))
+			continue;
+
+		ctx = panwrap_context_lock(fds[i].fd);
+		if (!ctx)
+			continue;
+
+		panwrap_freeze_time();
+		panwrap_events_wait(ctx, func,
+				    ret > 0 && (fds[i].revents & POLLIN),
+				    start, end);
+		panwrap_unfreeze_time();
+		panwrap_context_unlock(ctx);
+	}
+
+	errno = err;
+}
+
+int
+poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	u64 start;
+	int ret;
+	PROLOG(poll);
+
+	start = panwrap_monotonic_ns();
+	ret = orig_poll(fds, nfds, timeout);
+	panwrap_poll_post("poll", fds, nfds, ret, start,
+			  panwrap_monotonic_ns());
+
+	return ret;
+}
+
+int
+ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout,
+      const sigset_t *sigmask)
+{
+	u64 start;
+	int ret;
+	PROLOG(ppoll);
+
+	start = panwrap_monotonic_ns();
+	ret = orig_ppoll(fds, nfds, timeout, sigmask);
+	panwrap_poll_post("ppoll", fds, nfds, ret, start,
+			  panwrap_monotonic_ns());
+
+	return ret;
+}
+
+int
+select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+       struct timeval *timeout)
+{
+	struct panwrap_context *ctx;
+	fd_set waited;
+	u64 start, end;
+	int ret, err;
+	PROLOG(select);
+
+	if (!readfds)
+		return orig_select(nfds, readfds, writefds, exceptfds, timeout);
+
+	/* select() overwrites the set with the fds that became ready */
+	waited = *readfds;
+
+	start = panwrap_monotonic_ns();
+	ret = orig_select(nfds, readfds, writefds, exceptfds, timeout);
+	end = panwrap_monotonic_ns();
+	err = errno;
+
+	for (int fd = 0; fd < MIN(nfds, PANWRAP_MAX_FDS); fd++) {
+		if (!FD_ISSET(fd, &waited) || !panwrap_context_tracked(fd))
+			continue;
+
+		ctx = panwrap_context_lock(fd);
+		if (!ctx)
+			continue;
+
+		panwrap_freeze_time();
+		panwrap_events_wait(ctx, "select",
+				    ret > 0 && FD_ISSET(fd, readfds),
+				    start, end);
+		panwrap_unfreeze_time();
+		panwrap_context_unlock(ctx);
+	}
+
+	errno = err;
 	return ret;
 }
+
+int
+epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	int ret;
+	PROLOG(epoll_ctl);
+
+	ret = orig_epoll_ctl(epfd, op, fd, event);
+	if (ret || epfd < 0 || epfd >= PANWRAP_MAX_FDS ||
+	    !panwrap_context_tracked(fd))
+		return ret;
+
+	if (op == EPOLL_CTL_ADD)
+		epoll_watches[epfd] = fd + 1;
+	else if (op == EPOLL_CTL_DEL && epoll_watches[epfd] == fd + 1)
+		epoll_watches[epfd] = 0;
+
+	return ret;
+}
+
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	struct panwrap_context *ctx;
+	bool ready = false;
+	u64 start, end;
+	int ret, err, fd;
+	PROLOG(epoll_wait);
+
+	if (epfd < 0 || epfd >= PANWRAP_MAX_FDS || !epoll_watches[epfd])
+		return orig_epoll_wait(epfd, events, maxevents, timeout);
+
+	fd = epoll_watches[epfd] - 1;
+
+	start = panwrap_monotonic_ns();
+	ret = orig_epoll_wait(epfd, events, maxevents, timeout);
+	end = panwrap_monotonic_ns();
+	err = errno;
+
+	/* The events only carry the application's own data, so we can't tell
+	 * which fd in the set became ready. Any readable one counts, errors
+	 * and hangups don't mean there are events to read. */
+	for (int i = 0; i < ret; i++)
+		ready |= events[i].events & EPOLLIN;
+
+	ctx = panwrap_context_lock(fd);
+	if (ctx) {
+		panwrap_freeze_time();
+		panwrap_events_wait(ctx, "epoll_wait", ready, start, end);
+		panwrap_unfreeze_time();
+		panwrap_context_unlock(ctx);
+	}
+
+	errno = err;
+	return ret;
+}
+
+static void __attribute__((constructor))
+panwrap_syscall_init()
+{
+	const char *path = getenv("PANWRAP_IOCTL_DUMP");
+	const char *format = getenv("PANWRAP_IOCTL_DUMP_FORMAT");
+
+	if (!path)
+		return;
+
+	dump_format = format && strcmp(format, "binary") == 0 ?
+		&ioctl_dump_binary : &ioctl_dump_json;
+
+	dump_file = fopen(path, dump_format == &ioctl_dump_binary ? "wb" : "w");
+	if (!dump_file)
+		panwrap_log("Failed to open %s for dumping ioctls: %s\n",
+			    path, strerror(errno));
+}
@@ -0,0 +1,395 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Tiler heap usage
+ *
+ * The tiler writes its polygon lists to a heap, which the driver allocates
+ * with MALI_MEM_GROW_ON_GPF: only part of it is committed up front, and
+ * whenever the tiler runs past the end of what's committed, it takes a page
+ * fault and stalls while the kernel grows the heap by another extent worth
+ * of pages. With PANWRAP_TILER_HEAP=1, we follow each context's growable
+ * allocations to see how often that happens:
+ *
+ *  - Growable allocations get tracked from MEM_ALLOC, along with any
+ *    MEM_COMMIT calls resizing them.
+ *  - Growth on faults isn't visible to userspace, so at the end of every
+ *    frame (once the completion event of each fragment atom gets read, see
+ *    panwrap-events.c) we ask the kernel for each heap's committed size with
+ *    our own MEM_QUERY. Any growth since the last frame means the tiler used
+ *    up every page committed before it. Fragment atoms that don't report
+ *    completing end their frame when they're submitted instead, and we
+ *    query once more when logging the stats, to catch growth in frames
+ *    whose completion we never saw.
+ *  - Framebuffers tell the tiler which part of the heap it gets, so we also
+ *    note how much of each heap they hand out.
+ *
+ * Each growth gets logged as it's seen, and a report of each heap's committed
+ * size, growth and faults per frame goes along with the other context stats,
+ * together with the tiler's bin size and hierarchy levels from the GPU
+ * properties.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include <mali-job-schema.h>
+#include <pandecode.h>
+#include "panwrap.h"
+
+#define MALI_PAGE_SIZE 4096
+#define MAX_CHAIN_JOBS 256
+
+/* The UK function IDs of type 0x82 ioctls are their numbers plus this */
+#define MALI_UK_FUNC_BASE 512
+
+static bool enabled;
+static int (*real_ioctl)(int fd, int request, ...);
+
+static struct {
+	bool valid;
+	u32 bin_size_bytes;
+	u32 max_active_levels;
+} tiler;
+static pthread_mutex_t tiler_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+panwrap_tiler_heap_set_gpu_props(const struct mali_ioctl_gpu_props_reg_dump *props)
+{
+	pthread_mutex_lock(&tiler_lock);
+	tiler.valid = true;
+	tiler.bin_size_bytes = props->tiler.bin_size_bytes;
+	tiler.max_active_levels = props->tiler.max_active_levels;
+	pthread_mutex_unlock(&tiler_lock);
+}
+
+/* The live heap containing gpu_va, or -1 */
+static int
+tiler_heap_find(const struct panwrap_tiler_heap *th, mali_ptr gpu_va)
+{
+	for (int i = 0; i < th->count; i++) {
+		if (!th->heaps[i].freed && !th->heaps[i].unmapped &&
+		    gpu_va >= th->heaps[i].gpu_va &&
+		    gpu_va < th->heaps[i].gpu_va +
+		    th->heaps[i].va_pages * MALI_PAGE_SIZE)
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+tiler_heap_add(struct panwrap_tiler_heap *th,
+	       const struct mali_ioctl_mem_alloc *args)
+{
+	int i;
+
+	if (!(args->flags & MALI_MEM_GROW_ON_GPF) ||
+	    th->count == PANWRAP_TILER_HEAPS)
+		return;
+
+	i = th->count++;
+	th->heaps[i].gpu_va = args->gpu_va;
+	th->heaps[i].unmapped = args->flags & MALI_MEM_SAME_VA;
+	th->heaps[i].va_pages = args->va_pages;
+	th->heaps[i].extent = args->extent;
+	th->heaps[i].initial_pages = args->commit_pages;
+	th->heaps[i].commit_pages = args->commit_pages;
+	th->heaps[i].peak_pages = args->commit_pages;
+}
+
+static void
+tiler_heap_set_commit(struct panwrap_tiler_heap *th, int i, u64 pages,
+		      bool faulted)
+{
+	typeof(th->heaps[0]) *h = &th->heaps[i];
+	u64 faults;
+
+	if (faulted && pages > h->commit_pages) {
+		faults = (pages - h->commit_pages + MAX(h->extent, 1) - 1) /
+			MAX(h->extent, 1);
+
+		panwrap_log("Tiler heap @ " MALI_PTR_FORMAT " grew from %" PRIu64 " to %" PRIu64 " pages in frame %" PRIu64 " (~%" PRIu64 " fault%s), after using all %" PRIu64 " committed pages\n",
+			    h->gpu_va, h->commit_pages, pages, th->frames,
+			    faults, faults == 1 ? "" : "s", h->commit_pages);
+
+		h->growths++;
+		h->grown_pages += pages - h->commit_pages;
+		h->faults += faults;
+		th->frame_faults += faults;
+	}
+
+	h->commit_pages = pages;
+	h->peak_pages = MAX(h->peak_pages, pages);
+}
+
+/* Ask the kernel how many pages of each heap are committed by now */
+static void
+tiler_heap_sample(struct panwrap_context *ctx)
+{
+	struct panwrap_tiler_heap *th = &ctx->tiler_heap;
+
+	if (!real_ioctl)
+		real_ioctl = __rd_dlsym_helper("ioctl");
+
+	for (int i = 0; i < th->count; i++) {
+		struct mali_ioctl_mem_query query = {
+			.header.id = MALI_UK_FUNC_BASE +
+				_IOC_NR(MALI_IOCTL_MEM_QUERY),
+			.gpu_addr = th->heaps[i].gpu_va,
+			.query = MALI_MEM_QUERY_COMMIT_SIZE,
+		};
+
+		if (th->heaps[i].freed || th->heaps[i].unmapped)
+			continue;
+
+		if (real_ioctl(ctx->fd, MALI_IOCTL_MEM_QUERY, &query) == 0 &&
+		    query.header.rc == MALI_ERROR_NONE)
+			tiler_heap_set_commit(th, i, query.value, true);
+	}
+}
+
+static const void *
+tiler_heap_resolve(void *data, mali_ptr gpu_va, size_t size)
+{
+	return panwrap_try_deref_gpu_mem(gpu_va, size);
+}
+
+static bool
+tiler_heap_visit_job(void *data, int index, mali_ptr gpu_va,
+		     const struct mali_job_descriptor_header *h)
+{
+	struct mali_job_descriptor_header_unpacked hu;
+
+	mali_job_descriptor_header_unpack(h, &hu);
+	return hu.job_type == JOB_TYPE_FRAGMENT;
+}
+
+static void
+tiler_heap_visit_framebuffer(void *data, mali_ptr gpu_va,
+			     const struct mali_framebuffer *fb,
+			     const struct mali_framebuffer_extra *extra,
+			     const struct mali_render_target *rts)
+{
+	struct panwrap_tiler_heap *th = data;
+	struct mali_framebuffer_unpacked fu;
+	int i;
+
+	mali_framebuffer_unpack(fb, &fu);
+
+	i = tiler_heap_find(th, fu.tiler_heap_start);
+	if (i >= 0 && fu.tiler_heap_end > fu.tiler_heap_start)
+		th->heaps[i].tiler_bytes =
+			fu.tiler_heap_end - fu.tiler_heap_start;
+}
+
+static const struct pandecode_visitor tiler_heap_visitor = {
+	.job = tiler_heap_visit_job,
+	.framebuffer = tiler_heap_visit_framebuffer,
+};
+
+static void
+tiler_heap_end_frame(struct panwrap_context *ctx)
+{
+	struct panwrap_tiler_heap *th = &ctx->tiler_heap;
+
+	if (!th->count)
+		return;
+
+	tiler_heap_sample(ctx);
+
+	th->frames++;
+	if (th->frame_faults)
+		th->frames_with_growth++;
+	th->max_frame_faults = MAX(th->max_frame_faults, th->frame_faults);
+	th->frame_faults = 0;
+}
+
+static void
+tiler_heap_submit(struct panwrap_context *ctx,
+		  const struct mali_ioctl_job_submit *args)
+{
+	struct panwrap_tiler_heap *th = &ctx->tiler_heap;
+	const struct mali_jd_atom_v2 *atoms = args->addr;
+	struct pandecode_context decode = {
+		.resolve = tiler_heap_resolve,
+		.visitor = &tiler_heap_visitor,
+		.data = th,
+		.max_jobs = MAX_CHAIN_JOBS,
+	};
+	bool frame_done = false;
+
+	if (args->stride != sizeof(*atoms))
+		return;
+
+	for (int i = 0; i < args->nr_atoms; i++) {
+		const struct mali_jd_atom_v2 *a = &atoms[i];
+
+		if ((a->core_req & MALI_JD_REQ_SOFT_JOB) ||
+		    !(a->core_req & MALI_JD_REQ_FS))
+			continue;
+
+		if (a->jc)
+			pandecode_chain(&decode, a->jc);
+
+		/* The frame has only been queued so far */
+		if (a->core_req & (MALI_JD_REQ_EVENT_NEVER |
+				   MALI_JD_REQ_EVENT_ONLY_ON_FAILURE))
+			frame_done = true;
+		else
+			th->fragment_atoms[a->atom_number] = true;
+	}
+
+	if (frame_done)
+		tiler_heap_end_frame(ctx);
+}
+
+/**
+ * Note that atom atom_number of ctx completed, ending a frame if it was a
+ * fragment atom.
+ */
+void
+panwrap_tiler_heap_complete(struct panwrap_context *ctx, u8 atom_number)
+{
+	struct panwrap_tiler_heap *th = &ctx->tiler_heap;
+
+	if (!enabled || !th->fragment_atoms[atom_number])
+		return;
+
+	th->fragment_atoms[atom_number] = false;
+	tiler_heap_end_frame(ctx);
+}
+
+/**
+ * SAME_VA allocations only get their GPU VA once they're mmap()ed, until then
+ * MEM_ALLOC hands out a cookie for the mmap() offset instead.
+ */
+void
+panwrap_tiler_heap_mmap(struct panwrap_context *ctx, mali_ptr cookie,
+			mali_ptr gpu_va)
+{
+	struct panwrap_tiler_heap *th = &ctx->tiler_heap;
+
+	for (int i = 0; i < th->count; i++) {
+		if (th->heaps[i].unmapped && th->heaps[i].gpu_va == cookie) {
+			th->heaps[i].gpu_va = gpu_va;
+			th->heaps[i].unmapped = false;
+			break;
+		}
+	}
+}
+
+/**
+ * Follow whatever a successful ioctl on ctx does to its tiler heaps.
+ */
+void
+panwrap_tiler_heap_ioctl(struct panwrap_context *ctx,
+			 unsigned long int request, const void *ptr)
+{
+	struct panwrap_tiler_heap *th = &ctx->tiler_heap;
+	const union mali_ioctl_header *header = ptr;
+	int i;
+
+	if (!enabled || !ptr || header->rc != MALI_ERROR_NONE)
+		return;
+
+	if (IOCTL_MATCHES(request, MALI_IOCTL_JOB_SUBMIT)) {
+		tiler_heap_submit(ctx, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_ALLOC)) {
+		tiler_heap_add(th, ptr);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_COMMIT)) {
+		const struct mali_ioctl_mem_commit *args = ptr;
+
+		i = tiler_heap_find(th, args->gpu_addr);
+		if (i >= 0) {
+			th->heaps[i].commits++;
+			tiler_heap_set_commit(th, i, args->pages, false);
+		}
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_QUERY)) {
+		const struct mali_ioctl_mem_query *args = ptr;
+
+		i = tiler_heap_find(th, args->gpu_addr);
+		if (i >= 0 && args->query == MALI_MEM_QUERY_COMMIT_SIZE)
+			tiler_heap_set_commit(th, i, args->value, true);
+	} else if (IOCTL_MATCHES(request, MALI_IOCTL_MEM_FREE)) {
+		const struct mali_ioctl_mem_free *args = ptr;
+
+		i = tiler_heap_find(th, args->gpu_addr);
+		if (i >= 0)
+			th->heaps[i].freed = true;
+	}
+}
+
+void
+panwrap_tiler_heap_log_stats(struct panwrap_context *ctx)
+{
+	struct panwrap_tiler_heap *th = &ctx->tiler_heap;
+
+	if (!th->count)
+		return;
+
+	/* Whatever grew after the last frame we saw complete */
+	tiler_heap_sample(ctx);
+	if (th->frame_faults) {
+		th->frames_with_growth++;
+		th->max_frame_faults = MAX(th->max_frame_faults,
+					   th->frame_faults);
+		th->frame_faults = 0;
+	}
+
+	panwrap_log("Tiler heaps on context %u over %" PRIu64 " frames",
+		    ctx->id, th->frames);
+	pthread_mutex_lock(&tiler_lock);
+	if (tiler.valid)
+		panwrap_log_cont(", with %u byte bins and %u hierarchy levels",
+				 tiler.bin_size_bytes,
+				 tiler.max_active_levels);
+	pthread_mutex_unlock(&tiler_lock);
+	panwrap_log_cont(":\n");
+	panwrap_indent++;
+
+	for (int i = 0; i < th->count; i++) {
+		const typeof(th->heaps[0]) *h = &th->heaps[i];
+
+		panwrap_log(MALI_PTR_FORMAT ": %" PRIu64 " of %" PRIu64 " pages committed at first, %" PRIu64 " at peak, %" PRIu64 " at the end, grown %" PRIu64 " times by %" PRIu64 " pages (~%" PRIu64 " faults, extent %" PRIu64 ")",
+			    h->gpu_va, h->initial_pages, h->va_pages,
+			    h->peak_pages, h->commit_pages, h->growths,
+			    h->grown_pages, h->faults, h->extent);
+		if (h->commits)
+			panwrap_log_cont(", resized %" PRIu64 " times with MEM_COMMIT",
+					 h->commits);
+		if (h->tiler_bytes)
+			panwrap_log_cont(", %" PRIu64 " bytes given to the tiler",
+					 h->tiler_bytes);
+		panwrap_log_cont("\n");
+
+		if (h->faults)
+			panwrap_log("Committing %" PRIu64 " pages up front would have avoided every fault\n",
+				    h->peak_pages);
+	}
+
+	if (th->frames)
+		panwrap_log("Heaps grew in %" PRIu64 " of %" PRIu64 " frames, with up to ~%" PRIu64 " faults in one frame\n",
+			    th->frames_with_growth, th->frames,
+			    th->max_frame_faults);
+
+	panwrap_indent--;
+}
+
+static void __attribute__((constructor))
+panwrap_tiler_heap_init()
+{
+	enabled = panwrap_parse_env_bool("PANWRAP_TILER_HEAP", false);
+}
@@ -0,0 +1,66 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_TILER_HEAP_H__
+#define __PANWRAP_TILER_HEAP_H__
+
+#include <stdbool.h>
+#include <mali-ioctl.h>
+
+struct panwrap_context;
+
+#define PANWRAP_TILER_HEAPS 16
+
+/* The growable allocations of one context, see panwrap-tiler-heap.c */
+struct panwrap_tiler_heap {
+	struct {
+		mali_ptr gpu_va;
+		u64 va_pages;
+		u64 extent;
+		bool freed;
+
+		/* SAME_VA, and gpu_va is still the mmap() cookie */
+		bool unmapped;
+
+		u64 initial_pages;
+		u64 commit_pages;
+		u64 peak_pages;
+		u64 growths;
+		u64 grown_pages;
+		u64 faults;
+		u64 commits;
+
+		/* How much of it the last framebuffer using it gave the tiler */
+		u64 tiler_bytes;
+	} heaps[PANWRAP_TILER_HEAPS];
+	int count;
+
+	/* Fragment atoms whose completion ends a frame */
+	bool fragment_atoms[256];
+
+	u64 frames;
+	u64 frame_faults;
+	u64 frames_with_growth;
+	u64 max_frame_faults;
+};
+
+void panwrap_tiler_heap_set_gpu_props(const struct mali_ioctl_gpu_props_reg_dump *props);
+void panwrap_tiler_heap_ioctl(struct panwrap_context *ctx,
+			      unsigned long int request, const void *ptr);
+void panwrap_tiler_heap_mmap(struct panwrap_context *ctx, mali_ptr cookie,
+			     mali_ptr gpu_va);
+void panwrap_tiler_heap_complete(struct panwrap_context *ctx, u8 atom_number);
+void panwrap_tiler_heap_log_stats(struct panwrap_context *ctx);
+
+#endif /* __PANWRAP_TILER_HEAP_H__ */
@@ -0,0 +1,192 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * GPU timeline
+ *
+ * Out of the submission and completion times from panwrap-events.c, we
+ * rebuild when each context had work queued on the GPU. Whenever it has at
+ * least one atom in flight the GPU counts as busy, and the gaps between the
+ * last atom completing and the next submission are idle bubbles. Together
+ * with the time the application spent blocked waiting on events, that's
+ * usually enough to tell whether it's CPU-bound or GPU-bound.
+ *
+ * Completions are only seen once the application asks for them, so busy time
+ * is an upper bound. Soft jobs and atoms that never send events aren't
+ * counted as in flight. Each fragment atom submitted ends a frame, and with
+ * PANWRAP_TIMELINE_FRAMES=1 every frame gets its own line in the log.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "panwrap.h"
+
+static bool log_frames;
+
+static u64
+timeline_now(struct panwrap_timeline *tl, u64 ns)
+{
+	/* Completion times are estimates, don't let them go backwards */
+	tl->last_ns = MAX(tl->last_ns, ns);
+	return tl->last_ns;
+}
+
+static void
+totals_add_busy(struct panwrap_timeline *tl, u64 ns)
+{
+	tl->frame.busy_ns += ns;
+	tl->total.busy_ns += ns;
+}
+
+static void
+totals_add_bubble(struct panwrap_timeline_totals *t, u64 ns)
+{
+	t->idle_ns += ns;
+	t->bubbles++;
+	t->max_bubble_ns = MAX(t->max_bubble_ns, ns);
+}
+
+static void
+totals_add_submit(struct panwrap_timeline_totals *t, int depth)
+{
+	t->submits++;
+	t->depth_sum += depth;
+	t->max_depth = MAX(t->max_depth, depth);
+}
+
+static void
+timeline_end_frame(struct panwrap_context *ctx, u64 ns)
+{
+	struct panwrap_timeline *tl = &ctx->timeline;
+	const struct panwrap_timeline_totals *f = &tl->frame;
+	u64 length = ns - f->start_ns;
+
+	/* Split any busy period still going between the two frames */
+	if (tl->in_flight) {
+		totals_add_busy(tl, ns - tl->busy_since);
+		tl->busy_since = ns;
+	}
+
+	tl->frames++;
+
+	if (log_frames) {
+		panwrap_log("Frame %" PRIu64 ": %.3f ms, GPU busy %.1f%%, %" PRIu64 " bubbles (longest %.3f ms), CPU blocked %.3f ms, queue depth avg %.2f max %d\n",
+			    tl->frames, length / 1000000.0,
+			    length ? f->busy_ns * 100.0 / length : 0.0,
+			    f->bubbles, f->max_bubble_ns / 1000000.0,
+			    f->blocked_ns / 1000000.0,
+			    (double) f->depth_sum / f->submits, f->max_depth);
+	}
+
+	tl->frame = (struct panwrap_timeline_totals) { .start_ns = ns };
+}
+
+/**
+ * Note a successful JOB_SUBMIT, with the number of atoms in it that will
+ * occupy the GPU until their completion events arrive.
+ */
+void
+panwrap_timeline_submit(struct panwrap_context *ctx, u64 ns, int atoms,
+			bool fragment)
+{
+	struct panwrap_timeline *tl = &ctx->timeline;
+
+	ns = timeline_now(tl, ns);
+	if (!tl->total.start_ns)
+		tl->total.start_ns = tl->frame.start_ns = ns;
+
+	if (atoms && !tl->in_flight) {
+		if (tl->idle_since) {
+			totals_add_bubble(&tl->frame, ns - tl->idle_since);
+			totals_add_bubble(&tl->total, ns - tl->idle_since);
+		}
+		tl->busy_since = ns;
+	}
+
+	tl->in_flight += atoms;
+	totals_add_submit(&tl->frame, tl->in_flight);
+	totals_add_submit(&tl->total, tl->in_flight);
+
+	if (fragment)
+		timeline_end_frame(ctx, ns);
+}
+
+void
+panwrap_timeline_complete(struct panwrap_context *ctx, u64 ns, int atoms)
+{
+	struct panwrap_timeline *tl = &ctx->timeline;
+
+	if (!atoms || !tl->in_flight)
+		return;
+
+	ns = timeline_now(tl, ns);
+	tl->in_flight = MAX(tl->in_flight - atoms, 0);
+
+	if (!tl->in_flight) {
+		totals_add_busy(tl, ns - tl->busy_since);
+		tl->idle_since = ns;
+	}
+}
+
+void
+panwrap_timeline_blocked(struct panwrap_context *ctx, u64 ns)
+{
+	ctx->timeline.frame.blocked_ns += ns;
+	ctx->timeline.total.blocked_ns += ns;
+}
+
+void
+panwrap_timeline_log_stats(const struct panwrap_context *ctx)
+{
+	const struct panwrap_timeline *tl = &ctx->timeline;
+	const struct panwrap_timeline_totals *t = &tl->total;
+	u64 length = tl->last_ns - t->start_ns;
+	u64 busy = t->busy_ns;
+	double busy_pct, blocked_pct;
+
+	if (!t->submits || !length)
+		return;
+
+	if (tl->in_flight)
+		busy += tl->last_ns - tl->busy_since;
+
+	busy_pct = busy * 100.0 / length;
+	blocked_pct = t->blocked_ns * 100.0 / length;
+
+	panwrap_log("GPU timeline on context %u: %.3f ms, %" PRIu64 " frames\n",
+		    ctx->id, length / 1000000.0, tl->frames);
+	panwrap_indent++;
+	panwrap_log("GPU busy %.3f ms (%.1f%%), idle %.3f ms in %" PRIu64 " bubbles, longest %.3f ms\n",
+		    busy / 1000000.0, busy_pct, t->idle_ns / 1000000.0,
+		    t->bubbles, t->max_bubble_ns / 1000000.0);
+	panwrap_log("CPU blocked on the GPU %.3f ms (%.1f%%)\n",
+		    t->blocked_ns / 1000000.0, blocked_pct);
+	panwrap_log("Queue depth at submission avg %.2f, max %d\n",
+		    (double) t->depth_sum / t->submits, t->max_depth);
+
+	if (busy_pct >= 90.0)
+		panwrap_log("The GPU was almost never idle, this looks GPU-bound\n");
+	else if (blocked_pct >= 50.0)
+		panwrap_log("The CPU waited on the GPU while it sat idle, submissions look serialized\n");
+	else
+		panwrap_log("The GPU sat idle waiting for work, this looks CPU-bound\n");
+	panwrap_indent--;
+}
+
+static void __attribute__((constructor))
+panwrap_timeline_init()
+{
+	log_frames = panwrap_parse_env_bool("PANWRAP_TIMELINE_FRAMES", false);
+}
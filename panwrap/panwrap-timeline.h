@@ -0,0 +1,53 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_TIMELINE_H__
+#define __PANWRAP_TIMELINE_H__
+
+#include <stdbool.h>
+#include <panloader-util.h>
+
+struct panwrap_context;
+
+struct panwrap_timeline_totals {
+	u64 start_ns;
+	u64 busy_ns;
+	u64 idle_ns;
+	u64 blocked_ns;
+	u64 bubbles;
+	u64 max_bubble_ns;
+	u64 submits;
+	u64 depth_sum;
+	int max_depth;
+};
+
+/* GPU busy/idle tracking for one context, see panwrap-timeline.c */
+struct panwrap_timeline {
+	int in_flight;
+	u64 last_ns;
+	u64 busy_since;
+	u64 idle_since;
+
+	u64 frames;
+	struct panwrap_timeline_totals frame, total;
+};
+
+void panwrap_timeline_submit(struct panwrap_context *ctx, u64 ns,
+			     int atoms, bool fragment);
+void panwrap_timeline_complete(struct panwrap_context *ctx, u64 ns,
+			       int atoms);
+void panwrap_timeline_blocked(struct panwrap_context *ctx, u64 ns);
+void panwrap_timeline_log_stats(const struct panwrap_context *ctx);
+
+#endif /* __PANWRAP_TIMELINE_H__ */
@@ -12,6 +12,8 @@
  *
  */
 
+#define _GNU_SOURCE /* For RTLD_NEXT */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -20,6 +22,7 @@
 #include <errno.h>
 #include <time.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "panwrap.h"
 
 #define HEXDUMP_COL_LEN  4
@@ -28,11 +31,38 @@
 static bool enable_timestamps = false,
 	    enable_hexdump_trimming = true;
 
-static bool time_is_frozen = false;
+static __thread bool time_is_frozen = false;
 static struct timespec start_time;
-static struct timespec total_time_frozen, start_freeze_time, frozen_timestamp;
+static struct timespec total_time_frozen;
+static __thread struct timespec start_freeze_time, frozen_timestamp;
+static pthread_mutex_t time_lock = PTHREAD_MUTEX_INITIALIZER;
 static FILE *log_output;
-short panwrap_indent = 0;
+__thread short panwrap_indent = 0;
+
+/*
+ * Each thread builds up its log lines in its own buffer, and only writes them
+ * out once they're complete. This keeps lines from different threads from
+ * getting mixed together, and lets us hand them off to the deferred decoding
+ * thread instead of writing them ourselves.
+ */
+static __thread struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} log_line;
+
+/* Frees each thread's log line buffer when the thread exits */
+static pthread_key_t log_line_key;
+static pthread_once_t log_line_key_once = PTHREAD_ONCE_INIT;
+
+/* Overrides the timestamp for log lines printed from the current thread */
+static __thread const struct timespec *log_timestamp;
+
+/* Where complete lines from the current thread go instead, if anywhere */
+static __thread struct panwrap_log_buffer *log_capture;
+
+/* Whether to drop whatever the current thread logs */
+static __thread bool log_muted;
 
 void
 panwrap_log_decoded_flags(const struct panwrap_flag_info *flag_info,
@@ -66,6 +96,17 @@ panwrap_log_decoded_flags(const struct panwrap_flag_info *flag_info,
 	}
 }
 
+const char *
+panwrap_enum_name(const struct panwrap_enum_info *enum_info, u64 value)
+{
+	for (int i = 0; enum_info[i].name; i++) {
+		if (enum_info[i].value == value)
+			return enum_info[i].name;
+	}
+
+	return "???";
+}
+
 void
 panwrap_log_hexdump(const void *data, size_t size)
 {
@@ -145,8 +186,9 @@ out:
 }
 
 /**
- * Grab the location of a symbol from the system's libc instead of our
- * preloaded one
+ * Grab the location of a symbol from the next library that provides it instead
+ * of our preloaded one. Usually that's the system's libc, but it could also be
+ * another preloaded library such as panfake.
  */
 void *
 __rd_dlsym_helper(const char *name)
@@ -154,6 +196,12 @@ __rd_dlsym_helper(const char *name)
 	static void *libc_dl;
 	void *func;
 
+#ifdef RTLD_NEXT
+	func = dlsym(RTLD_NEXT, name);
+	if (func)
+		return func;
+#endif
+
 	if (!libc_dl)
 		libc_dl = dlopen("libc.so", RTLD_LAZY);
 	if (!libc_dl) {
@@ -217,6 +265,10 @@ __get_monotonic_time(const char *file, int line, struct timespec *tp)
  * panwrap's code.
  *
  * tl;dr: any time that passes while frozen is removed from timestamps
+ *
+ * Each thread freezes time on its own, but the time spent frozen gets removed
+ * from everyone's timestamps. This is only exact while one thread at a time is
+ * inside of panwrap, which is good enough to keep timestamps monotonic.
  */
 void
 panwrap_freeze_time()
@@ -233,7 +285,9 @@ panwrap_freeze_time()
 	 */
 	frozen_timestamp = start_freeze_time;
 	timespec_subtract(&frozen_timestamp, &start_time);
+	pthread_mutex_lock(&time_lock);
 	timespec_subtract(&frozen_timestamp, &total_time_frozen);
+	pthread_mutex_unlock(&time_lock);
 }
 
 void
@@ -248,12 +302,19 @@ panwrap_unfreeze_time()
 	get_monotonic_time(&time_spent_frozen);
 
 	timespec_subtract(&time_spent_frozen, &start_freeze_time);
+	pthread_mutex_lock(&time_lock);
 	timespec_add(&total_time_frozen, &time_spent_frozen);
+	pthread_mutex_unlock(&time_lock);
 }
 
 static void inline
 timestamp_get(struct timespec *tp)
 {
+	if (log_timestamp) {
+		*tp = *log_timestamp;
+		return;
+	}
+
 	if (time_is_frozen) {
 		*tp = frozen_timestamp;
 		return;
@@ -261,7 +322,173 @@ timestamp_get(struct timespec *tp)
 
 	get_monotonic_time(tp);
 	timespec_subtract(tp, &start_time);
+	pthread_mutex_lock(&time_lock);
 	timespec_subtract(tp, &total_time_frozen);
+	pthread_mutex_unlock(&time_lock);
+}
+
+/**
+ * Get the current timestamp, in the same timebase that's used for log output
+ */
+void
+panwrap_timestamp_get(struct timespec *tp)
+{
+	if (!enable_timestamps) {
+		tp->tv_sec = tp->tv_nsec = 0;
+		return;
+	}
+
+	timestamp_get(tp);
+}
+
+/**
+ * Make all log lines from the current thread use the given timestamp, or go
+ * back to using the current time if tp is NULL. Used when logging things long
+ * after they actually happened.
+ */
+void
+panwrap_log_set_timestamp(const struct timespec *tp)
+{
+	log_timestamp = tp;
+}
+
+u64
+panwrap_monotonic_ns()
+{
+	struct timespec tp;
+
+	get_monotonic_time(&tp);
+
+	return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void
+panwrap_log_output(const char *text, size_t len)
+{
+	if (panwrap_deferred_should_queue())
+		panwrap_deferred_queue_text(text, len);
+	else
+		fwrite(text, 1, len, log_output);
+}
+
+static void
+panwrap_log_write_line()
+{
+	struct panwrap_log_buffer *b = log_capture;
+
+	if (!log_line.len)
+		return;
+
+	if (!b) {
+		panwrap_log_output(log_line.buf, log_line.len);
+	} else {
+		if (b->len + log_line.len > b->size) {
+			b->size = MAX(b->size * 2, b->len + log_line.len);
+			b->text = realloc(b->text, b->size);
+			if (!b->text) {
+				fprintf(stderr, "Failed to grow panwrap log buffer\n");
+				exit(1);
+			}
+		}
+
+		memcpy(b->text + b->len, log_line.buf, log_line.len);
+		b->len += log_line.len;
+	}
+
+	log_line.len = 0;
+}
+
+static void
+panwrap_log_line_free(void *buf)
+{
+	free(buf);
+	log_line.buf = NULL;
+	log_line.size = log_line.len = 0;
+}
+
+static void
+panwrap_log_line_key_create()
+{
+	pthread_key_create(&log_line_key, panwrap_log_line_free);
+}
+
+/**
+ * Collect complete log lines from the current thread in buf instead of
+ * writing them out, until this is called again with NULL. The lines can be
+ * written out later with panwrap_log_buffer_write().
+ */
+void
+panwrap_log_capture(struct panwrap_log_buffer *buf)
+{
+	log_capture = buf;
+}
+
+/**
+ * Drop whatever the current thread logs until this is called again with
+ * false. Decoders use this to go over something they've already logged once
+ * just for the statistics they keep.
+ */
+void
+panwrap_log_mute(bool mute)
+{
+	log_muted = mute;
+}
+
+/**
+ * Write out the lines collected in buf as if they were just logged from the
+ * current thread, and free them.
+ */
+void
+panwrap_log_buffer_write(struct panwrap_log_buffer *buf)
+{
+	if (buf->len)
+		panwrap_log_output(buf->text, buf->len);
+
+	free(buf->text);
+	buf->text = NULL;
+	buf->len = buf->size = 0;
+}
+
+static void
+panwrap_log_vappend(const char *format, va_list ap)
+{
+	va_list ap_copy;
+	int len;
+
+	for (;;) {
+		va_copy(ap_copy, ap);
+		len = vsnprintf(log_line.buf + log_line.len,
+				log_line.size - log_line.len, format, ap_copy);
+		va_end(ap_copy);
+
+		if (len < 0)
+			return;
+		if (log_line.len + len < log_line.size)
+			break;
+
+		log_line.size = (log_line.len + len + 1) * 2;
+		log_line.buf = realloc(log_line.buf, log_line.size);
+		if (!log_line.buf) {
+			fprintf(stderr, "Failed to grow panwrap log buffer\n");
+			exit(1);
+		}
+		pthread_once(&log_line_key_once, panwrap_log_line_key_create);
+		pthread_setspecific(log_line_key, log_line.buf);
+	}
+
+	log_line.len += len;
+	if (log_line.buf[log_line.len - 1] == '\n')
+		panwrap_log_write_line();
+}
+
+static void __attribute__((format (printf, 1, 2)))
+panwrap_log_append(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	panwrap_log_vappend(format, ap);
+	va_end(ap);
 }
 
 void
@@ -270,38 +497,56 @@ panwrap_log(const char *format, ...)
 	struct timespec tp;
 	va_list ap;
 
+	if (log_muted)
+		return;
+
 	if (enable_timestamps) {
 		timestamp_get(&tp);
-		fprintf(log_output,
-			"panwrap [%.8lf]: ", tp.tv_sec + tp.tv_nsec / 1e+9F);
+		panwrap_log_append("panwrap [%.8lf]: ",
+				   tp.tv_sec + tp.tv_nsec / 1e+9F);
 	} else {
-		fprintf(log_output, "panwrap: ");
+		panwrap_log_append("panwrap: ");
 	}
 
 	for (int i = 0; i < panwrap_indent; i++) {
-		fputs("  ", log_output);
+		panwrap_log_append("  ");
 	}
 
 	va_start(ap, format);
-	vfprintf(log_output, format, ap);
+	panwrap_log_vappend(format, ap);
 	va_end(ap);
 }
 
-/* Eventually this function might do more */
 void
 panwrap_log_cont(const char *format, ...)
 {
 	va_list ap;
 
+	if (log_muted)
+		return;
+
 	va_start(ap, format);
-	vfprintf(log_output, format, ap);
+	panwrap_log_vappend(format, ap);
 	va_end(ap);
 }
 
+/**
+ * Write raw text straight to the log output, bypassing the line buffers. Only
+ * meant for the deferred decoding thread.
+ */
+void
+panwrap_log_write(const char *text, size_t len)
+{
+	fwrite(text, 1, len, log_output);
+}
+
 void
 panwrap_log_flush()
 {
-	fflush(log_output);
+	panwrap_log_write_line();
+
+	if (!panwrap_deferred_should_queue())
+		fflush(log_output);
 }
 
 /* Some functions for debugging in gdb */
@@ -313,8 +558,8 @@ panwrap_download_mem(void *p, size_t s)
 	return cpy;
 }
 
-static bool
-parse_env_bool(const char *env, bool def)
+bool
+panwrap_parse_env_bool(const char *env, bool def)
 {
 	const char *val = getenv(env);
 
@@ -333,12 +578,35 @@ parse_env_bool(const char *env, bool def)
 	exit(1);
 }
 
+long
+panwrap_parse_env_long(const char *env, long def)
+{
+	const char *val = getenv(env);
+	char *end;
+	long ret;
+
+	if (!val)
+		return def;
+
+	errno = 0;
+	ret = strtol(val, &end, 0);
+	if (errno || end == val || *end != '\0') {
+		fprintf(stderr,
+			"Invalid value for %s: %s\n"
+			"Value must be an integer\n",
+			env, val);
+		exit(1);
+	}
+
+	return ret;
+}
+
 static void __attribute__((constructor))
 panwrap_util_init()
 {
 	const char *env;
 
-	if (parse_env_bool("PANWRAP_ENABLE_TIMESTAMPS", false)) {
+	if (panwrap_parse_env_bool("PANWRAP_ENABLE_TIMESTAMPS", false)) {
 		enable_timestamps = true;
 		if (clock_gettime(CLOCK_MONOTONIC, &start_time)) {
 			fprintf(stderr,
@@ -348,8 +616,8 @@ panwrap_util_init()
 		}
 	}
 
-	enable_hexdump_trimming = parse_env_bool("PANWRAP_ENABLE_HEXDUMP_TRIM",
-						 true);
+	enable_hexdump_trimming =
+		panwrap_parse_env_bool("PANWRAP_ENABLE_HEXDUMP_TRIM", true);
 
 	env = getenv("PANWRAP_OUTPUT");
 	if (env) {
@@ -370,3 +638,20 @@ panwrap_util_init()
 		log_output = stdout;
 	}
 }
+
+/**
+ * 64-bit FNV-1a. Pass PANWRAP_HASH_INIT to start a new hash, or a previous
+ * result to keep hashing more data into it.
+ */
+u64
+panwrap_hash(const void *data, size_t size, u64 hash)
+{
+	const unsigned char *d = data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= d[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
@@ -0,0 +1,237 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Parallel decoding
+ *
+ * A single JOB_SUBMIT can carry a lot of atoms, each with its own job chain
+ * to decode. With PANWRAP_DECODE_THREADS=n, a pool of n - 1 worker threads
+ * helps the submitting thread decode them: each atom gets decoded into its
+ * own log buffer, and once they're all done the buffers get written out in
+ * atom order, so the log looks the same as when decoding one atom at a time.
+ *
+ * Workers act on behalf of the submitting thread, so they see the same
+ * context, memory snapshot, timestamp and indentation it does, and the
+ * submitting thread keeps holding the context's lock until they're done.
+ * Anything the decoders keep across atoms would see them in whatever order
+ * the workers get to them, so payload numbers and the like would change from
+ * one run to the next. Instead, each parallel batch gets an ID, and while it
+ * runs the decoders leave out whatever depends on the order: the decode cache
+ * and the attribute history are bypassed, render passes aren't compared with
+ * the one before, and the shader store dumps a shader for every atom of the
+ * batch that uses it. That way the log only depends on what got submitted.
+ *
+ * Only one submit gets decoded in parallel at a time. If another thread
+ * submits in the meantime, it just decodes its atoms by itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "panwrap.h"
+
+#define MAX_THREADS 64
+
+struct workers_batch {
+	unsigned int id;
+	void (*func)(void *data, int i);
+	void *data;
+	int count;
+	int next;
+	int done;
+	struct panwrap_log_buffer *logs;
+
+	/* What the workers inherit from the submitting thread */
+	struct panwrap_context *ctx;
+	const struct panwrap_snapshot *snapshot;
+	struct timespec timestamp;
+	short indent;
+};
+
+static int nr_threads;
+static pthread_t threads[MAX_THREADS];
+static int threads_started;
+static bool stopping;
+static unsigned int last_batch_id;
+
+static __thread unsigned int current_batch_id;
+
+static pthread_once_t threads_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct workers_batch *batch;
+
+static void
+workers_run_item(struct workers_batch *b, int i, bool inherit)
+{
+	short indent = panwrap_indent;
+
+	if (inherit) {
+		panwrap_context_set_current(b->ctx);
+		panwrap_snapshot_use(b->snapshot);
+		panwrap_log_set_timestamp(&b->timestamp);
+		panwrap_indent = b->indent;
+	}
+
+	current_batch_id = b->id;
+	panwrap_log_capture(&b->logs[i]);
+	b->func(b->data, i);
+	panwrap_log_capture(NULL);
+	current_batch_id = 0;
+
+	if (inherit) {
+		panwrap_log_set_timestamp(NULL);
+		panwrap_snapshot_use(NULL);
+		panwrap_context_set_current(NULL);
+	}
+
+	panwrap_indent = indent;
+}
+
+static void *
+workers_thread(void *data)
+{
+	struct workers_batch *b;
+	int i;
+
+	pthread_mutex_lock(&queue_lock);
+	for (;;) {
+		while (!stopping && !(batch && batch->next < batch->count))
+			pthread_cond_wait(&work_cond, &queue_lock);
+
+		if (stopping)
+			break;
+
+		b = batch;
+		i = b->next++;
+		pthread_mutex_unlock(&queue_lock);
+
+		workers_run_item(b, i, true);
+
+		pthread_mutex_lock(&queue_lock);
+		if (++b->done == b->count)
+			pthread_cond_signal(&done_cond);
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	return NULL;
+}
+
+static void
+workers_start_threads()
+{
+	for (int i = 0; i < nr_threads - 1; i++) {
+		int ret = pthread_create(&threads[i], NULL, workers_thread,
+					 NULL);
+
+		if (ret) {
+			fprintf(stderr, "Failed to start decoding worker: %s\n",
+				strerror(ret));
+			break;
+		}
+
+		threads_started++;
+	}
+}
+
+/**
+ * Call func(data, i) for every i in [0, count), spread across the worker
+ * threads if there are any. Whatever each call logs comes out in order of i,
+ * as if they were all made one after another from the calling thread.
+ */
+void
+panwrap_workers_run(int count, void (*func)(void *data, int i), void *data)
+{
+	struct workers_batch b = {
+		.func = func,
+		.data = data,
+		.count = count,
+		.ctx = panwrap_context_current(),
+		.snapshot = panwrap_snapshot_current(),
+		.indent = panwrap_indent,
+	};
+
+	if (nr_threads <= 1 || count <= 1 ||
+	    pthread_mutex_trylock(&batch_lock)) {
+		for (int i = 0; i < count; i++)
+			func(data, i);
+		return;
+	}
+
+	pthread_once(&threads_once, workers_start_threads);
+
+	/* Skip 0, which means we aren't decoding in parallel */
+	b.id = ++last_batch_id ?: ++last_batch_id;
+	b.logs = calloc(count, sizeof(*b.logs));
+	panwrap_timestamp_get(&b.timestamp);
+
+	pthread_mutex_lock(&queue_lock);
+	batch = &b;
+	pthread_cond_broadcast(&work_cond);
+
+	/* Pitch in until everything's been picked up, then wait for the rest */
+	while (b.next < b.count) {
+		int i = b.next++;
+
+		pthread_mutex_unlock(&queue_lock);
+		workers_run_item(&b, i, false);
+		pthread_mutex_lock(&queue_lock);
+		b.done++;
+	}
+	while (b.done < b.count)
+		pthread_cond_wait(&done_cond, &queue_lock);
+
+	batch = NULL;
+	pthread_mutex_unlock(&queue_lock);
+
+	for (int i = 0; i < count; i++)
+		panwrap_log_buffer_write(&b.logs[i]);
+	free(b.logs);
+
+	pthread_mutex_unlock(&batch_lock);
+}
+
+/**
+ * The ID of the parallel decoding batch the calling thread is working on, or
+ * 0 if it isn't decoding in parallel. Decoders use this to leave out anything
+ * that depends on the order atoms get decoded in.
+ */
+unsigned int
+panwrap_workers_batch()
+{
+	return current_batch_id;
+}
+
+static void __attribute__((constructor))
+panwrap_workers_init()
+{
+	nr_threads = MIN(MAX(panwrap_parse_env_long("PANWRAP_DECODE_THREADS", 1),
+			     1), MAX_THREADS);
+}
+
+static void __attribute__((destructor))
+panwrap_workers_fini()
+{
+	pthread_mutex_lock(&queue_lock);
+	stopping = true;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&queue_lock);
+
+	for (int i = 0; i < threads_started; i++)
+		pthread_join(threads[i], NULL);
+}
@@ -0,0 +1,22 @@
+/*
+ * © Copyright 2017 The BiOpenly Community
+ *
+ * This program is free software and is provided to you under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation, and any use by you of this program is subject to the terms
+ * of such GNU licence.
+ *
+ * A copy of the licence is included with the program, and can also be obtained
+ * from Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef __PANWRAP_WORKERS_H__
+#define __PANWRAP_WORKERS_H__
+
+void panwrap_workers_run(int count, void (*func)(void *data, int i),
+			 void *data);
+unsigned int panwrap_workers_batch();
+
+#endif /* __PANWRAP_WORKERS_H__ */
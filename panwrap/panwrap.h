@@ -21,15 +21,35 @@
 #define __WRAP_H__
 
 #include <dlfcn.h>
+#include <stdbool.h>
+#include <time.h>
+#include <linux/ioctl.h>
 #include <panloader-util.h>
 #include "panwrap-mmap.h"
 #include "panwrap-decoder.h"
+#include "panwrap-job-graph.h"
+#include "panwrap-shader.h"
+#include "panwrap-fragment.h"
+#include "panwrap-compute.h"
+#include "panwrap-indices.h"
+#include "panwrap-decode-cache.h"
+#include "panwrap-deferred.h"
+#include "panwrap-workers.h"
+#include "panwrap-sample.h"
+#include "panwrap-latency.h"
+#include "panwrap-capture.h"
+#include "panwrap-context.h"
 
 struct panwrap_flag_info {
 	u64 flag;
 	const char *name;
 };
 
+struct panwrap_enum_info {
+	u64 value;
+	const char *name;
+};
+
 #define PROLOG(func) 					\
 	static typeof(func) *orig_##func = NULL;	\
 	if (!orig_##func)				\
@@ -38,16 +58,38 @@ struct panwrap_flag_info {
 void __attribute__((format (printf, 1, 2))) panwrap_log(const char *format, ...);
 void __attribute__((format (printf, 1, 2))) panwrap_log_cont(const char *format, ...);
 void panwrap_log_flush();
+void panwrap_log_write(const char *text, size_t len);
+
+struct panwrap_log_buffer {
+	char *text;
+	size_t len;
+	size_t size;
+};
+
+void panwrap_log_capture(struct panwrap_log_buffer *buf);
+void panwrap_log_buffer_write(struct panwrap_log_buffer *buf);
+void panwrap_log_mute(bool mute);
 
 void panwrap_freeze_time();
 void panwrap_unfreeze_time();
+void panwrap_timestamp_get(struct timespec *tp);
+void panwrap_log_set_timestamp(const struct timespec *tp);
+u64 panwrap_monotonic_ns();
+
+bool panwrap_parse_env_bool(const char *env, bool def);
+long panwrap_parse_env_long(const char *env, long def);
+
+#define PANWRAP_HASH_INIT 0xcbf29ce484222325ull
+u64 panwrap_hash(const void *data, size_t size, u64 hash);
 
 void panwrap_log_decoded_flags(const struct panwrap_flag_info *flag_info,
 			       u64 flags);
+const char *panwrap_enum_name(const struct panwrap_enum_info *enum_info,
+			      u64 value);
 void panwrap_log_hexdump(const void *data, size_t size);
 void panwrap_log_hexdump_trimmed(const void *data, size_t size);
 
-extern short panwrap_indent;
+extern __thread short panwrap_indent;
 
 void * __rd_dlsym_helper(const char *name);
 